@@ -0,0 +1,57 @@
+#ifndef BATCH_PIPELINE_H
+#define BATCH_PIPELINE_H
+
+#include <sycl/sycl.hpp>
+#include <string>
+#include <vector>
+
+#include <image.h>
+
+struct BatchOptions
+{
+    std::string outDir = ".";       // where the <name>_sobel.png files go
+    bool pgmOutput = false;         // write <name>_sobel.pgm through a mapped file instead, no PNG encode
+    int decodeThreads = 0;          // <= 0: a quarter of the cores, at least 1
+    int encodeThreads = 0;          // <= 0: a quarter of the cores, at least 1
+    int queueDepth = 4;             // capacity of each queue between stages
+    int imagesInFlight = 2;         // images submitted to the device before waiting on the oldest
+    bool normalize = true;          // see SobelEdgesUint8Buffer
+    Border border = Border::Clamp;
+};
+
+struct BatchStats
+{
+    int imagesDone = 0;
+    int imagesFailed = 0;
+    double wallMs = 0.0;
+    // Time each stage spent working, summed over its threads
+    double decodeMs = 0.0;
+    double computeMs = 0.0;
+    double encodeMs = 0.0;
+};
+
+/****************************************************************************
+* Expand a batch argument to image paths. A directory gives the image files
+* it holds (png, jpg, jpeg, bmp, tga, pgm, ppm), sorted by name. Any other
+* path is read as a list file with one image path per line.
+* @param path Directory or list file.
+* @param paths[out] The image paths.
+* @return Ok, or FileIOFailure if path cannot be read.
+*****************************************************************************/
+Result ListBatchInputs(const std::string &path, std::vector<std::string> &paths);
+
+/****************************************************************************
+* Run the RGB to u8 edges filter over many images as a three stage pipeline:
+* decode (stbi_load) -> device compute -> encode (stbi_write_png). PGM and
+* PPM inputs are memory mapped instead of decoded.
+* Stages run on their own threads, linked by bounded queues, so the device
+* works on one image while others are being decoded and encoded. Throughput
+* is set by the slowest stage rather than the sum of the stages.
+* Images that fail to load or write are counted in stats.imagesFailed and
+* skipped.
+* @return Ok if every image was processed.
+*****************************************************************************/
+Result SobelBatchBuffer(sycl::queue &q, const std::vector<std::string> &paths,
+                        const BatchOptions &options, BatchStats &stats);
+
+#endif
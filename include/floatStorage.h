@@ -0,0 +1,96 @@
+#ifndef FLOAT_STORAGE_H
+#define FLOAT_STORAGE_H
+
+#include <cstdint>
+#include <cstring>
+
+/****************************************************************************
+* 16 bit storage types for the host (C++) path, see StoragePrecision. Both
+* are just the 16 bits and convert to and from float with static_cast, so
+* kernels can be templated on the storage type and do all their arithmetic
+* in float. Conversions round to nearest even.
+*****************************************************************************/
+
+inline uint32_t FloatBits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float BitsToFloat(uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// Not _Float16: without -mf16c compilers convert it with a library call per
+// value. Whole rows are converted with F16C by FloatToHalfRowSimd and
+// HalfToFloatRowSimd instead, this is the scalar fallback.
+struct HostHalf
+{
+    uint16_t bits = 0;
+
+    HostHalf() = default;
+    HostHalf(float f)
+    {
+        uint32_t u = FloatBits(f);
+        uint32_t sign = (u >> 16) & 0x8000u;
+        uint32_t absU = u & 0x7FFFFFFFu;
+        if (absU >= 0x7F800000u)                    // Inf or NaN
+        {
+            bits = static_cast<uint16_t>(sign | 0x7C00u | (absU > 0x7F800000u ? 0x200u : 0u));
+        }
+        else if (absU >= 0x477FF000u)               // rounds to above 65504
+        {
+            bits = static_cast<uint16_t>(sign | 0x7C00u);
+        }
+        else if (absU < 0x38800000u)                // half subnormal or 0
+        {
+            // Let the float adder do the rounding: 0.5f has the exponent
+            // that puts the half subnormal step in the last mantissa bit
+            float r = BitsToFloat(absU) + 0.5f;
+            bits = static_cast<uint16_t>(sign | (FloatBits(r) - 0x3F000000u));
+        }
+        else
+        {
+            uint32_t odd = (absU >> 13) & 1u;
+            absU += 0xC8000FFFu + odd;              // rebias exponent, round to nearest even
+            bits = static_cast<uint16_t>(sign | (absU >> 13));
+        }
+    }
+
+    operator float() const
+    {
+        uint32_t sign = static_cast<uint32_t>(bits & 0x8000u) << 16;
+        uint32_t exponent = (bits >> 10) & 0x1Fu;
+        uint32_t mantissa = bits & 0x3FFu;
+        if (exponent == 0x1Fu) return BitsToFloat(sign | 0x7F800000u | (mantissa << 13));
+        if (exponent == 0)                          // subnormal: mantissa * 2^-24
+        {
+            float f = static_cast<float>(mantissa) * (1.0f / 16777216.0f);
+            return sign ? -f : f;
+        }
+        return BitsToFloat(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+    }
+};
+
+struct HostBFloat16
+{
+    uint16_t bits = 0;
+
+    HostBFloat16() = default;
+    HostBFloat16(float f)
+    {
+        // Written without branches so loops of conversions vectorize
+        uint32_t u = FloatBits(f);
+        uint32_t rounded = (u + 0x7FFFu + ((u >> 16) & 1u)) >> 16;     // round to nearest even
+        uint32_t quietNan = (u >> 16) | 0x40u;
+        bits = static_cast<uint16_t>((u & 0x7FFFFFFFu) > 0x7F800000u ? quietNan : rounded);
+    }
+
+    operator float() const { return BitsToFloat(static_cast<uint32_t>(bits) << 16); }
+};
+
+#endif
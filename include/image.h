@@ -1,6 +1,15 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <sycl/sycl.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
 enum class Border : int
 {
     Clamp = 0,  // aaaaaa|abcdefgh|hhhhhhh
@@ -13,6 +22,16 @@ enum class Border : int
     Last = Constant      // Last useful value in the border enum
 };
 
+// Storage type of intermediate images (e.g. the Sobel gradients). The
+// arithmetic is always float, only the values kept in memory between
+// passes are rounded to this type.
+enum class StoragePrecision : int
+{
+    Float32 = 0,
+    Float16,    // IEEE half, 11 bit significand, max 65504
+    BFloat16,   // top 16 bits of a float, 8 bit significand, float's range
+};
+
 enum Result
 {
     Ok = 0,				//!< Operation completed successfully.
@@ -27,4 +46,237 @@ enum Result
     Unknown1				//!< Unknown error has occured.
 };
 
-#endif
\ No newline at end of file
+/****************************************************************************
+* Map coordinate i onto [0, n) for border mode B (see the Border enum).
+* Border::Constant returns -1 when i is outside, meaning "use the constant".
+* Inline so it can be used from SYCL kernels as well as host code.
+*****************************************************************************/
+template <Border B>
+inline int BorderIndex(int i, int n)
+{
+    if (i >= 0 && i < n) return i;
+
+    if constexpr (B == Border::Clamp)
+    {
+        return i < 0 ? 0 : n - 1;
+    }
+    else if constexpr (B == Border::Wrap)
+    {
+        int r = i % n;
+        return r < 0 ? r + n : r;
+    }
+    else if constexpr (B == Border::Reflect)
+    {
+        // The edge pixel is not repeated, the period is 2n - 2
+        if (n == 1) return 0;
+        int period = 2 * n - 2;
+        int r = i % period;
+        if (r < 0) r += period;
+        return r < n ? r : period - r;
+    }
+    else if constexpr (B == Border::Mirror)
+    {
+        // The edge pixel is repeated, the period is 2n
+        int period = 2 * n;
+        int r = i % period;
+        if (r < 0) r += period;
+        return r < n ? r : period - 1 - r;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+/****************************************************************************
+* Read pixel (x, y) from src (a pointer or an accessor) with border mode B.
+*****************************************************************************/
+template <Border B, typename Src>
+inline float BorderFetch(const Src &src, int x, int y, int sx, int sy, int pitch,
+                         float constant)
+{
+    int x1 = BorderIndex<B>(x, sx);
+    int y1 = BorderIndex<B>(y, sy);
+    if constexpr (B == Border::Constant)
+    {
+        if (x1 < 0 || y1 < 0) return constant;
+    }
+    return src[y1 * pitch + x1];
+}
+
+template <Border B>
+using BorderTag = std::integral_constant<Border, B>;
+
+/****************************************************************************
+* Turn a run time border mode into a compile time one: calls f(BorderTag<B>{})
+* so that the per pixel code is specialized for the border mode.
+* @return What f returns, or InvalidArgument for an unknown border.
+*****************************************************************************/
+template <typename F>
+inline Result DispatchBorder(Border border, F &&f)
+{
+    switch (border)
+    {
+    case Border::Clamp:    return f(BorderTag<Border::Clamp>{});
+    case Border::Wrap:     return f(BorderTag<Border::Wrap>{});
+    case Border::Reflect:  return f(BorderTag<Border::Reflect>{});
+    case Border::Mirror:   return f(BorderTag<Border::Mirror>{});
+    case Border::Constant: return f(BorderTag<Border::Constant>{});
+    default: return Result::InvalidArgument;
+    }
+}
+
+// Alignment of the rows of Image<T> in bytes: a cache line, and the widest
+// SIMD register (AVX-512)
+#define IMAGE_ROW_ALIGNMENT 64
+
+enum class ImageMemory : int
+{
+    Host = 0,   // aligned host allocation
+    UsmHost,    // sycl::aligned_alloc_host, pinned host memory the device reads directly
+    UsmShared,  // sycl::aligned_alloc_shared, migrates between host and device on use
+};
+
+/****************************************************************************
+* Image of T with interleaved channels and rows IMAGE_ROW_ALIGNMENT aligned.
+* Pitch() is the distance between rows in elements, at least
+* Width() * Channels(); the padding at the end of each row is zeroed on
+* allocation and otherwise left alone. Every kind of memory is host
+* accessible. Buffer() and UsmData() hand the same memory to SYCL without
+* a copy, so the image must outlive them.
+*****************************************************************************/
+template <typename T>
+class Image
+{
+    static_assert(IMAGE_ROW_ALIGNMENT % sizeof(T) == 0, "rows of T can't be aligned");
+
+public:
+    Image() = default;
+    Image(int width, int height, int channels = 1) { Allocate(nullptr, width, height, channels, ImageMemory::Host); }
+    Image(sycl::queue &q, int width, int height, int channels = 1,
+          ImageMemory memory = ImageMemory::UsmShared)
+    {
+        Allocate(&q, width, height, channels, memory);
+    }
+    ~Image() { Release(); }
+
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+    Image(Image &&other) noexcept { *this = std::move(other); }
+    Image &operator=(Image &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            data_ = std::exchange(other.data_, nullptr);
+            context_ = std::move(other.context_);
+            other.context_.reset();
+            memory_ = other.memory_;
+            width_ = std::exchange(other.width_, 0);
+            height_ = std::exchange(other.height_, 0);
+            channels_ = std::exchange(other.channels_, 0);
+            pitch_ = std::exchange(other.pitch_, 0);
+        }
+        return *this;
+    }
+
+    bool Empty() const { return data_ == nullptr; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int Channels() const { return channels_; }
+    ImageMemory Memory() const { return memory_; }
+    // Elements from one row to the next
+    size_t Pitch() const { return pitch_; }
+    size_t PitchBytes() const { return pitch_ * sizeof(T); }
+    // Elements of all the rows, padding included
+    size_t NumElements() const { return pitch_ * height_; }
+    // True if there is no padding, i.e. the pixels are contiguous
+    bool IsPacked() const { return pitch_ == static_cast<size_t>(width_) * channels_; }
+
+    T *Data() { return data_; }
+    const T *Data() const { return data_; }
+    T *Row(int y) { return data_ + y * pitch_; }
+    const T *Row(int y) const { return data_ + y * pitch_; }
+    T &At(int x, int y, int c = 0) { return Row(y)[x * channels_ + c]; }
+    const T &At(int x, int y, int c = 0) const { return Row(y)[x * channels_ + c]; }
+
+    // USM pointer for kernels, nullptr for ImageMemory::Host images
+    T *UsmData() { return memory_ == ImageMemory::Host ? nullptr : data_; }
+
+    // Buffer over all the rows, padding included, without a copy. The
+    // kernels index it with Pitch(). Destroying the buffer writes back in place.
+    sycl::buffer<T, 1> Buffer()
+    {
+        return sycl::buffer<T, 1>(data_, sycl::range<1>(NumElements()),
+                                  {sycl::property::buffer::use_host_ptr()});
+    }
+
+    // Copy width * channels elements per row from pSrc, srcPitch elements apart
+    void CopyFrom(const T *pSrc, size_t srcPitch)
+    {
+        for (int y = 0; y < height_; y++)
+        {
+            std::memcpy(Row(y), pSrc + y * srcPitch, static_cast<size_t>(width_) * channels_ * sizeof(T));
+        }
+    }
+
+    void CopyTo(T *pDst, size_t dstPitch) const
+    {
+        for (int y = 0; y < height_; y++)
+        {
+            std::memcpy(pDst + y * dstPitch, Row(y), static_cast<size_t>(width_) * channels_ * sizeof(T));
+        }
+    }
+
+private:
+    void Allocate(sycl::queue *q, int width, int height, int channels, ImageMemory memory)
+    {
+        if (width <= 0 || height <= 0 || channels <= 0) return;
+        const size_t rowBytes = static_cast<size_t>(width) * channels * sizeof(T);
+        const size_t pitchBytes = (rowBytes + IMAGE_ROW_ALIGNMENT - 1) / IMAGE_ROW_ALIGNMENT * IMAGE_ROW_ALIGNMENT;
+        const size_t count = pitchBytes / sizeof(T) * height;
+
+        if (q == nullptr || memory == ImageMemory::Host)
+        {
+            memory = ImageMemory::Host;
+            data_ = static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(IMAGE_ROW_ALIGNMENT)));
+        }
+        else
+        {
+            data_ = memory == ImageMemory::UsmHost
+                        ? sycl::aligned_alloc_host<T>(IMAGE_ROW_ALIGNMENT, count, *q)
+                        : sycl::aligned_alloc_shared<T>(IMAGE_ROW_ALIGNMENT, count, *q);
+            if (data_ == nullptr) throw std::bad_alloc();
+            context_ = q->get_context();
+        }
+        std::memset(static_cast<void *>(data_), 0, count * sizeof(T));
+        memory_ = memory;
+        width_ = width;
+        height_ = height;
+        channels_ = channels;
+        pitch_ = pitchBytes / sizeof(T);
+    }
+
+    void Release()
+    {
+        if (data_ != nullptr)
+        {
+            if (memory_ == ImageMemory::Host) ::operator delete(data_, std::align_val_t(IMAGE_ROW_ALIGNMENT));
+            else sycl::free(data_, *context_);
+        }
+        data_ = nullptr;
+        context_.reset();
+        width_ = height_ = channels_ = 0;
+        pitch_ = 0;
+    }
+
+    T *data_ = nullptr;
+    std::optional<sycl::context> context_;     // of USM allocations
+    ImageMemory memory_ = ImageMemory::Host;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    size_t pitch_ = 0;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <sycl/sycl.hpp>
+#include <cstdint>
+#include <string>
+
+#include <image.h>
+
+/****************************************************************************
+* A file mapped into memory, unmapped when destroyed. Read only mappings
+* share the page cache, so nothing is copied or decoded until the pages are
+* touched. Created files are mapped read/write and reach the disk when the
+* mapping is closed.
+*****************************************************************************/
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    Result OpenRead(const std::string &path);
+    // Create (or truncate) the file at size bytes and map it writable
+    Result Create(const std::string &path, size_t size);
+    void Close();
+
+    uint8_t *Data() { return static_cast<uint8_t *>(data_); }
+    const uint8_t *Data() const { return static_cast<const uint8_t *>(data_); }
+    size_t Size() const { return size_; }
+    bool Writable() const { return writable_; }
+
+private:
+    void *data_ = nullptr;
+    size_t size_ = 0;
+    bool writable_ = false;
+#ifdef _WIN32
+    void *file_ = nullptr;      // HANDLE
+    void *mapping_ = nullptr;   // HANDLE
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Most channels of a raw float image. Width * height * channels must also
+// fit in an int, the image functions index with int.
+#define RAW_FLOAT_MAX_CHANNELS 4
+
+enum class ImageFileFormat : int
+{
+    Pgm = 0,    // binary P5, 1 channel u8
+    Ppm,        // binary P6, 3 channel u8
+    RawFloat,   // RawFloatHeader then width * height * channels floats
+};
+
+// Header of the raw float format, in native byte order. 32 bytes so the
+// floats after it are 32 byte aligned in the page aligned mapping; a
+// headerSize that is not a multiple of 32 is rejected.
+struct RawFloatHeader
+{
+    char magic[4] = {'R', 'A', 'W', 'F'};
+    uint32_t headerSize = 32;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t channels = 0;
+    uint32_t reserved[3] = {};
+};
+static_assert(sizeof(RawFloatHeader) == 32, "RawFloatHeader keeps the floats 32 byte aligned");
+
+/****************************************************************************
+* Uncompressed image file accessed through a MappedFile: binary PGM/PPM with
+* maxval 255, or the raw float format. The pixels are used in place, there
+* is no decode into a separate allocation.
+*****************************************************************************/
+class MappedImage
+{
+public:
+    // Map an existing file read only. The format comes from its header.
+    Result Open(const std::string &path);
+    // Create a file of the given format and size, header filled in, for the
+    // pixels to be written in place. channels is for RawFloat (at most
+    // RAW_FLOAT_MAX_CHANNELS), Pgm has 1 and Ppm 3.
+    Result Create(const std::string &path, ImageFileFormat format, int width, int height, int channels = 1);
+    void Close() { file_.Close(); pixels_ = nullptr; }
+
+    ImageFileFormat Format() const { return format_; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int Channels() const { return channels_; }
+    size_t NumElements() const { return static_cast<size_t>(width_) * height_ * channels_; }
+    bool Writable() const { return file_.Writable(); }
+
+    // Pixels of Pgm and Ppm files
+    const uint8_t *Pixels() const { return pixels_; }
+    // Pixels of RawFloat files
+    const float *Floats() const { return reinterpret_cast<const float *>(pixels_); }
+    // The same for created files, nullptr for files opened read only
+    uint8_t *WritablePixels() { return Writable() ? pixels_ : nullptr; }
+    float *WritableFloats() { return reinterpret_cast<float *>(WritablePixels()); }
+
+private:
+    MappedFile file_;
+    uint8_t *pixels_ = nullptr;
+    ImageFileFormat format_ = ImageFileFormat::Pgm;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+};
+
+// True for the extensions MappedImage reads: .pgm, .ppm and .rawf
+bool IsMappedImagePath(const std::string &path);
+
+/****************************************************************************
+* Write width * height * channels elements to a new mapped file: u8 for Pgm
+* and Ppm, float for RawFloat.
+*****************************************************************************/
+Result WriteMappedImage(const std::string &path, ImageFileFormat format, const void *pData,
+                        int width, int height, int channels = 1);
+
+/****************************************************************************
+* Zero copy SYCL buffers over the mapped pixels. T is uint8_t for Pgm and Ppm,
+* float for RawFloat. The input buffer is read only and never writes back;
+* the output buffer writes back into the mapped file when destroyed. The
+* image must outlive the buffer.
+*****************************************************************************/
+template <typename T>
+sycl::buffer<T, 1> MappedInputBuffer(const MappedImage &image)
+{
+    const T *pData = reinterpret_cast<const T *>(image.Pixels());
+    return sycl::buffer<T, 1>(pData, sycl::range<1>(image.NumElements()),
+                              {sycl::property::buffer::use_host_ptr()});
+}
+
+template <typename T>
+sycl::buffer<T, 1> MappedOutputBuffer(MappedImage &image)
+{
+    T *pData = reinterpret_cast<T *>(image.WritablePixels());
+    return sycl::buffer<T, 1>(pData, sycl::range<1>(image.NumElements()),
+                              {sycl::property::buffer::use_host_ptr()});
+}
+
+#endif
@@ -1,6 +1,304 @@
+#ifndef IMAGE_UTILS_AGNOSTIC_H
+#define IMAGE_UTILS_AGNOSTIC_H
+
 #include <sycl/sycl.hpp>
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Default work-group tile of the fused Sobel kernels, until the tuner finds a
+// better one (see workGroupTuner.h). The local memory tile is
+// (SOBEL_TILE_HEIGHT + 2) x (SOBEL_TILE_WIDTH + 2) floats.
+#define SOBEL_TILE_WIDTH  16
+#define SOBEL_TILE_HEIGHT 16
+
+// luminance() weights (CIE 1931) premultiplied by 1/255, so u8 input needs
+// no divisions
+#define LUMA_SCALED_R (0.2126f / 255.0f)
+#define LUMA_SCALED_G (0.7152f / 255.0f)
+#define LUMA_SCALED_B (0.0722f / 255.0f)
+
+// Fixed point luminance weights (CIE 1931, as in luminance()) in 1/256ths.
+// They sum to 256 so white stays 255.
+#define LUMA_FIXED_R 54
+#define LUMA_FIXED_G 183
+#define LUMA_FIXED_B 19
+
+// Largest Gaussian radius with a fixed tap fast path (3, 5 and 7 taps)
+#define GAUSSIAN_FIXED_MAX_RADIUS 3
+
+// Default number of gradient orientation bins over 0 ... 180 degrees (20 degrees each)
+#define ORIENTATION_BINS 9
 
 extern SYCL_EXTERNAL float luminance(uint8_t r, uint8_t g, uint8_t b);
 
+/***************************************************************
+ Sampled Gaussian with standard deviation sigma > 0: 2r + 1 taps
+ with r = ceil(3 * sigma) (at least 1), normalized to sum 1.
+*/
+std::vector<float> GaussianKernel(float sigma);
+
+/***************************************************************
+ Integer version of luminance(), 0 ... 255 instead of 0 ... 1
+*/
+inline uint8_t LuminanceFixed(uint8_t r, uint8_t g, uint8_t b)
+{
+    return static_cast<uint8_t>((LUMA_FIXED_R * r + LUMA_FIXED_G * g + LUMA_FIXED_B * b + 128) >> 8);
+}
+
+/***************************************************************
+ Saturating u8 edge strength from integer Sobel gradients:
+ (|dx| + |dy|) >> shift, clamped to 255. The L1 norm avoids the
+ square root; on u8 input |dx| + |dy| <= 2040, so shift 3 can never
+ saturate and smaller shifts trade headroom for contrast.
+*/
+inline uint8_t SobelMagnitudeFixed(int dx, int dy, int shift)
+{
+    int mag = ((dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy)) >> shift;
+    return static_cast<uint8_t>(mag < 255 ? mag : 255);
+}
+
+/***************************************************************
+ Sobel gradients of the pixel at index c of a tile (e.g. a SYCL
+ local accessor) that is haloW wide. Shared by the buffer and USM
+ kernels. T is float for float tiles or int for u8 tiles.
+*/
+template <typename Tile, typename T>
+inline void SobelFromTile(const Tile &tile, int c, int haloW, T &dx, T &dy)
+{
+    T tl = tile[c - haloW - 1];
+    T t  = tile[c - haloW];
+    T tr = tile[c - haloW + 1];
+    T l  = tile[c - 1];
+    T r  = tile[c + 1];
+    T bl = tile[c + haloW - 1];
+    T b  = tile[c + haloW];
+    T br = tile[c + haloW + 1];
+
+    dx = (tl - tr) + 2 * (l - r) + (bl - br);
+    dy = (tl + 2 * t + tr) - (bl + 2 * b + br);
+}
+
+/***************************************************************
+ 3x3 stencil with integer coefficients fixed at compile time, in the
+ row major order of Convolution3x3Cpp's pFilter. Zero taps are never
+ read, +1 and -1 taps are an add or a subtract and only the others
+ multiply. The taps are accumulated in the same order as
+ Convolution3x3Cpp, so the result is the same as with the filter in
+ a float[9] (up to the sign of a zero).
+*/
+template <int C, typename F>
+inline void VisitStencilTap(F &f, int i)
+{
+    if constexpr (C != 0) f(std::integral_constant<int, C>(), i % 3 - 1, i / 3 - 1);
+}
+
+// value += C * v with the multiply left out for C = +-1
+template <int C, typename T>
+inline void AccumulateStencilTap(T &value, T v)
+{
+    if constexpr (C == 1) value += v;
+    else if constexpr (C == -1) value -= v;
+    else value += v * static_cast<T>(C);
+}
+
+template <int... C>
+struct Stencil3x3
+{
+    static_assert(sizeof...(C) == 9, "a 3x3 stencil has 9 coefficients");
+
+    static constexpr int coefficients[9] = {C...};
+
+    // Calls f(coefficient, k, l) for every non zero tap at column offset k
+    // and row offset l (-1 ... 1), the coefficient as an integral_constant
+    template <typename F>
+    static void ForEachTap(F &&f)
+    {
+        ForEachTap(f, std::make_integer_sequence<int, 9>());
+    }
+
+    // Weighted sum of the taps, fetch(k, l) returns the pixel at (x + k, y + l)
+    template <typename T, typename Fetch>
+    static T Apply(const Fetch &fetch)
+    {
+        T value = 0;
+        ForEachTap([&](auto c, int k, int l) {
+            AccumulateStencilTap<decltype(c)::value>(value, static_cast<T>(fetch(k, l)));
+        });
+        return value;
+    }
+
+private:
+    template <typename F, int... I>
+    static void ForEachTap(F &f, std::integer_sequence<int, I...>)
+    {
+        (VisitStencilTap<C>(f, I), ...);
+    }
+};
+
+using SobelXStencil    = Stencil3x3< 1,  0, -1,
+                                     2,  0, -2,
+                                     1,  0, -1>;
+using SobelYStencil    = Stencil3x3< 1,  2,  1,
+                                     0,  0,  0,
+                                    -1, -2, -1>;
+using ScharrXStencil   = Stencil3x3< 3,  0,  -3,
+                                    10,  0, -10,
+                                     3,  0,  -3>;
+using ScharrYStencil   = Stencil3x3< 3, 10,  3,
+                                     0,  0,  0,
+                                    -3,-10, -3>;
+using PrewittXStencil  = Stencil3x3< 1,  0, -1,
+                                     1,  0, -1,
+                                     1,  0, -1>;
+using PrewittYStencil  = Stencil3x3< 1,  1,  1,
+                                     0,  0,  0,
+                                    -1, -1, -1>;
+using LaplacianStencil = Stencil3x3< 0,  1,  0,
+                                     1, -4,  1,
+                                     0,  1,  0>;
+
+// Canny pixel states after non-maximum suppression and double thresholding
+#define CANNY_NONE   0
+#define CANNY_WEAK   1
+#define CANNY_STRONG 2
+
+/***************************************************************
+ Canny non-maximum suppression and double threshold of pixel (x, y).
+ dx, dy are its Sobel gradients (SobelFromTile's sign convention,
+ which doesn't change the orientation) and mag the gradient magnitude
+ image. The gradient orientation is quantized to 0, 45, 90 or 135
+ degrees and the pixel is kept only if its magnitude is not below its
+ two neighbours across the edge. Neighbours outside the image count as
+ 0. Shared by the C++ and SYCL paths.
+*/
+template <typename Mag>
+inline uint8_t CannyClassify(const Mag &mag, int x, int y, int width, int height,
+                             float dx, float dy, float lowThreshold, float highThreshold)
+{
+    const float tan22 = 0.41421356f;  // tan(22.5 degrees)
+    float adx = dx < 0 ? -dx : dx;
+    float ady = dy < 0 ? -dy : dy;
+    int ox, oy;     // step to the neighbour along the gradient
+    if (ady <= tan22 * adx)      { ox = 1; oy = 0; }
+    else if (adx <= tan22 * ady) { ox = 0; oy = 1; }
+    else if ((dx > 0) == (dy > 0)) { ox = 1; oy = 1; }
+    else                         { ox = 1; oy = -1; }
+
+    float m = mag[y * width + x];
+    if (m < lowThreshold) return CANNY_NONE;
+    int x1 = x + ox, y1 = y + oy;
+    int x2 = x - ox, y2 = y - oy;
+    float m1 = (x1 >= 0 && x1 < width && y1 >= 0 && y1 < height) ? float(mag[y1 * width + x1]) : 0.0f;
+    float m2 = (x2 >= 0 && x2 < width && y2 >= 0 && y2 < height) ? float(mag[y2 * width + x2]) : 0.0f;
+    if (m < m1 || m < m2) return CANNY_NONE;
+    return m >= highThreshold ? CANNY_STRONG : CANNY_WEAK;
+}
+
+/***************************************************************
+ True if one of the 8 neighbours of index c in a tile (or image)
+ that is pitch wide is CANNY_STRONG. The caller keeps c off the
+ outer ring.
+*/
+template <typename Tile>
+inline bool CannyHasStrongNeighbour(const Tile &tile, int c, int pitch)
+{
+    return tile[c - pitch - 1] == CANNY_STRONG || tile[c - pitch] == CANNY_STRONG ||
+           tile[c - pitch + 1] == CANNY_STRONG || tile[c - 1] == CANNY_STRONG ||
+           tile[c + 1] == CANNY_STRONG || tile[c + pitch - 1] == CANNY_STRONG ||
+           tile[c + pitch] == CANNY_STRONG || tile[c + pitch + 1] == CANNY_STRONG;
+}
+
+/***************************************************************
+ Unsigned orientation of the gradient (dx, dy) quantized to one of
+ numBins bins over 0 ... 180 degrees: (dx, dy) and (-dx, -dy) fall in
+ the same bin. Bin b starts at b * 180 / numBins degrees. Shared by
+ the C++ and SYCL paths.
+*/
+inline uint8_t QuantizeOrientation(float dx, float dy, int numBins)
+{
+    const float pi = 3.14159265f;
+    float angle = sycl::atan2(dy, dx);     // -pi ... pi
+    if (angle < 0.0f) angle += pi;
+    int bin = static_cast<int>(angle * (numBins / pi));
+    return static_cast<uint8_t>(bin < numBins ? bin : 0);   // 180 degrees is 0
+}
+
+/***************************************************************
+ Histogram of oriented gradients layout. The image is cut into
+ cellSize x cellSize cells (partial cells at the right and bottom
+ are left out), each a histogram of numBins orientations weighted by
+ the gradient magnitude. Blocks of blockSize x blockSize cells, one
+ cell apart, are normalized separately and concatenated: the
+ descriptor holds blocksX * blocksY blocks of
+ blockSize * blockSize * numBins floats, in row major order.
+*/
+struct HogOptions
+{
+    int cellSize = 8;
+    int blockSize = 2;
+    int numBins = ORIENTATION_BINS;
+    float clip = 0.2f;      // L2-Hys clipping of the normalized block
+};
+
+inline bool HogOptionsValid(const HogOptions &options)
+{
+    return options.cellSize > 0 && options.blockSize > 0 && options.numBins > 0 &&
+           options.numBins <= 255 && options.clip > 0.0f;
+}
+
+inline int HogBlocksX(int width, const HogOptions &options)
+{
+    return std::max(width / options.cellSize - options.blockSize + 1, 0);
+}
+
+inline int HogBlocksY(int height, const HogOptions &options)
+{
+    return std::max(height / options.cellSize - options.blockSize + 1, 0);
+}
+
+// Floats in the descriptor of a width x height image, 0 if it has no block
+inline size_t HogDescriptorSize(int width, int height, const HogOptions &options)
+{
+    return static_cast<size_t>(HogBlocksX(width, options)) * HogBlocksY(height, options) *
+           options.blockSize * options.blockSize * options.numBins;
+}
+
+/***************************************************************
+ L2-Hys normalization of the block whose top left cell is (bx, by)
+ into out[outOffset ...]: the cell histograms of the block are L2
+ normalized, clipped at clip and L2 normalized again. cells holds
+ numBins floats per cell, cellsX cells per row. Shared by the C++ and
+ SYCL paths.
+*/
+template <typename Cells, typename Out>
+inline void HogNormalizeBlock(const Cells &cells, const Out &out, size_t outOffset, int bx, int by,
+                              int cellsX, int blockSize, int numBins, float clip)
+{
+    const float eps = 1e-6f;
+    const int blockLength = blockSize * blockSize * numBins;
+    float sum = 0.0f;
+    for (int i = 0; i < blockLength; i++)
+    {
+        int cell = i / numBins;
+        float v = cells[(static_cast<size_t>(by + cell / blockSize) * cellsX + bx + cell % blockSize) * numBins +
+                        i % numBins];
+        out[outOffset + i] = v;
+        sum += v * v;
+    }
+    float scale = 1.0f / sycl::sqrt(sum + eps);
+    sum = 0.0f;
+    for (int i = 0; i < blockLength; i++)
+    {
+        float v = sycl::min(out[outOffset + i] * scale, clip);
+        out[outOffset + i] = v;
+        sum += v * v;
+    }
+    scale = 1.0f / sycl::sqrt(sum + eps);
+    for (int i = 0; i < blockLength; i++) out[outOffset + i] *= scale;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef IMAGE_UTILS_SIMD_CPP_H
+#define IMAGE_UTILS_SIMD_CPP_H
+
+#include <cstdint>
+
+// x86 SIMD kernels for the host (C++) path. They are only built for the host
+// pass of the compiler, and picked at run time based on what the CPU supports.
+#if !defined(__SYCL_DEVICE_ONLY__) && (defined(__x86_64__) || defined(_M_X64)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define IMAGE_UTILS_X86_SIMD 1
+#else
+#define IMAGE_UTILS_X86_SIMD 0
+#endif
+
+enum class SimdLevel : int
+{
+    Scalar = 0,
+    Avx2,
+    Avx512
+};
+
+// Widest SIMD level in use. Defaults to the best one the CPU supports.
+SimdLevel GetSimdLevel();
+
+// Limit the SIMD level, e.g. to compare against the scalar code. Levels the
+// CPU doesn't support are ignored. Returns the level now in use.
+SimdLevel SetSimdLevel(SimdLevel level);
+
+/****************************************************************************
+* Apply a 3x3 filter to the interior pixels [x0, x1) of one row. All the taps
+* must be inside the image, i.e. x0 >= 1 and x1 <= width - 1. The taps are
+* accumulated in the same order as Convolution3x3Cpp so the results are
+* identical to the scalar code.
+* @param pOut[out] Output row.
+* @param pUp, pMid, pDown Input rows y - 1, y and y + 1.
+* @param pFilter Filter coefficients to apply.  Must be float[9].
+* @return First x not processed. Whatever is left is less than one vector
+*         and is up to the caller.
+*****************************************************************************/
+int Convolution3x3RowSimd(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, const float* pFilter, int x0, int x1);
+
+/****************************************************************************
+* Convolution3x3RowSimd with the coefficients of a Stencil3x3 S fixed at
+* compile time: zero taps are skipped and +-1 taps are adds or subtracts.
+* Instantiated for the stencils in imageUtilsAgnostic.h.
+* @return First x not processed.
+*****************************************************************************/
+template <typename S>
+int StencilRowSimd(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, int x0, int x1);
+
+/****************************************************************************
+* Fixed point Sobel magnitude of the interior pixels [x0, x1) of one row of
+* a u8 gray image, with the same limits on x0 and x1 as above. Gradients are
+* accumulated in int16 (16 pixels per AVX2 vector, 32 with AVX-512BW) and the
+* result is SobelMagnitudeFixed, bit exact with the scalar code.
+* @param pOut[out] Output row.
+* @param pUp, pMid, pDown Input rows y - 1, y and y + 1.
+* @param shift Right shift applied to |dx| + |dy|.
+* @return First x not processed.
+*****************************************************************************/
+int SobelFixedRowSimd(uint8_t* pOut, const uint8_t* pUp, const uint8_t* pMid,
+                      const uint8_t* pDown, int x0, int x1, int shift);
+
+/****************************************************************************
+* luminance() of n interleaved u8 pixels, 16 per iteration. The channels are
+* deinterleaved with byte shuffles and weighted with the premultiplied
+* LUMA_SCALED_* weights in the same order as luminance(), so the results are
+* identical to the scalar code.
+* @param pOut[out] n gray values, 0 ... 1.
+* @param pIn Interleaved RGB (numChannels 3) or RGBA (4) pixels.
+* @return First pixel not converted. Other channel counts convert nothing.
+*****************************************************************************/
+int ConvertToGrayscaleRowSimd(float* pOut, const uint8_t* pIn, int numChannels, int n);
+
+/****************************************************************************
+* Convert n floats to IEEE half bits, rounding to nearest even, and back.
+* Same results as HostHalf in floatStorage.h.
+* @return First index not converted, up to the caller.
+*****************************************************************************/
+int FloatToHalfRowSimd(uint16_t* pDst, const float* pSrc, int n);
+
+int HalfToFloatRowSimd(float* pDst, const uint16_t* pSrc, int n);
+
+#endif
@@ -1,9 +1,20 @@
 #include <sycl/sycl.hpp>
 #include <array>
 
-extern int FindMaxValBuffer(sycl::queue &q,
-                      sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
-                      int width, int height, int numChannels);
+#include <image.h>
+#include <imageUtilsAgnostic.h>
+
+// Max (or max absolute) value of the image, written to max_out_buffer[0] on the device
+extern void FindMaxValBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &max_out_buffer, // 1 element
+                      int width, int height, bool absMax = false);
+
+// Scale the image in place by 1 / max_buffer[0]
+extern void ScaleImgBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_image_buffer, // input and output
+                      sycl::buffer<float, 1> &max_buffer,
+                      int width, int height);
 
 extern void ConvertToGrayscaleBuffer(sycl::queue &q,
                       sycl::buffer<uint8_t, 1> &u8_image_in_buffer, // input
@@ -24,13 +35,266 @@ extern void InitUint8SyclBuffer1(sycl::queue &q,
                       //buffer &u8_buffer, // input and output
                       int width, int height, uint8_t value);
 
+extern void ComputeMagnitudeBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in0_buffer,
+                      sycl::buffer<float, 1> &fl_in1_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height);
+
+// Device version of Convolution3x3Cpp. pFilter must be float[9].
+extern Result Convolution3x3Buffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      const float *pFilter,
+                      int width, int height,
+                      Border border = Border::Clamp, float constant = 0.0f);
+
+// The same on Image<float>s, used in place. in and out must be single channel
+// and the same size. Returns once out holds the result.
+extern Result Convolution3x3Buffer(sycl::queue &q,
+                      Image<float> &in,
+                      Image<float> &out,
+                      const float *pFilter,
+                      Border border = Border::Clamp, float constant = 0.0f);
+
+// Device version of StencilCpp, for the stencils of imageUtilsAgnostic.h
+template <typename S>
+extern Result StencilBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height,
+                      Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Separable filter on the device, see SeparableFilterCpp. kernelX is applied
+* along rows then kernelY along columns. Both must have an odd length.
+* @return Ok, or InvalidArgument for an even or empty kernel.
+*****************************************************************************/
+extern Result SeparableFilterBuffer(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 const std::vector<float> &kernelX,
+                 const std::vector<float> &kernelY,
+                 int width, int height,
+                 Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Gaussian blur on the device, see GaussianBlurCpp. 3, 5 and 7 tap kernels
+* (sigma <= 1) use fixed tap kernels, larger ones SeparableFilterBuffer.
+* @return Ok, or InvalidArgument if sigma is not positive.
+*****************************************************************************/
+extern Result GaussianBlurBuffer(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height, float sigma,
+                 Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Holds the device only scratch memory (dx, dy, their horizontal pass
+* temporaries and the normalization max) used by the separable SobelFilter, so it can be reused
+* frame after frame. Create one per (width, height, device).
+* precision is the storage type of the scratch images; Float16 and BFloat16
+* halve their memory and traffic, the kernels still compute in float.
+* Destroying it doesn't wait for its kernels, the memory goes back to the
+* device pool once they are done.
+*****************************************************************************/
+class SobelContext
+{
+public:
+    SobelContext(sycl::queue &q, int width, int height,
+                 StoragePrecision precision = StoragePrecision::Float32);
+    ~SobelContext();
+    SobelContext(const SobelContext &) = delete;
+    SobelContext &operator=(const SobelContext &) = delete;
+
+    sycl::queue &Queue() { return queue_; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    StoragePrecision Precision() const { return precision_; }
+    // Device memory owned by the context, in bytes
+    size_t BytesAllocated() const { return bytesAllocated_; }
+    // True if the context can be used for this queue's device and image size
+    bool IsCompatible(const sycl::queue &q, int width, int height) const;
+
+private:
+    friend void SobelFilter(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 Border border, float constant);
+    friend Result CannyBufferOrThrow(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 float sigma, float lowThreshold, float highThreshold);
+    void Release();
+
+    sycl::queue queue_;
+    int width_;
+    int height_;
+    StoragePrecision precision_;
+    size_t bytesAllocated_ = 0;
+    void *dx_ = nullptr;        // float, sycl::half or bfloat16 images, see precision_
+    void *dy_ = nullptr;
+    void *dxTmp_ = nullptr;
+    void *dyTmp_ = nullptr;
+    float *maxVal_ = nullptr;   // device side max of dx and dy
+    sycl::event lastUse_;   // last kernel that touched the scratch memory
+};
+
+// Per frame Sobel using the context's scratch memory. Does no allocations.
+// The default border clamps, like the *Cpp functions. constant is only used by Border::Constant.
+extern void SobelFilter(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 Border border = Border::Clamp, float constant = 0.0f);
+
+// One shot version with its own context. Like the above it only submits,
+// it doesn't wait for the kernels.
 extern void SobelFilter(sycl::queue &q,
                  sycl::buffer<float, 1> &fl_in_buffer,
                  sycl::buffer<float, 1> &fl_out_buffer,
-                 int width, int height);
+                 int width, int height,
+                 Border border = Border::Clamp, float constant = 0.0f,
+                 StoragePrecision precision = StoragePrecision::Float32);
+
+// Tiled version of SobelFilter, in three submissions: a fill of the max, one
+// local memory tiled kernel for the magnitude and the max, and a scale pass
+// that reads and writes the output once more
+extern void SobelFilterFused(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height,
+                 Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Fused grayscale + Sobel + u8 conversion. Reads interleaved u8 RGB or RGBA
+* (numChannels 3 or 4, 1 for gray) and writes the u8 edge magnitude, with no full frame
+* float intermediates.
+* @param normalize Scale by the max gradient like SobelFilter (two passes over
+*                  the input). Otherwise use a fixed scale in a single pass.
+*****************************************************************************/
+extern void SobelEdgesUint8Buffer(sycl::queue &q,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 bool normalize = true,
+                 Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Integer Sobel for 8 bit input, see SobelFixedCpp: fixed point luminance,
+* integer gradients and a saturating u8 magnitude (|dx| + |dy|) >> shift.
+* Single pass with no normalization, so no float data at all.
+*****************************************************************************/
+extern void SobelFixedBuffer(sycl::queue &q,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 int shift = 2,
+                 Border border = Border::Clamp, uint8_t constant = 0);
+
+/****************************************************************************
+* Canny edge detection on the device: Gaussian pre-blur, SobelFilter
+* gradients, non-maximum suppression, double threshold and parallel
+* hysteresis, with every intermediate kept on the device.
+* @param sigma Pre-blur, 0 to skip it.
+* @param lowThreshold, highThreshold Thresholds on the normalized Sobel
+*        magnitude (SobelFilter's output). Pixels above highThreshold are
+*        edges, pixels above lowThreshold are edges if connected to one.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+extern Result CannyBuffer(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 float sigma = 1.0f, float lowThreshold = 0.1f, float highThreshold = 0.3f);
+
+extern Result CannyBuffer(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height,
+                 float sigma = 1.0f, float lowThreshold = 0.1f, float highThreshold = 0.3f);
+
+/****************************************************************************
+* Sobel magnitude and quantized gradient orientation in a single tiled
+* kernel, see SobelMagnitudeOrientationCpp.
+* @param fl_magnitude_buffer[out] SobelFilter's normalized magnitude.
+* @param u8_orientation_buffer[out] Orientation bin per pixel, see
+*        QuantizeOrientation.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+extern Result SobelMagnitudeOrientationBuffer(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_magnitude_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_orientation_buffer,
+                 int width, int height, int numBins = ORIENTATION_BINS,
+                 Border border = Border::Clamp, float constant = 0.0f);
 
+/****************************************************************************
+* Histogram of oriented gradients on the device, see HogOptions for the
+* layout. The cell histograms are built in local memory, so cellSize *
+* cellSize must fit in a work-group. Same descriptor as HogCpp up to float
+* rounding.
+* @param fl_descriptor_buffer[out] At least HogDescriptorSize() floats.
+* @return Ok, or InvalidArgument (also if the image has no full block).
+*****************************************************************************/
+extern Result HogBuffer(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_magnitude_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_orientation_buffer,
+                 sycl::buffer<float, 1> &fl_descriptor_buffer,
+                 int width, int height, const HogOptions &options = HogOptions());
 
+/****************************************************************************
+* The functions above whose kernels TuneWorkGroups times, without their
+* catch: an exception from the runtime, e.g. for a work-group size the
+* kernel can't run with, goes to the caller instead of terminating. All the
+* arguments must be given. An invalid border mode returns InvalidArgument.
+*****************************************************************************/
+extern Result Convolution3x3BufferOrThrow(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      const float *pFilter,
+                      int width, int height,
+                      Border border, float constant);
 
+template <typename S>
+extern Result StencilBufferOrThrow(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height,
+                      Border border, float constant);
 
+extern Result SeparableFilterBufferOrThrow(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 const std::vector<float> &kernelX,
+                 const std::vector<float> &kernelY,
+                 int width, int height,
+                 Border border, float constant);
 
+extern Result GaussianBlurBufferOrThrow(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height, float sigma,
+                 Border border, float constant);
 
+extern Result SobelFilterFusedOrThrow(sycl::queue &q,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height,
+                 Border border, float constant);
+
+extern Result SobelEdgesUint8BufferOrThrow(sycl::queue &q,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 bool normalize, Border border, float constant);
+
+// InvalidArgument also for a shift outside 0 ... 15 or no channels
+extern Result SobelFixedBufferOrThrow(sycl::queue &q,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 int shift, Border border, uint8_t constant);
+
+extern Result CannyBufferOrThrow(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 float sigma, float lowThreshold, float highThreshold);
@@ -2,6 +2,11 @@
 #include <array>
 
 #include <image.h>
+#include <threadPool.h>
+#include <imageUtilsAgnostic.h>
+
+// Rows per band handed to a thread by the ThreadPool versions below
+#define HOST_BAND_ROWS 16
 
 float FindMaxCpp(const float *fl_image_in, // input const
                       int width, int height);
@@ -33,12 +38,201 @@ void ConvertToUint8Cpp(
 * @param pIn Input image.
 * @param pFilter Filter coefficients to apply.  Must be float[9].
 * @param border Controls border element processing.
-* @param vectorize
+* @param constant Value used outside the image for Border::Constant.
 * @return Ok if the filter is applied successfully.
 *****************************************************************************/
 Result Convolution3x3Cpp(float* pOut, const float* pIn, const float* pFilter, 
-                      int sx, int sy, int pitch, Border border);
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+/****************************************************************************
+* Convolution3x3Cpp with the coefficients of a Stencil3x3 fixed at compile
+* time, e.g. StencilCpp<SobelXStencil>(...). Zero taps cost nothing and
+* +-1 taps no multiply. Same result as Convolution3x3Cpp with the stencil's
+* coefficients. Provided for the Sobel, Scharr, Prewitt and Laplacian
+* stencils of imageUtilsAgnostic.h.
+* @return Ok if the filter is applied successfully.
+*****************************************************************************/
+template <typename S>
+Result StencilCpp(float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+/****************************************************************************
+* Apply a separable filter: pKernelX along rows, then pKernelY along columns.
+* Both are correlated with the image, i.e. pKernel[0] weighs x - r (or y - r).
+* For example the Sobel x gradient is pKernelX = {1, 0, -1}, pKernelY = {1, 2, 1}.
+* @param pOut[out] Output filtered image. Must not be pIn.
+* @param pIn Input image.
+* @param pKernelX, kxSize Horizontal kernel, any odd length.
+* @param pKernelY, kySize Vertical kernel, any odd length.
+* @param border Controls border element processing.
+* @param constant Value used outside the image for Border::Constant.
+* @return Ok if the filter is applied successfully.
+*****************************************************************************/
+Result SeparableFilterCpp(float* pOut, const float* pIn,
+                      const float* pKernelX, int kxSize,
+                      const float* pKernelY, int kySize,
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+/****************************************************************************
+* Gaussian blur with standard deviation sigma, e.g. to denoise before edge
+* detection. The kernel is GaussianKernel(sigma): radius ceil(3 * sigma),
+* normalized to sum 1. 3, 5 and 7 tap kernels (sigma <= 1) use fixed tap
+* passes, larger ones the separable filter.
+* @param pOut[out] Output image. Must not be pIn.
+* @param sigma Standard deviation in pixels, > 0.
+* @param border Controls border element processing.
+* @param constant Value used outside the image for Border::Constant.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+Result GaussianBlurCpp(float* pOut, const float* pIn, int sx, int sy, int pitch,
+                      float sigma, Border border = Border::Clamp, float constant = 0.0f);
 
+// precision sets the storage type of the gradient images, see StoragePrecision.
+// constant is only used by Border::Constant.
 void SobelFilterCpp(std::vector<float> &fl_in_buffer, // a grayscale buffer with 1 channel
                  std::vector<float> &fl_out_buffer,
-                 int width, int height);
\ No newline at end of file
+                 int width, int height, Border border = Border::Clamp, float constant = 0.0f,
+                 StoragePrecision precision = StoragePrecision::Float32);
+
+/****************************************************************************
+* Multithreaded versions of the above. The image is split into bands of
+* HOST_BAND_ROWS rows that run on the pool. Results are identical to the
+* single threaded versions.
+*****************************************************************************/
+float FindMaxCpp(ThreadPool &pool, const float *fl_image_in, // input const
+                      int width, int height);
+
+void ScaleImgCpp(ThreadPool &pool,
+                      const float *fl_image_in, // input const
+                      float *fl_image_out, // output
+                      int width, int height, 
+                      float scale);
+
+void ComputeMagnitudeCpp(ThreadPool &pool,
+                      const float *fl_image_in0, // input const
+                      const float *fl_image_in1, // input const
+                      std::vector<float> &fl_image_out, // output
+                      int width, int height);
+
+Result Convolution3x3Cpp(ThreadPool &pool, float* pOut, const float* pIn, const float* pFilter, 
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+template <typename S>
+Result StencilCpp(ThreadPool &pool, float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+Result SeparableFilterCpp(ThreadPool &pool, float* pOut, const float* pIn,
+                      const float* pKernelX, int kxSize,
+                      const float* pKernelY, int kySize,
+                      int sx, int sy, int pitch, Border border, float constant = 0.0f);
+
+Result GaussianBlurCpp(ThreadPool &pool, float* pOut, const float* pIn, int sx, int sy, int pitch,
+                      float sigma, Border border = Border::Clamp, float constant = 0.0f);
+
+/****************************************************************************
+* Image<float> versions of Convolution3x3Cpp and GaussianBlurCpp. out and in
+* must be single channel and the same size; the pitch comes from the images.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+Result Convolution3x3Cpp(Image<float> &out, const Image<float> &in, const float* pFilter,
+                      Border border, float constant = 0.0f);
+
+Result Convolution3x3Cpp(ThreadPool &pool, Image<float> &out, const Image<float> &in, const float* pFilter,
+                      Border border, float constant = 0.0f);
+
+Result GaussianBlurCpp(Image<float> &out, const Image<float> &in, float sigma,
+                      Border border = Border::Clamp, float constant = 0.0f);
+
+Result GaussianBlurCpp(ThreadPool &pool, Image<float> &out, const Image<float> &in, float sigma,
+                      Border border = Border::Clamp, float constant = 0.0f);
+
+void SobelFilterCpp(ThreadPool &pool,
+                 std::vector<float> &fl_in_buffer, // a grayscale buffer with 1 channel
+                 std::vector<float> &fl_out_buffer,
+                 int width, int height, Border border = Border::Clamp, float constant = 0.0f,
+                 StoragePrecision precision = StoragePrecision::Float32);
+
+/****************************************************************************
+* Integer Sobel for 8 bit input: fixed point luminance, int16 gradients and
+* a saturating u8 magnitude min((|dx| + |dy|) >> shift, 255). Unlike
+* SobelFilterCpp there is no max normalization.
+* @param pOut[out] Edges, width * height u8.
+* @param pIn Interleaved u8 image, numChannels per pixel. 1 or 2 channels
+*            are taken as gray, 3 or more as RGB(A).
+* @param shift Scale of the magnitude, 0 ... 15. 3 never saturates.
+* @param border Controls border element processing.
+* @param constant Gray value used outside the image for Border::Constant.
+* @return Ok if the filter is applied successfully.
+*****************************************************************************/
+Result SobelFixedCpp(uint8_t* pOut, const uint8_t* pIn, int width, int height, int numChannels,
+                      int shift = 2, Border border = Border::Clamp, uint8_t constant = 0);
+
+Result SobelFixedCpp(ThreadPool &pool, uint8_t* pOut, const uint8_t* pIn, int width, int height,
+                      int numChannels, int shift = 2, Border border = Border::Clamp, uint8_t constant = 0);
+
+struct ImageDiff
+{
+    float maxAbsError = 0.0f;
+    float meanAbsError = 0.0f;
+    float psnr = 0.0f;          // dB against peak, infinite if the images are equal
+};
+
+/****************************************************************************
+* Accuracy of pTest against the reference pRef, e.g. a reduced storage
+* precision against the float path.
+* @param peak Largest value of the images, 1 for normalized images.
+*****************************************************************************/
+ImageDiff CompareImagesCpp(const float *pRef, const float *pTest, int width, int height,
+                      float peak = 1.0f);
+
+/****************************************************************************
+* Canny edge detection: Gaussian pre-blur, Sobel gradients, non-maximum
+* suppression, double threshold and hysteresis. Same edges as CannyBuffer.
+* @param u8_edges_out[out] width * height, 255 on edges and 0 elsewhere.
+* @param fl_gray Grayscale image, 1 channel.
+* @param sigma Pre-blur, 0 to skip it.
+* @param lowThreshold, highThreshold Thresholds on the normalized Sobel
+*        magnitude (SobelFilterCpp's output). Pixels above highThreshold are
+*        edges, pixels above lowThreshold are edges if connected to one.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+Result CannyCpp(std::vector<uint8_t> &u8_edges_out, const std::vector<float> &fl_gray,
+                 int width, int height, float sigma = 1.0f,
+                 float lowThreshold = 0.1f, float highThreshold = 0.3f);
+
+Result CannyCpp(ThreadPool &pool, std::vector<uint8_t> &u8_edges_out, const std::vector<float> &fl_gray,
+                 int width, int height, float sigma = 1.0f,
+                 float lowThreshold = 0.1f, float highThreshold = 0.3f);
+
+/****************************************************************************
+* Sobel magnitude and quantized gradient orientation from the same pass, for
+* callers that need the direction too (e.g. HogCpp).
+* @param fl_magnitude_out[out] SobelFilterCpp's normalized magnitude.
+* @param u8_orientation_out[out] Orientation bin per pixel, see
+*        QuantizeOrientation.
+* @param numBins Orientation bins over 0 ... 180 degrees, 1 ... 255.
+* @return Ok, or InvalidArgument.
+*****************************************************************************/
+Result SobelMagnitudeOrientationCpp(const std::vector<float> &fl_in,
+                 std::vector<float> &fl_magnitude_out, std::vector<uint8_t> &u8_orientation_out,
+                 int width, int height, int numBins = ORIENTATION_BINS, Border border = Border::Clamp);
+
+Result SobelMagnitudeOrientationCpp(ThreadPool &pool, const std::vector<float> &fl_in,
+                 std::vector<float> &fl_magnitude_out, std::vector<uint8_t> &u8_orientation_out,
+                 int width, int height, int numBins = ORIENTATION_BINS, Border border = Border::Clamp);
+
+/****************************************************************************
+* Histogram of oriented gradients, see HogOptions for the layout. Same
+* descriptor as HogBuffer up to float rounding.
+* @param descriptor[out] HogDescriptorSize() floats.
+* @param fl_magnitude, u8_orientation SobelMagnitudeOrientationCpp's output,
+*        with options.numBins bins.
+* @return Ok, or InvalidArgument (also if the image has no full block).
+*****************************************************************************/
+Result HogCpp(std::vector<float> &descriptor, const std::vector<float> &fl_magnitude,
+                 const std::vector<uint8_t> &u8_orientation, int width, int height,
+                 const HogOptions &options = HogOptions());
+
+Result HogCpp(ThreadPool &pool, std::vector<float> &descriptor, const std::vector<float> &fl_magnitude,
+                 const std::vector<uint8_t> &u8_orientation, int width, int height,
+                 const HogOptions &options = HogOptions());
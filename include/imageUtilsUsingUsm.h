@@ -0,0 +1,42 @@
+#ifndef IMAGE_UTILS_USING_USM_H
+#define IMAGE_UTILS_USING_USM_H
+
+#include <sycl/sycl.hpp>
+#include <vector>
+
+#include <image.h>
+
+/****************************************************************************
+* USM versions of the filter pipeline. All pointers are device (or shared)
+* USM allocations. Every function only submits work: it waits for deps,
+* returns the event of its last kernel and never blocks the host, so a whole
+* pipeline can be chained with events on an in-order queue.
+*****************************************************************************/
+
+extern sycl::event ConvertToGrayscaleUsm(sycl::queue &q,
+                      const uint8_t *u8_image_in, // input
+                      float *fl_gray,             // output
+                      int width, int height, int numChannels,
+                      const std::vector<sycl::event> &deps = {});
+
+/****************************************************************************
+* Single kernel, local memory tiled Sobel (see SobelFilterFused), normalized
+* by the max gradient like SobelFilterCpp.
+* @param fl_max Device scratch for the max, 1 float. Reused from frame to
+*               frame, it must not be shared by pipelines running at once.
+*****************************************************************************/
+extern sycl::event SobelFilterUsm(sycl::queue &q,
+                      const float *fl_in,  // a grayscale image with 1 channel
+                      float *fl_out,
+                      float *fl_max,
+                      int width, int height,
+                      Border border = Border::Clamp, float constant = 0.0f,
+                      const std::vector<sycl::event> &deps = {});
+
+extern sycl::event ConvertToUint8Usm(sycl::queue &q,
+                      const float *fl_in,  // input. normalized to 0 ... 1
+                      uint8_t *u8_out,
+                      int width, int height,
+                      const std::vector<sycl::event> &deps = {});
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+#include <sycl/sycl.hpp>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class PoolMemory : int
+{
+    Host = 0,   // plain host memory
+    UsmDevice,  // sycl::malloc_device
+    UsmHost,    // sycl::malloc_host
+};
+
+struct PoolStats
+{
+    size_t hits = 0;            // requests served from a cached block
+    size_t misses = 0;          // requests that allocated a new block
+    size_t bytesInUse = 0;      // handed out and not returned yet
+    size_t bytesCached = 0;     // returned, kept for reuse
+    size_t highWaterInUse = 0;  // peak of bytesInUse
+    size_t highWaterTotal = 0;  // peak of bytesInUse + bytesCached, i.e. memory held
+};
+
+/****************************************************************************
+* Size class pool of scratch memory. Requests are rounded up to a size class
+* (256 bytes, then four classes per power of two, so at most 25% is wasted)
+* and returned blocks are kept per class for the next request of that class
+* instead of being freed. Thread safe. Device memory must not be returned
+* while kernels still use it: use FreeAfter with the last kernel's event.
+*****************************************************************************/
+class MemoryPool
+{
+public:
+    MemoryPool() = default;     // PoolMemory::Host
+    MemoryPool(const sycl::queue &q, PoolMemory memory);
+    ~MemoryPool();
+    MemoryPool(const MemoryPool &) = delete;
+    MemoryPool &operator=(const MemoryPool &) = delete;
+
+    // nullptr if the allocation fails
+    void *Allocate(size_t bytes);
+    void Free(void *p);
+    // Free p once e has completed, without blocking. Until then the block
+    // counts as in use; Allocate and Trim take back the completed ones.
+    void FreeAfter(void *p, const sycl::event &e);
+    // Free the cached blocks
+    void Trim();
+
+    PoolMemory Memory() const { return memory_; }
+    PoolStats Stats() const;
+    void ResetStats();
+    // True if the pool's memory is usable on q
+    bool Serves(const sycl::queue &q) const;
+
+    static size_t SizeClass(size_t bytes);
+
+private:
+    void *AllocateBlock(size_t bytes);
+    void FreeBlock(void *p);
+    // The body of Free and of taking back completed FreeAfter blocks, with
+    // mutex_ held
+    void CacheBlock(void *p);
+    void ReclaimCompleted(bool wait);
+
+    PoolMemory memory_ = PoolMemory::Host;
+    std::optional<sycl::queue> queue_;      // of USM pools
+    mutable std::mutex mutex_;
+    std::map<size_t, std::vector<void *>> cached_;     // per size class
+    std::unordered_map<void *, size_t> inUse_;         // block and its size class
+    std::vector<std::pair<void *, sycl::event>> pending_;  // FreeAfter blocks
+    PoolStats stats_;
+};
+
+// Process wide host pool
+MemoryPool &HostMemoryPool();
+
+// Pool of memory kind memory (UsmDevice or UsmHost) for q's device and
+// context, created on first use
+MemoryPool &UsmMemoryPool(const sycl::queue &q, PoolMemory memory = PoolMemory::UsmDevice);
+
+/****************************************************************************
+* count Ts from a pool, returned when destroyed. The memory is not
+* initialized.
+*****************************************************************************/
+template <typename T>
+class PooledArray
+{
+public:
+    PooledArray(MemoryPool &pool, size_t count)
+        : pool_(pool), data_(static_cast<T *>(pool.Allocate(count * sizeof(T)))), size_(count)
+    {
+        if (data_ == nullptr) throw std::bad_alloc();
+    }
+    ~PooledArray() { pool_.Free(data_); }
+    PooledArray(const PooledArray &) = delete;
+    PooledArray &operator=(const PooledArray &) = delete;
+
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+    size_t size() const { return size_; }
+    T &operator[](size_t i) { return data_[i]; }
+    const T &operator[](size_t i) const { return data_[i]; }
+
+private:
+    MemoryPool &pool_;
+    T *data_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef MULTI_DEVICE_H
+#define MULTI_DEVICE_H
+
+#include <sycl/sycl.hpp>
+#include <cstdint>
+#include <vector>
+
+#include <image.h>
+
+enum class PartitionMode : int
+{
+    SingleDevice = 0,
+    Numa,       // sub-devices of the device, one per NUMA node
+    Devices,    // every device of the device's platform
+};
+
+/****************************************************************************
+* Queues to split a frame over. Each queue has a context of its own, so the
+* buffers first used on it are allocated for its (sub-)device: on a multi
+* socket CPU the memory of a NUMA sub-device is local to its socket. A
+* device that can't be partitioned by NUMA domain is used whole.
+*****************************************************************************/
+std::vector<sycl::queue> CreatePartitionQueues(const sycl::device &device, PartitionMode mode,
+                                               const sycl::async_handler &handler,
+                                               bool enableProfiling = false);
+
+struct PartitionStats
+{
+    std::vector<int> bandRows;      // rows given to each queue
+    double wallMs = 0;
+};
+
+/****************************************************************************
+* Sobel edges of an interleaved u8 RGB or RGBA image split into one row band
+* per queue, the band heights in proportion to the compute units of the
+* queues' devices. Each band is copied to its device with a one row halo
+* above and below and filtered there. The gradients of all bands are
+* normalized by the max over the whole image, so the stitched edges match
+* SobelFilter on one device (with the u8 conversion saturating).
+* @return Ok, or InvalidArgument (no queues, empty image, Border::Wrap).
+*****************************************************************************/
+Result SobelEdgesPartitioned(std::vector<sycl::queue> &queues,
+                             const uint8_t *pImage, uint8_t *pEdges,
+                             int width, int height, int numChannels,
+                             PartitionStats &stats,
+                             Border border = Border::Clamp, float constant = 0.0f);
+
+#endif
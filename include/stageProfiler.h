@@ -0,0 +1,61 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <sycl/sycl.hpp>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct StageStats
+{
+    std::string name;
+    size_t count = 0;       // events timed
+    double totalMs = 0;
+    double minMs = 0;
+    double medianMs = 0;
+    double maxMs = 0;
+};
+
+/****************************************************************************
+* Device time per named stage, from the command_start and command_end of
+* the events of kernels and copies. The queue must be created with
+* property::queue::enable_profiling; events of other queues are counted as
+* unprofiled. Recording only keeps the event, the times are read in Collect.
+*****************************************************************************/
+class StageProfiler
+{
+public:
+    void Record(const char *stage, const sycl::event &e);
+    // Add a time measured some other way, e.g. of a host stage
+    void AddTime(const std::string &stage, double ms);
+    // Wait for the events recorded so far and add their times to their stage
+    void Collect();
+    void Clear();
+
+    // Per stage in the order the stages were first recorded. Collects first.
+    std::vector<StageStats> Stats();
+    size_t Unprofiled() const { return unprofiled_; }
+
+    // Table of the stats, with the share of the summed device time per stage
+    void Report(std::ostream &os);
+
+private:
+    // Times of stage, which is added to order_ the first time
+    std::vector<double> &Times(const std::string &stage);
+
+    std::vector<std::pair<const char *, sycl::event>> pending_;
+    std::vector<std::string> order_;
+    std::map<std::string, std::vector<double>> timesMs_;
+    size_t unprofiled_ = 0;
+};
+
+// Profiler the SYCL functions called on this thread record their events
+// to, nullptr (the default) for none. Returns the previous one.
+StageProfiler *SetStageProfiler(StageProfiler *profiler);
+
+// Record e as part of stage with the thread's profiler, if any. Returns e.
+sycl::event ProfileStage(const char *stage, sycl::event e);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef STRIP_STREAM_H
+#define STRIP_STREAM_H
+
+#include <sycl/sycl.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <image.h>
+#include <threadPool.h>
+
+/****************************************************************************
+* Rows of an image read top to bottom, for images that don't fit in memory.
+* Pixels are interleaved u8, Channels() per pixel.
+*****************************************************************************/
+class RowSource
+{
+public:
+    virtual ~RowSource() = default;
+    virtual int Width() const = 0;
+    virtual int Height() const = 0;
+    virtual int Channels() const = 0;
+    // Read the next numRows rows into pRows, Width() * Channels() bytes each
+    virtual bool ReadRows(uint8_t *pRows, int numRows) = 0;
+};
+
+/****************************************************************************
+* Where the rows of a 1 channel u8 result go, top to bottom.
+*****************************************************************************/
+class RowSink
+{
+public:
+    virtual ~RowSink() = default;
+    virtual bool WriteRows(const uint8_t *pRows, int numRows) = 0;
+};
+
+/****************************************************************************
+* Binary PGM (P5, gray) or PPM (P6, RGB) file with a maxval of at most 255.
+* Samples of a smaller maxval are stretched to 0 ... 255 as they are read.
+*****************************************************************************/
+class PnmRowSource : public RowSource
+{
+public:
+    Result Open(const std::string &path);
+    int Width() const override { return width_; }
+    int Height() const override { return height_; }
+    int Channels() const override { return channels_; }
+    bool ReadRows(uint8_t *pRows, int numRows) override;
+
+private:
+    std::ifstream file_;
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    int maxVal_ = 255;
+};
+
+/****************************************************************************
+* Writes a binary PGM (P5) file. The header goes out on Open, the rows as
+* they are written.
+*****************************************************************************/
+class PnmRowSink : public RowSink
+{
+public:
+    Result Open(const std::string &path, int width, int height);
+    bool WriteRows(const uint8_t *pRows, int numRows) override;
+
+private:
+    std::ofstream file_;
+    int width_ = 0;
+};
+
+struct StreamOptions
+{
+    int stripRows = 256;            // output rows per strip, sets the memory used
+    Border border = Border::Clamp;  // Wrap needs the last rows first and is not supported
+    uint8_t constant = 0;           // sample value (every channel) outside the image for Border::Constant
+};
+
+struct StreamStats
+{
+    int strips = 0;
+    size_t bytesAllocated = 0;      // strip memory, independent of the image height
+    double wallMs = 0.0;
+};
+
+/****************************************************************************
+* Sobel edges of an image of any height, one horizontal strip at a time:
+* each strip of stripRows rows is read with a one row halo above and below,
+* converted to gray, filtered and converted to u8, and its rows are written
+* to sink before the next strip is read. The halo rows are those of the
+* whole image (border mode applied at the top and bottom of the image
+* only), so the result doesn't depend on the strip height.
+*
+* The max gradient of the whole image isn't known until the end, so the
+* gradients are scaled by their largest possible value, 4, like
+* SobelEdgesUint8Buffer without normalize.
+* @return Ok, InvalidArgument (bad options, Border::Wrap) or FileIOFailure.
+*****************************************************************************/
+Result SobelStreamCpp(ThreadPool &pool, RowSource &source, RowSink &sink,
+                      const StreamOptions &options, StreamStats &stats);
+
+/****************************************************************************
+* Device version of the above. Two strips are in flight, so the next strip
+* is read while the device works on the current one.
+*****************************************************************************/
+Result SobelStreamBuffer(sycl::queue &q, RowSource &source, RowSink &sink,
+                      const StreamOptions &options, StreamStats &stats);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/****************************************************************************
+* Fixed size pool of worker threads for the host (C++) path. ParallelFor
+* splits [0, count) into chunks that the workers, and the calling thread,
+* take until all are done.
+*****************************************************************************/
+class ThreadPool
+{
+public:
+    // numThreads <= 0 sizes the pool to the machine. The calling thread counts
+    // as one of the threads, so numThreads - 1 workers are started.
+    explicit ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int NumThreads() const { return static_cast<int>(workers_.size()) + 1; }
+
+    /****************************************************************************
+    * Call fn(begin, end) on chunks of at most grain items covering [0, count).
+    * Blocks until every chunk is done. Not reentrant: fn must not call
+    * ParallelFor on the same pool.
+    *****************************************************************************/
+    void ParallelFor(int count, int grain, const std::function<void(int, int)> &fn);
+
+private:
+    void WorkerLoop();
+    void RunChunks();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stop_ = false;
+
+    // Current job
+    const std::function<void(int, int)> *fn_ = nullptr;
+    int count_ = 0;
+    int grain_ = 1;
+    std::atomic<int> next_{0};
+    int busy_ = 0;          // workers still in the current job
+    unsigned jobId_ = 0;
+};
+
+#endif
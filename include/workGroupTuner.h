@@ -0,0 +1,133 @@
+#ifndef WORK_GROUP_TUNER_H
+#define WORK_GROUP_TUNER_H
+
+#include <sycl/sycl.hpp>
+#include <string>
+#include <vector>
+
+#include <image.h>
+
+// Default cache of tuned shapes, in the working directory
+#define WORK_GROUP_CACHE_FILE "sobel_workgroups.cache"
+
+// Kernels of imageUtilsUsingBuffers whose work-group shape is tuned
+enum class TunedKernel : int
+{
+    Convolution3x3 = 0,
+    SeparableFilter,
+    GaussianBlur,
+    SobelSeparable,     // SobelFilter with a SobelContext
+    SobelFused,         // tile kernels: the shape is the tile size
+    SobelEdgesUint8,
+    SobelFixed,
+    CannyClassify,
+    CannyHysteresis,
+    Stencil,            // StencilBuffer
+
+    Count
+};
+
+const char *TunedKernelName(TunedKernel kernel);
+
+// True for the kernels that stage a tile of (x + 2) * (y + 2) pixels in
+// local memory, so the shape also sets the local memory used
+bool IsTileKernel(TunedKernel kernel);
+
+/****************************************************************************
+* Work-group shape, x along image rows. 0 x 0 leaves the shape to the
+* runtime (a plain range), which only the non tile kernels accept.
+*****************************************************************************/
+struct WorkGroupShape
+{
+    int x = 0;
+    int y = 0;
+
+    bool IsSet() const { return x > 0 && y > 0; }
+};
+
+/****************************************************************************
+* Shape to launch kernel with on q's device for a width x height image: the
+* tuned one from the cache if there is one, else the default (tile kernels
+* SOBEL_TILE_WIDTH x SOBEL_TILE_HEIGHT, the others 0 x 0). The cache file is
+* read the first time a device is seen. Shapes that don't fit the device
+* (max_work_group_size, the kernels' work_group_size, local_mem_size) are
+* ignored.
+*****************************************************************************/
+WorkGroupShape GetWorkGroupShape(const sycl::queue &q, TunedKernel kernel, int width, int height);
+
+// Where the tuned shapes are read from and written to. Default
+// WORK_GROUP_CACHE_FILE. Forgets what was read from the previous file.
+void SetWorkGroupCacheFile(const std::string &path);
+
+struct TunedShape
+{
+    TunedKernel kernel;
+    WorkGroupShape shape;
+    double ms;          // median device time of the tuned kernel (wall time of
+                        // its function if the device can't profile)
+    double defaultMs;   // same with the default shape. Infinity for a shape
+                        // the runtime rejected.
+};
+
+/****************************************************************************
+* Time every candidate shape that fits the device (x 8 ... 256, y 1 ... 32,
+* x * y within max_work_group_size and the kernels' own work_group_size,
+* tiles within local_mem_size) for each kernel on a width x height image,
+* and keep the fastest. Only the device time of the tuned kernel counts.
+* Shapes the runtime rejects are skipped. The results are used by
+* GetWorkGroupShape from then on and are saved to the cache file, replacing
+* earlier ones for the same device and size.
+* @param results[out] The chosen shape per kernel.
+* @return Ok, or FileIOFailure if the cache file can't be written.
+*****************************************************************************/
+Result TuneWorkGroups(sycl::queue &q, int width, int height, std::vector<TunedShape> &results,
+                      int iterations = 5);
+
+/****************************************************************************
+* Run a kernel over a height x width grid on h: f(y, x) per pixel. With a
+* set shape it is an nd_range of that work-group size, rounded up to whole
+* work-groups with the work-items outside the image idle. Otherwise a range.
+*****************************************************************************/
+template <typename F>
+inline void ParallelFor2D(sycl::handler &h, WorkGroupShape shape, int height, int width, F f)
+{
+    if (!shape.IsSet())
+    {
+        h.parallel_for(sycl::range<2>(height, width), [=](sycl::id<2> idx) {
+            f(static_cast<int>(idx[0]), static_cast<int>(idx[1]));
+        });
+        return;
+    }
+    sycl::range<2> local(shape.y, shape.x);
+    sycl::range<2> global(((height + shape.y - 1) / shape.y) * shape.y,
+                          ((width + shape.x - 1) / shape.x) * shape.x);
+    h.parallel_for(sycl::nd_range<2>(global, local), [=](sycl::nd_item<2> item) {
+        int y = static_cast<int>(item.get_global_id(0));
+        int x = static_cast<int>(item.get_global_id(1));
+        if (y < height && x < width) f(y, x);
+    });
+}
+
+// The same with a reduction: f(y, x, reducer)
+template <typename Reduction, typename F>
+inline void ParallelFor2D(sycl::handler &h, WorkGroupShape shape, int height, int width,
+                          Reduction reduction, F f)
+{
+    if (!shape.IsSet())
+    {
+        h.parallel_for(sycl::range<2>(height, width), reduction, [=](sycl::id<2> idx, auto &reducer) {
+            f(static_cast<int>(idx[0]), static_cast<int>(idx[1]), reducer);
+        });
+        return;
+    }
+    sycl::range<2> local(shape.y, shape.x);
+    sycl::range<2> global(((height + shape.y - 1) / shape.y) * shape.y,
+                          ((width + shape.x - 1) / shape.x) * shape.x);
+    h.parallel_for(sycl::nd_range<2>(global, local), reduction, [=](sycl::nd_item<2> item, auto &reducer) {
+        int y = static_cast<int>(item.get_global_id(0));
+        int x = static_cast<int>(item.get_global_id(1));
+        if (y < height && x < width) f(y, x, reducer);
+    });
+}
+
+#endif
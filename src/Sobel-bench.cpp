@@ -0,0 +1,345 @@
+//==============================================================
+// Benchmark of every filter primitive on the C++ (single and multi
+// threaded) and SYCL backends over a sweep of image sizes.
+//
+// Each measurement runs warmup iterations first, then times every
+// iteration on its own. SYCL iterations end with a queue wait so the
+// time covers execution, not just submission. The report gives the
+// median and p95 latency and megapixels per second (at the median).
+//
+// Usage: Sobel-bench [--sizes WxH,WxH,...] [--iterations N] [--warmup N]
+//                    [--format csv|json]
+//==============================================================
+#include <sycl/sycl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingBuffers.h"
+#include "imageUtilsUsingCpp.h"
+#include "imageUtilsSimdCpp.h"
+#include "image.h"
+
+using namespace sycl;
+using namespace std;
+
+const int EXIT_ERROR_CODE = 1;
+
+// Create an exception handler for asynchronous SYCL exceptions
+static auto exception_handler = [](sycl::exception_list e_list) {
+  for (std::exception_ptr const &e : e_list) {
+    try {
+      std::rethrow_exception(e);
+    }
+    catch (std::exception const &e) {
+      std::cout << "Failure: " << e.what() << std::endl;
+      std::terminate();
+    }
+  }
+};
+
+struct BenchOptions
+{
+  std::vector<std::pair<int, int>> sizes = {{640, 480}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+  int iterations = 50;
+  int warmup = 5;
+  bool json = false;
+};
+
+struct BenchResult
+{
+  std::string backend;
+  std::string primitive;
+  int width;
+  int height;
+  int iterations;
+  double medianMs;
+  double p95Ms;
+  double mpixPerSec;
+};
+
+/***************************************************************
+ * Run fn warmup times, then time each of iterations runs.
+****************************************************************/
+static BenchResult TimeIt(const std::string &backend, const std::string &primitive,
+                          int width, int height, const BenchOptions &opt,
+                          const std::function<void()> &fn,
+                          const std::function<void()> &reset = nullptr)  // untimed, before every run
+{
+  for (int i = 0; i < opt.warmup; i++)
+  {
+    if (reset) reset();
+    fn();
+  }
+
+  std::vector<double> timesMs(opt.iterations);
+  for (int i = 0; i < opt.iterations; i++)
+  {
+    if (reset) reset();
+    auto timeBegin = std::chrono::steady_clock::now();
+    fn();
+    auto timeEnd = std::chrono::steady_clock::now();
+    timesMs[i] = std::chrono::duration<double, std::milli>(timeEnd - timeBegin).count();
+  }
+  std::sort(timesMs.begin(), timesMs.end());
+
+  BenchResult r;
+  r.backend = backend;
+  r.primitive = primitive;
+  r.width = width;
+  r.height = height;
+  r.iterations = opt.iterations;
+  r.medianMs = timesMs[timesMs.size() / 2];
+  r.p95Ms = timesMs[std::min(timesMs.size() - 1, (timesMs.size() * 95) / 100)];
+  r.mpixPerSec = r.medianMs > 0.0 ? (double(width) * height / 1.0e6) / (r.medianMs / 1000.0) : 0.0;
+  return r;
+}
+
+static void PrintResult(const BenchResult &r, bool json)
+{
+  if (json)
+  {
+    cout << "{\"backend\": \"" << r.backend << "\", \"primitive\": \"" << r.primitive
+         << "\", \"width\": " << r.width << ", \"height\": " << r.height
+         << ", \"iterations\": " << r.iterations << ", \"median_ms\": " << r.medianMs
+         << ", \"p95_ms\": " << r.p95Ms << ", \"mpix_per_s\": " << r.mpixPerSec << "}" << std::endl;
+  }
+  else
+  {
+    cout << r.backend << "," << r.primitive << "," << r.width << "," << r.height << ","
+         << r.iterations << "," << r.medianMs << "," << r.p95Ms << "," << r.mpixPerSec << std::endl;
+  }
+}
+
+static bool ParseArgs(int argc, char *argv[], BenchOptions &opt)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--sizes" && hasValue)
+    {
+      opt.sizes.clear();
+      std::stringstream ss(argv[++i]);
+      std::string item;
+      while (std::getline(ss, item, ','))
+      {
+        int w = 0, h = 0;
+        if (sscanf(item.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) return false;
+        opt.sizes.push_back({w, h});
+      }
+    }
+    else if (arg == "--iterations" && hasValue) opt.iterations = std::max(1, atoi(argv[++i]));
+    else if (arg == "--warmup" && hasValue) opt.warmup = std::max(0, atoi(argv[++i]));
+    else if (arg == "--format" && hasValue) opt.json = std::string(argv[++i]) == "json";
+    else return false;
+  }
+  return !opt.sizes.empty();
+}
+
+/***************************************************************
+ * C++ backend, single threaded or on the pool
+****************************************************************/
+static void BenchCpp(const std::string &backend, ThreadPool *pool,
+                     const std::vector<uint8_t> &rgb, int width, int height, int channels,
+                     const BenchOptions &opt)
+{
+  size_t numPixels = static_cast<size_t>(width) * height;
+  std::vector<float> gray(numPixels), a(numPixels), b(numPixels), c(numPixels);
+  std::vector<uint8_t> u8(numPixels);
+  const float sobelXFilter[9] = {1, 0, -1, 2, 0, -2, 1, 0, -1};
+  ConvertToGrayscaleCpp(rgb.data(), gray, width, height, channels);
+
+  std::vector<BenchResult> results;
+  // The grayscale and uint8 conversions have no pool versions, so they are
+  // only reported for the single threaded backend
+  if (!pool)
+  {
+    results.push_back(TimeIt(backend, "grayscale", width, height, opt, [&]() {
+        ConvertToGrayscaleCpp(rgb.data(), gray, width, height, channels);
+    }));
+  }
+  results.push_back(TimeIt(backend, "convolution3x3", width, height, opt, [&]() {
+      if (pool) Convolution3x3Cpp(*pool, a.data(), gray.data(), sobelXFilter, width, height, width, Border::Clamp);
+      else Convolution3x3Cpp(a.data(), gray.data(), sobelXFilter, width, height, width, Border::Clamp);
+  }));
+  results.push_back(TimeIt(backend, "stencil_sobel_x", width, height, opt, [&]() {
+      if (pool) StencilCpp<SobelXStencil>(*pool, a.data(), gray.data(), width, height, width, Border::Clamp);
+      else StencilCpp<SobelXStencil>(a.data(), gray.data(), width, height, width, Border::Clamp);
+  }));
+  results.push_back(TimeIt(backend, "sobel", width, height, opt, [&]() {
+      if (pool) SobelFilterCpp(*pool, gray, b, width, height);
+      else SobelFilterCpp(gray, b, width, height);
+  }));
+  results.push_back(TimeIt(backend, "rgb_to_edges_u8_fixed", width, height, opt, [&]() {
+      if (pool) SobelFixedCpp(*pool, u8.data(), rgb.data(), width, height, channels);
+      else SobelFixedCpp(u8.data(), rgb.data(), width, height, channels);
+  }));
+  results.push_back(TimeIt(backend, "sobel_storage_f16", width, height, opt, [&]() {
+      if (pool) SobelFilterCpp(*pool, gray, b, width, height, Border::Clamp, 0.0f, StoragePrecision::Float16);
+      else SobelFilterCpp(gray, b, width, height, Border::Clamp, 0.0f, StoragePrecision::Float16);
+  }));
+  results.push_back(TimeIt(backend, "sobel_storage_bf16", width, height, opt, [&]() {
+      if (pool) SobelFilterCpp(*pool, gray, b, width, height, Border::Clamp, 0.0f, StoragePrecision::BFloat16);
+      else SobelFilterCpp(gray, b, width, height, Border::Clamp, 0.0f, StoragePrecision::BFloat16);
+  }));
+  volatile float sink = 0.0f;
+  results.push_back(TimeIt(backend, "max", width, height, opt, [&]() {
+      sink = pool ? FindMaxCpp(*pool, a.data(), width, height) : FindMaxCpp(a.data(), width, height);
+  }));
+  results.push_back(TimeIt(backend, "scale", width, height, opt, [&]() {
+      if (pool) ScaleImgCpp(*pool, a.data(), c.data(), width, height, 0.5f);
+      else ScaleImgCpp(a.data(), c.data(), width, height, 0.5f);
+  }));
+  results.push_back(TimeIt(backend, "magnitude", width, height, opt, [&]() {
+      if (pool) ComputeMagnitudeCpp(*pool, a.data(), c.data(), b, width, height);
+      else ComputeMagnitudeCpp(a.data(), c.data(), b, width, height);
+  }));
+  if (!pool)
+  {
+    results.push_back(TimeIt(backend, "uint8", width, height, opt, [&]() {
+        ConvertToUint8Cpp(gray, u8, width, height);
+    }));
+  }
+  for (auto &r : results) PrintResult(r, opt.json);
+}
+
+/***************************************************************
+ * SYCL backend. Every iteration waits for the queue.
+****************************************************************/
+static void BenchSycl(queue &q, std::vector<uint8_t> &rgb, int width, int height, int channels,
+                      const BenchOptions &opt)
+{
+  const std::string backend = "sycl";
+  size_t numPixels = static_cast<size_t>(width) * height;
+  const float sobelXFilter[9] = {1, 0, -1, 2, 0, -2, 1, 0, -1};
+
+  buffer<uint8_t, 1> rgbBuf{rgb.data(), range<1>(rgb.size())};
+  buffer<float, 1> grayBuf{range<1>(numPixels)};
+  buffer<float, 1> aBuf{range<1>(numPixels)};
+  buffer<float, 1> bBuf{range<1>(numPixels)};
+  buffer<float, 1> maxBuf{range<1>(1)};
+  buffer<float, 1> scaleBuf{range<1>(numPixels)};
+  buffer<uint8_t, 1> u8Buf{range<1>(numPixels)};
+  SobelContext sobelCtx(q, width, height);
+  SobelContext sobelCtxF16(q, width, height, StoragePrecision::Float16);
+  SobelContext sobelCtxBf16(q, width, height, StoragePrecision::BFloat16);
+
+  ConvertToGrayscaleBuffer(q, rgbBuf, grayBuf, width, height, channels);
+  q.wait();
+
+  std::vector<BenchResult> results;
+  results.push_back(TimeIt(backend, "grayscale", width, height, opt, [&]() {
+      ConvertToGrayscaleBuffer(q, rgbBuf, grayBuf, width, height, channels);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "convolution3x3", width, height, opt, [&]() {
+      Convolution3x3Buffer(q, grayBuf, aBuf, sobelXFilter, width, height);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "stencil_sobel_x", width, height, opt, [&]() {
+      StencilBuffer<SobelXStencil>(q, grayBuf, aBuf, width, height);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "sobel", width, height, opt, [&]() {
+      SobelFilter(sobelCtx, grayBuf, bBuf);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "sobel_storage_f16", width, height, opt, [&]() {
+      SobelFilter(sobelCtxF16, grayBuf, bBuf);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "sobel_storage_bf16", width, height, opt, [&]() {
+      SobelFilter(sobelCtxBf16, grayBuf, bBuf);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "sobel_fused", width, height, opt, [&]() {
+      SobelFilterFused(q, grayBuf, bBuf, width, height);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "max", width, height, opt, [&]() {
+      FindMaxValBuffer(q, aBuf, maxBuf, width, height);
+      q.wait();
+  }));
+  // ScaleImgBuffer works in place: scale a copy of the gradients, restored
+  // before every run, so the values don't shrink from run to run
+  results.push_back(TimeIt(backend, "scale", width, height, opt, [&]() {
+      ScaleImgBuffer(q, scaleBuf, maxBuf, width, height);
+      q.wait();
+  }, [&]() {
+      q.submit([&](handler &h) {
+        accessor src(aBuf, h, read_only);
+        accessor dst(scaleBuf, h, write_only, no_init);
+        h.copy(src, dst);
+      });
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "magnitude", width, height, opt, [&]() {
+      ComputeMagnitudeBuffer(q, aBuf, grayBuf, bBuf, width, height);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "uint8", width, height, opt, [&]() {
+      ConvertToUint8Buffer(q, grayBuf, u8Buf, width, height);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "rgb_to_edges_u8", width, height, opt, [&]() {
+      SobelEdgesUint8Buffer(q, rgbBuf, u8Buf, width, height, channels);
+      q.wait();
+  }));
+  results.push_back(TimeIt(backend, "rgb_to_edges_u8_fixed", width, height, opt, [&]() {
+      SobelFixedBuffer(q, rgbBuf, u8Buf, width, height, channels);
+      q.wait();
+  }));
+  for (auto &r : results) PrintResult(r, opt.json);
+}
+
+int main(int argc, char *argv[]) {
+  BenchOptions opt;
+  if (!ParseArgs(argc, argv, opt))
+  {
+    cerr << "Usage: " << argv[0]
+         << " [--sizes WxH,WxH,...] [--iterations N] [--warmup N] [--format csv|json]" << std::endl;
+    return EXIT_ERROR_CODE;
+  }
+
+  // The default device selector will select the most performant device.
+  auto selector = default_selector_v;
+  const int channels = 3;
+  try {
+    queue q(selector, exception_handler);
+    ThreadPool pool;
+
+    // Results go to stdout, everything else to stderr so the output stays parsable
+    cerr << "Running on device: " << q.get_device().get_info<info::device::name>() << std::endl;
+    cerr << "Host threads: " << pool.NumThreads() << ", SIMD level: "
+         << static_cast<int>(GetSimdLevel()) << std::endl;
+    if (!opt.json)
+    {
+      cout << "backend,primitive,width,height,iterations,median_ms,p95_ms,mpix_per_s" << std::endl;
+    }
+
+    std::mt19937 rng(12345);
+    for (auto &size : opt.sizes)
+    {
+      int width = size.first;
+      int height = size.second;
+      std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * channels);
+      for (auto &v : rgb) v = static_cast<uint8_t>(rng());
+
+      BenchCpp("cpp", nullptr, rgb, width, height, channels, opt);
+      BenchCpp("cpp_threads", &pool, rgb, width, height, channels, opt);
+      BenchSycl(q, rgb, width, height, channels, opt);
+    }
+  } catch (std::exception const &e) {
+    cerr << "An exception is caught while benchmarking: " << e.what() << std::endl;
+    return EXIT_ERROR_CODE;
+  }
+  return 0;
+}
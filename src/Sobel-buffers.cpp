@@ -30,9 +30,17 @@
 #include <malloc.h>
 #include <windows.h> 
 #include <chrono>
+#include <algorithm>
 #include "imageUtilsAgnostic.h"
 #include "imageUtilsUsingBuffers.h"
 #include "imageUtilsUsingCpp.h"
+#include "batchPipeline.h"
+#include "stripStream.h"
+#include "imageIO.h"
+#include "workGroupTuner.h"
+#include "stageProfiler.h"
+#include "multiDevice.h"
+#include "memoryPool.h"
 #include "image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -69,6 +77,22 @@ static auto exception_handler = [](sycl::exception_list e_list) {
   }
 };
 
+// Hits, misses and high water marks of a scratch memory pool
+static void PrintPoolStats(const char *name, const PoolStats &stats)
+{
+  cout << name << ": " << stats.hits << " hits, " << stats.misses << " misses, high water "
+       << (float)stats.highWaterInUse/(1024.0f * 1024.0f) << " MBytes in use, "
+       << (float)stats.highWaterTotal/(1024.0f * 1024.0f) << " MBytes held" << std::endl;
+}
+
+// Error of the reduced storage Sobel result against the Float32 one
+static void PrintAccuracy(const float *pReference, const float *pResult, int width, int height)
+{
+  ImageDiff diff = CompareImagesCpp(pReference, pResult, width, height);
+  cout << "Accuracy against Float32 storage: max error " << diff.maxAbsError
+       << ", mean error " << diff.meanAbsError << ", PSNR " << diff.psnr << " dB" << std::endl;
+}
+
 // Array type and data size for this example.
 constexpr size_t array_size = 10000;
 typedef array<int, array_size> IntArray;
@@ -76,12 +100,144 @@ typedef array<int, array_size> IntArray;
 //**************************************************************************
 // Demonstrate iota both sequential on CPU and parallel on device.
 //**************************************************************************
-int main() {
+int main(int argc, char *argv[]) {
   // Create device selector for the device of your interest.
   // The default device selector will select the most performant device.
   auto selector = default_selector_v;
   cout << "Starting main" << std::endl;
 
+  // Batch mode: Sobel-buffers --batch <directory or list file> [output directory] [--pgm]
+  if (argc > 2 && string(argv[1]) == "--batch")
+  {
+    vector<string> paths;
+    if (ListBatchInputs(argv[2], paths) != Result::Ok || paths.empty())
+    {
+      cout << "ERROR: no images found in " << argv[2] << std::endl;
+      exit(EXIT_ERROR_CODE);
+    }
+    BatchOptions options;
+    if (argc > 3) options.outDir = argv[3];
+    if (argc > 4 && string(argv[4]) == "--pgm") options.pgmOutput = true;
+
+    queue sycl_que(selector, exception_handler);
+    cout << "Running on device: "
+        << sycl_que.get_device().get_info<info::device::name>() << "\n";
+    BatchStats stats;
+    Result result = SobelBatchBuffer(sycl_que, paths, options, stats);
+    cout << "Processed " << stats.imagesDone << " of " << paths.size() << " images in "
+         << stats.wallMs << " msec (" << 1000.0 * stats.imagesDone / std::max(stats.wallMs, 1.0)
+         << " images/sec)" << std::endl;
+    cout << "Stage busy time: decode " << stats.decodeMs << " msec, compute " << stats.computeMs
+         << " msec, encode " << stats.encodeMs << " msec" << std::endl;
+    return result == Result::Ok ? 0 : EXIT_ERROR_CODE;
+  }
+
+  // Tune the work-group shapes for this device and image size:
+  // Sobel-buffers --tune <width>x<height>
+  // Later runs on the same device and size use the tuned shapes.
+  if (argc > 2 && string(argv[1]) == "--tune")
+  {
+    int tuneWidth = 0, tuneHeight = 0;
+    if (sscanf(argv[2], "%dx%d", &tuneWidth, &tuneHeight) != 2 || tuneWidth <= 0 || tuneHeight <= 0)
+    {
+      cout << "ERROR: expected <width>x<height>, got " << argv[2] << std::endl;
+      exit(EXIT_ERROR_CODE);
+    }
+    queue sycl_que(selector, exception_handler);
+    cout << "Tuning on device: "
+        << sycl_que.get_device().get_info<info::device::name>() << "\n";
+    std::vector<TunedShape> tuned;
+    Result result = TuneWorkGroups(sycl_que, tuneWidth, tuneHeight, tuned);
+    for (auto &t : tuned)
+    {
+      cout << TunedKernelName(t.kernel) << ": " << t.shape.x << " x " << t.shape.y << ", "
+           << t.ms << " msec (default " << t.defaultMs << " msec)" << std::endl;
+    }
+    if (result != Result::Ok) cout << "ERROR: could not write " << WORK_GROUP_CACHE_FILE << std::endl;
+    return result == Result::Ok ? 0 : EXIT_ERROR_CODE;
+  }
+
+  // Streaming mode for images larger than memory:
+  // Sobel-buffers --stream[-cpu] <input .pgm or .ppm> <output .pgm> [strip rows]
+  if (argc > 3 && (string(argv[1]) == "--stream" || string(argv[1]) == "--stream-cpu"))
+  {
+    PnmRowSource source;
+    PnmRowSink sink;
+    if (source.Open(argv[2]) != Result::Ok ||
+        sink.Open(argv[3], source.Width(), source.Height()) != Result::Ok)
+    {
+      cout << "ERROR: could not open " << argv[2] << " or " << argv[3] << std::endl;
+      exit(EXIT_ERROR_CODE);
+    }
+    StreamOptions options;
+    if (argc > 4) options.stripRows = atoi(argv[4]);
+
+    StreamStats stats;
+    Result result;
+    if (string(argv[1]) == "--stream-cpu")
+    {
+      ThreadPool pool;
+      result = SobelStreamCpp(pool, source, sink, options, stats);
+    }
+    else
+    {
+      queue sycl_que(selector, exception_handler);
+      cout << "Running on device: "
+          << sycl_que.get_device().get_info<info::device::name>() << "\n";
+      result = SobelStreamBuffer(sycl_que, source, sink, options, stats);
+    }
+    cout << "Streamed " << source.Width() << " x " << source.Height() << " in " << stats.strips
+         << " strips, " << stats.wallMs << " msec, "
+         << (float)stats.bytesAllocated/(1024.0f * 1024.0f) << " MBytes of strip memory" << std::endl;
+    return result == Result::Ok ? 0 : EXIT_ERROR_CODE;
+  }
+
+  // Split each frame over NUMA sub-devices or over all the devices:
+  // Sobel-buffers --partition <numa|devices> <image> [iterations]
+  if (argc > 3 && string(argv[1]) == "--partition")
+  {
+    PartitionMode mode = string(argv[2]) == "numa" ? PartitionMode::Numa : PartitionMode::Devices;
+    int numIterations = argc > 4 ? std::max(atoi(argv[4]), 1) : 10;
+    int width, height, channels;
+    uint8_t* u8_rgb = stbi_load(argv[3], &width, &height, &channels, 3);
+    if (u8_rgb == nullptr)
+    {
+      cout << "ERROR: could not load image " << argv[3] << std::endl;
+      exit(EXIT_ERROR_CODE);
+    }
+    std::vector<uint8_t> u8_edges(width * height);
+
+    queue sycl_que(selector, exception_handler);
+    vector<queue> single{sycl_que};
+    vector<queue> partitioned = CreatePartitionQueues(sycl_que.get_device(), mode, exception_handler);
+
+    // The first run of each also builds the kernels, it isn't timed
+    PartitionStats stats;
+    double singleMs = 0, partitionedMs = 0;
+    for (int i = 0; i <= numIterations; i++)
+    {
+      SobelEdgesPartitioned(single, u8_rgb, u8_edges.data(), width, height, 3, stats);
+      if (i > 0) singleMs += stats.wallMs;
+    }
+    Result result = Result::Ok;
+    for (int i = 0; i <= numIterations && result == Result::Ok; i++)
+    {
+      result = SobelEdgesPartitioned(partitioned, u8_rgb, u8_edges.data(), width, height, 3, stats);
+      if (i > 0) partitionedMs += stats.wallMs;
+    }
+    for (size_t b = 0; b < stats.bandRows.size(); b++)
+    {
+      cout << "Band " << b << ": " << stats.bandRows[b] << " rows on "
+           << partitioned[b].get_device().get_info<info::device::name>() << std::endl;
+    }
+    cout << "Whole device " << singleMs / numIterations << " msec, " << partitioned.size()
+         << " partitions " << partitionedMs / numIterations << " msec per frame (speedup "
+         << singleMs / std::max(partitionedMs, 1e-9) << ")" << std::endl;
+    stbi_write_png("image_sobel_partitioned.png", width, height, 1, u8_edges.data(), width);
+    stbi_image_free(u8_rgb);
+    return result == Result::Ok ? 0 : EXIT_ERROR_CODE;
+  }
+
   int channels;
   int width; 
   int height; 
@@ -89,6 +245,7 @@ int main() {
   //path = "..\\images\\humingBirds.png";
   path = "..\\images\\Bikesgray.jpg"; // see https://en.wikipedia.org/wiki/Sobel_operator
   path = "..\\images\\HummingBirdAtFeeder.png";
+  if (argc > 1) path = argv[1];  // e.g. to compare with Sobel-usm on the same image
   const int LOAD_IMAGE_AS_IS = 0;
 
   std::chrono::steady_clock::time_point timeBegin;
@@ -122,16 +279,38 @@ int main() {
   #endif
 
 
-  uint8_t* u8_image_in = stbi_load(path.c_str(), &width, &height, &channels, LOAD_IMAGE_AS_IS);
+  // PGM and PPM files are mapped and used in place, anything else is decoded by stb
+  MappedImage mappedIn;
+  uint8_t* u8_decoded = nullptr;
+  const uint8_t* u8_image_in = nullptr;
+  const bool mappedInput = IsMappedImagePath(path);
+  if (mappedInput)
+  {
+    if (mappedIn.Open(path) == Result::Ok && mappedIn.Format() != ImageFileFormat::RawFloat)
+    {
+      u8_image_in = mappedIn.Pixels();
+      width = mappedIn.Width();
+      height = mappedIn.Height();
+      channels = mappedIn.Channels();
+    }
+  }
+  else
+  {
+    u8_decoded = stbi_load(path.c_str(), &width, &height, &channels, LOAD_IMAGE_AS_IS);
+    u8_image_in = u8_decoded;
+  }
   if (u8_image_in == nullptr) 
   {
     cout << "ERROR: could not load image " << path << std::endl;
     exit(EXIT_ERROR_CODE);
   }
   cout << "Loaded image " << path << " of width = " << width << ", height = " << height << ", num channels = " << channels << std::endl;
-  string imgWrittenBackOutStr = "image_as_read_in_";
-  imgWrittenBackOutStr += to_string(channels) + "channels.png";
-  stbi_write_png("image_as_read_in_3chan.png", width, height, channels, u8_image_in, width * channels);
+  if (!mappedInput)
+  {
+    string imgWrittenBackOutStr = "image_as_read_in_";
+    imgWrittenBackOutStr += to_string(channels) + "channels.png";
+    stbi_write_png("image_as_read_in_3chan.png", width, height, channels, u8_image_in, width * channels);
+  }
   
   //uint8_t* u8_out = reinterpret_cast<uint8_t*>(sycl::malloc_shared(width * height, sycl_que));
   std::vector<uint8_t> u8_image_out(width * height);
@@ -145,20 +324,45 @@ int main() {
 
   { // Set scope for SYCL buffers
 
+    #define USE_SYCL
+    //#undef USE_SYCL
+    #define USE_FUSED_SOBEL  // single kernel, local memory tiled Sobel
+    //#undef USE_FUSED_SOBEL
+    //#define USE_FUSED_RGB_TO_EDGES  // u8 image in, u8 edges out in one kernel
+    // Storage of the gradient images of the separable SYCL Sobel and the C++ Sobel.
+    // Anything but Float32 also reports the accuracy against Float32.
+    #define SOBEL_STORAGE StoragePrecision::Float32
+    //#define SOBEL_STORAGE StoragePrecision::Float16
+    //#define GAUSSIAN_SIGMA 1.0f  // denoise the grayscale image before edge detection
+    //#define USE_CANNY  // thin, connected Canny edges instead of the Sobel magnitude
+    //#define USE_HOG  // also extract HOG features, from the gradients of a single pass
+    //#define PROFILE_STAGES  // device time per kernel and copy, reported at the end
+
+  #ifdef PROFILE_STAGES
+    // The image is copied in, and the edges out, by explicit copies so they
+    // are timed like the kernels
+    buffer<uint8_t, 1> u8_image_in_buffer{range<1>(width * height * channels)};
+    buffer<uint8_t, 1> u8_image_out_buffer{range<1>(width * height)};
+  #else
     // Create sycl buffer for the input image
-    buffer<uint8_t, 1> u8_image_in_buffer{u8_image_in, width * height * channels};
+    // Read only, used in place (no copy for a mapped file, no write back)
+    buffer<uint8_t, 1> u8_image_in_buffer{u8_image_in, range<1>(width * height * channels),
+                                          {property::buffer::use_host_ptr()}};
+    //buffer<uint8_t, 1> u8_image_out_buffer{u8_image_out.data(), width * height};
+    buffer u8_image_out_buffer(u8_image_out);
+  #endif
     // Create sycl buffer for the grayscale image
     buffer<float, 1> fl_grayscale_buffer{fl_grayscale.data(),width * height};
 
     buffer<float, 1> fl_sobel_img_buffer{width * height};
 
-    //buffer<uint8_t, 1> u8_image_out_buffer{u8_image_out.data(), width * height};
-    buffer u8_image_out_buffer(u8_image_out);
-
-    #define USE_SYCL
-    //#undef USE_SYCL
-
+  #ifdef PROFILE_STAGES
+    queue sycl_que(selector, exception_handler, {property::queue::enable_profiling()});
+    StageProfiler profiler;
+    SetStageProfiler(&profiler);
+  #else
     queue sycl_que(selector, exception_handler);
+  #endif
     
     try {
       //queue q(selector, exception_handler);
@@ -171,32 +375,136 @@ int main() {
       cout << "Local Memory Size: " 
           << (float)(sycl_que.get_device().get_info<info::device::local_mem_size>())/1024.0f 
           << " kBytes" << std::endl;
+
+    #ifdef PROFILE_STAGES
+      ProfileStage("CopyImageToDevice", sycl_que.submit([&](handler &h) {
+        accessor image(u8_image_in_buffer, h, write_only, no_init);
+        h.copy(u8_image_in, image);
+      }));
+    #endif
       
-      #ifdef USE_SYCL
+      #if defined(USE_SYCL) && defined(USE_FUSED_RGB_TO_EDGES)
+        cout << "Using SYCL, fused u8 to u8 edges" << std::endl;
+        sycl_que.wait();
+        timeBegin = std::chrono::steady_clock::now();
+        for(int i = 0; i < numIterations; i++)
+        {
+          SobelEdgesUint8Buffer(sycl_que, u8_image_in_buffer, u8_image_out_buffer,
+                    width, height, channels);
+        }
+        // Device time, like Sobel-usm, not just the submissions
+        sycl_que.wait();
+        timeEnd = std::chrono::steady_clock::now();
+      #elif defined(USE_SYCL) && defined(USE_CANNY)
+        cout << "Using SYCL, Canny edges" << std::endl;
+        ConvertToGrayscaleBuffer(sycl_que, u8_image_in_buffer, fl_grayscale_buffer, width, height,
+                                 channels);
+        {
+          SobelContext sobelCtx(sycl_que, width, height, SOBEL_STORAGE);
+          sycl_que.wait();
+          timeBegin = std::chrono::steady_clock::now();
+          for(int i = 0; i < numIterations; i++)
+          {
+            CannyBuffer(sobelCtx, fl_grayscale_buffer, u8_image_out_buffer);
+          }
+          sycl_que.wait();
+          timeEnd = std::chrono::steady_clock::now();
+        }
+      #elif defined(USE_SYCL)
         cout << "Using SYCL" << std::endl;
         // Convert to gray scale range 0 ... 1.0
         ConvertToGrayscaleBuffer(sycl_que, u8_image_in_buffer, fl_grayscale_buffer, width, height,
                                  channels);
+      #ifdef GAUSSIAN_SIGMA
+        {
+          // The blurred image replaces the grayscale one
+          buffer<float, 1> fl_blurred_buffer{width * height};
+          GaussianBlurBuffer(sycl_que, fl_grayscale_buffer, fl_blurred_buffer, width, height, GAUSSIAN_SIGMA);
+          ProfileStage("CopyBlurred", sycl_que.submit([&](handler &h) {
+            accessor blurred(fl_blurred_buffer, h, read_only);
+            accessor gray(fl_grayscale_buffer, h, write_only, no_init);
+            h.copy(blurred, gray);
+          }));
+        }
+      #endif
 
+      #ifndef USE_FUSED_SOBEL
+        // Scratch memory is allocated once here and reused by every iteration
+        SobelContext sobelCtx(sycl_que, width, height, SOBEL_STORAGE);
+        cout << "Sobel context holds " 
+            << (float)sobelCtx.BytesAllocated()/(1024.0f * 1024.0f) << " MBytes" << std::endl;
+      #endif
+
+        // Only the Sobel iterations are timed, not the conversion before them
+        sycl_que.wait();
         timeBegin = std::chrono::steady_clock::now();
         for(int i = 0; i < numIterations; i++)
         {
-          SobelFilter(sycl_que, fl_grayscale_buffer, fl_sobel_img_buffer,
+        #ifdef USE_FUSED_SOBEL
+          SobelFilterFused(sycl_que, fl_grayscale_buffer, fl_sobel_img_buffer,
                     width, height);
+        #else
+          SobelFilter(sobelCtx, fl_grayscale_buffer, fl_sobel_img_buffer);
+        #endif
         }
+        sycl_que.wait();
         timeEnd = std::chrono::steady_clock::now();
 
+      #ifndef USE_FUSED_SOBEL
+        if (SOBEL_STORAGE != StoragePrecision::Float32)
+        {
+          buffer<float, 1> fl_reference_buffer{width * height};
+          SobelFilter(sycl_que, fl_grayscale_buffer, fl_reference_buffer, width, height);
+          host_accessor reference(fl_reference_buffer, read_only);
+          host_accessor result(fl_sobel_img_buffer, read_only);
+          PrintAccuracy(reference.get_pointer(), result.get_pointer(), width, height);
+        }
+      #endif
+
+      #ifdef USE_HOG
+        {
+          // Magnitude and orientation from one pass, the magnitude replaces the Sobel output
+          HogOptions hogOptions;
+          const size_t hogSize = HogDescriptorSize(width, height, hogOptions);
+          buffer<uint8_t, 1> u8_orientation_buffer{width * height};
+          SobelMagnitudeOrientationBuffer(sycl_que, fl_grayscale_buffer, fl_sobel_img_buffer,
+                                          u8_orientation_buffer, width, height, hogOptions.numBins);
+          if (hogSize > 0)
+          {
+            buffer<float, 1> fl_hog_buffer{hogSize};
+            HogBuffer(sycl_que, fl_sobel_img_buffer, u8_orientation_buffer, fl_hog_buffer, width, height,
+                      hogOptions);
+            cout << "HOG descriptor of " << hogSize << " floats, " << hogOptions.cellSize << " x "
+                 << hogOptions.cellSize << " cells" << std::endl;
+          }
+        }
+      #endif
+
         ConvertToUint8Buffer(sycl_que, fl_sobel_img_buffer, u8_image_out_buffer, width, height);
         //ConvertToUint8Buffer(sycl_que, fl_grayscale_buffer, u8_image_out_buffer, width, height);
         //initUint8SyclBuffer(sycl_que, u8_image_out, width, height, (uint8_t)128);
         //initUint8SyclBuffer1(sycl_que, u8_image_out_buffer, width, height, (uint8_t)128);
       #endif
 
+      #if defined(USE_SYCL) && defined(PROFILE_STAGES)
+        ProfileStage("CopyEdgesToHost", sycl_que.submit([&](handler &h) {
+          accessor edges(u8_image_out_buffer, h, read_only);
+          h.copy(edges, u8_image_out.data());
+        }));
+      #endif
+
     } catch (std::exception const &e) {
       cout << "An exception is caught while computing IotaParallel on device:  " << e.what() << std::endl;
       terminate();
     }
     sycl_que.wait();
+
+  #ifdef PROFILE_STAGES
+    SetStageProfiler(nullptr);
+    cout << "Device time per stage over " << numIterations << " iterations:" << std::endl;
+    profiler.Report(cout);
+  #endif
+    PrintPoolStats("Device scratch pool", UsmMemoryPool(sycl_que).Stats());
   } // End scope for SYCL buffers - causes synchronization with host.
   
   #ifndef USE_SYCL
@@ -205,16 +513,54 @@ int main() {
     cout << "Running C++ version" << std::endl;
     // Convert to gray scale range 0 ... 1.0
     ConvertToGrayscaleCpp(u8_image_in, fl_grayscale, width, height, channels);
+  #ifdef GAUSSIAN_SIGMA
+    {
+      std::vector<float> blurred(width * height);
+      GaussianBlurCpp(blurred.data(), fl_grayscale.data(), width, height, width, GAUSSIAN_SIGMA);
+      fl_grayscale.swap(blurred);
+    }
+  #endif
 
     std::vector<float> imageMag(width * height);
 
+    #define USE_HOST_THREADS  // run the C++ version on all the cores
+    //#undef USE_HOST_THREADS
+    #ifdef USE_HOST_THREADS
+    ThreadPool pool;
+    cout << "Using " << pool.NumThreads() << " host threads" << std::endl;
+    #endif
+
+  #ifdef USE_CANNY
+    cout << "Canny edges" << std::endl;
     timeBegin = std::chrono::steady_clock::now();
     for(int i = 0; i < numIterations; i++)
     {
-      SobelFilterCpp(fl_grayscale, imageMag, width, height);
+    #ifdef USE_HOST_THREADS
+      CannyCpp(pool, u8_image_out, fl_grayscale, width, height);
+    #else
+      CannyCpp(u8_image_out, fl_grayscale, width, height);
+    #endif
     }
     timeEnd = std::chrono::steady_clock::now();
+  #else
+    timeBegin = std::chrono::steady_clock::now();
+    for(int i = 0; i < numIterations; i++)
+    {
+    #ifdef USE_HOST_THREADS
+      SobelFilterCpp(pool, fl_grayscale, imageMag, width, height, Border::Clamp, 0.0f, SOBEL_STORAGE);
+    #else
+      SobelFilterCpp(fl_grayscale, imageMag, width, height, Border::Clamp, 0.0f, SOBEL_STORAGE);
+    #endif
+    }
+    timeEnd = std::chrono::steady_clock::now();
+    if (SOBEL_STORAGE != StoragePrecision::Float32)
+    {
+      std::vector<float> reference(width * height);
+      SobelFilterCpp(fl_grayscale, reference, width, height);
+      PrintAccuracy(reference.data(), imageMag.data(), width, height);
+    }
     ConvertToUint8Cpp(imageMag, u8_image_out, width, height); 
+  #endif
     //ConvertToUint8Cpp(fl_grayscale, u8_image_out, width, height);
     cout << "Done running C++" << std::endl;
   #endif
@@ -223,6 +569,7 @@ int main() {
 auto procTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(timeEnd - timeBegin);
 std::cout << "Processing Time " << (float)(procTimeUs.count())/(1000.0f * float(numIterations)) 
                                 << " msec]" << std::endl;
+PrintPoolStats("Host scratch pool", HostMemoryPool().Stats());
 
 #if 0
   // Print out some image values
@@ -248,10 +595,14 @@ std::cout << "Processing Time " << (float)(procTimeUs.count())/(1000.0f * float(
   cout << std::endl;
 #endif
 
-  stbi_write_png("image_grayscale.png", width, height, 1, u8_image_out.data(), width);
+  // Mapped input, mapped uncompressed output
+  if (mappedInput)
+    WriteMappedImage("image_grayscale.pgm", ImageFileFormat::Pgm, u8_image_out.data(), width, height);
+  else
+    stbi_write_png("image_grayscale.png", width, height, 1, u8_image_out.data(), width);
   
   // Reclaim now unused memory
-  stbi_image_free(u8_image_in);
+  if (u8_decoded) stbi_image_free(u8_decoded);
   //#endif
   //sycl::free(u8_out, sycl_que);
   cout << "Successfully completed on device.\n";
@@ -0,0 +1,1765 @@
+//==============================================================
+// Checks of the C++ (SIMD, threaded) and SYCL paths against the
+// scalar reference code on small images, including 1 pixel wide or
+// high images and sizes that are not a multiple of the SIMD width or
+// of HOST_BAND_ROWS.
+//
+// Paths documented as identical to the scalar code are compared
+// exactly (as floats, so -0 equals 0). Device results, which the
+// compiler may contract differently, are compared with a tolerance.
+//
+// Usage: Sobel-tests [--host]   (--host skips the device checks)
+//==============================================================
+#include <sycl/sycl.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batchPipeline.h"
+#include "boundedQueue.h"
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingBuffers.h"
+#include "imageUtilsUsingCpp.h"
+#include "imageUtilsUsingUsm.h"
+#include "imageUtilsSimdCpp.h"
+#include "floatStorage.h"
+#include "image.h"
+#include "imageIO.h"
+#include "memoryPool.h"
+#include "multiDevice.h"
+#include "stageProfiler.h"
+#include "stripStream.h"
+
+// For batchPipeline.cpp, which is linked in for ListBatchInputs
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace sycl;
+using namespace std;
+
+// The references below accumulate in the same order as the code under
+// test, so they have to be compiled with the same floating point rules
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#pragma clang fp reassociate(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+const int EXIT_ERROR_CODE = 1;
+
+// Create an exception handler for asynchronous SYCL exceptions
+static auto exception_handler = [](sycl::exception_list e_list) {
+  for (std::exception_ptr const &e : e_list) {
+    try {
+      std::rethrow_exception(e);
+    }
+    catch (std::exception const &e) {
+      std::cout << "Failure: " << e.what() << std::endl;
+      std::terminate();
+    }
+  }
+};
+
+// Small sizes: single pixels, single rows and columns, odd sizes around
+// the 8 and 16 float vectors and sizes spanning several row bands
+static const std::vector<std::pair<int, int>> testSizes = {
+  {1, 1}, {2, 1}, {1, 2}, {2, 2}, {1, 7}, {9, 1}, {3, 3}, {5, 4},
+  {17, 5}, {33, 7}, {67, 19}, {31, HOST_BAND_ROWS + 1}};
+
+static const Border allBorders[] = {Border::Clamp, Border::Wrap, Border::Reflect,
+                                    Border::Mirror, Border::Constant};
+
+static const char *borderNames[] = {"Clamp", "Wrap", "Reflect", "Mirror", "Constant"};
+
+static int numChecks = 0;
+static int numFailures = 0;
+
+static void Check(bool ok, const std::string &what)
+{
+  numChecks++;
+  if (!ok)
+  {
+    numFailures++;
+    cout << "FAIL: " << what << std::endl;
+  }
+}
+
+static std::string Describe(const char *name, int width, int height, Border border)
+{
+  std::stringstream ss;
+  ss << name << " " << width << "x" << height << " " << borderNames[static_cast<int>(border)];
+  return ss.str();
+}
+
+// Random values in 0 ... 1, the range of a gray image
+static std::vector<float> RandomImage(std::mt19937 &rng, int width, int height)
+{
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  std::vector<float> image(static_cast<size_t>(width) * height);
+  for (auto &v : image) v = dist(rng);
+  return image;
+}
+
+// Equal as floats, so a -0 matches a 0
+static bool Identical(const std::vector<float> &a, const std::vector<float> &b)
+{
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (!(a[i] == b[i])) return false;
+  }
+  return true;
+}
+
+// Every |a - b| within tolerance * (1 + |a|)
+static bool Close(const std::vector<float> &a, const std::vector<float> &b, float tolerance)
+{
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (!(std::fabs(a[i] - b[i]) <= tolerance * (1.0f + std::fabs(a[i])))) return false;
+  }
+  return true;
+}
+
+// Every pixel within 1, for u8 results truncated from floats that can
+// differ in the last bit
+static bool WithinOne(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b)
+{
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (std::abs(a[i] - b[i]) > 1) return false;
+  }
+  return true;
+}
+
+// The SIMD levels this CPU supports, Scalar first
+static std::vector<SimdLevel> SimdLevels()
+{
+  std::vector<SimdLevel> levels;
+  SimdLevel best = GetSimdLevel();
+  for (int l = 0; l <= static_cast<int>(best); l++) levels.push_back(static_cast<SimdLevel>(l));
+  return levels;
+}
+
+/***************************************************************
+ * Run fn on device buffers over a copy of in and return what it
+ * wrote to the output buffer.
+****************************************************************/
+template <typename TOut, typename TIn, typename F>
+static std::vector<TOut> RunOnDevice(const std::vector<TIn> &in, size_t outSize, F &&fn)
+{
+  std::vector<TIn> inCopy(in);
+  std::vector<TOut> out(outSize);
+  {
+    buffer<TIn, 1> inBuf{inCopy.data(), range<1>(inCopy.size())};
+    buffer<TOut, 1> outBuf{out.data(), range<1>(outSize)};
+    fn(inBuf, outBuf);
+  } // Destroying the buffers waits for the device and copies out back
+  return out;
+}
+
+/***************************************************************
+ * Index of coordinate i for border mode border, as the Border enum
+ * documents it. -1 means the constant. Written as repeated folding
+ * to check BorderIndex, not to share code with it.
+****************************************************************/
+static int ReferenceBorderIndex(Border border, int i, int n)
+{
+  switch (border)
+  {
+  case Border::Clamp:     // aaa|abc|ccc
+    return std::min(std::max(i, 0), n - 1);
+  case Border::Wrap:      // bc|abc|ab
+    while (i < 0) i += n;
+    while (i >= n) i -= n;
+    return i;
+  case Border::Reflect:   // cb|abc|ba
+    if (n == 1) return 0;
+    while (i < 0 || i >= n) i = i < 0 ? -i : 2 * (n - 1) - i;
+    return i;
+  case Border::Mirror:    // ba|abc|cb
+    while (i < 0 || i >= n) i = i < 0 ? -i - 1 : 2 * n - 1 - i;
+    return i;
+  default:
+    return i >= 0 && i < n ? i : -1;
+  }
+}
+
+// Plain 3x3 filter, the taps summed in row major order like Convolution3x3Cpp
+static std::vector<float> ReferenceConvolution3x3(const std::vector<float> &in, const float *pFilter,
+                                                  int width, int height, Border border, float constant)
+{
+  std::vector<float> out(in.size());
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      float value = 0.0f;
+      for (int l = -1; l <= 1; l++)
+      {
+        for (int k = -1; k <= 1; k++)
+        {
+          int ix = ReferenceBorderIndex(border, x + k, width);
+          int iy = ReferenceBorderIndex(border, y + l, height);
+          float v = ix < 0 || iy < 0 ? constant : in[iy * width + ix];
+          value += v * pFilter[(l + 1) * 3 + k + 1];
+        }
+      }
+      out[y * width + x] = value;
+    }
+  }
+  return out;
+}
+
+/***************************************************************
+ * Border modes: Convolution3x3Cpp at every SIMD level, single and
+ * multi threaded, against the reference filter. The filter has no
+ * symmetry so a flipped tap shows.
+****************************************************************/
+static void CheckBordersCpp(ThreadPool &pool)
+{
+  const float filter[9] = {0.5f, -1.0f, 2.0f, 0.25f, 3.0f, -0.75f, 1.5f, -2.0f, 0.125f};
+  const float constant = 0.375f;
+  std::mt19937 rng(5);
+  SimdLevel best = GetSimdLevel();
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceConvolution3x3(in, filter, width, height, border, constant);
+      std::vector<float> out(in.size());
+      for (SimdLevel level : SimdLevels())
+      {
+        SetSimdLevel(level);
+        std::string what = Describe("Convolution3x3Cpp", width, height, border) +
+                           " simd " + std::to_string(static_cast<int>(level));
+        Convolution3x3Cpp(out.data(), in.data(), filter, width, height, width, border, constant);
+        Check(Identical(ref, out), what);
+        Convolution3x3Cpp(pool, out.data(), in.data(), filter, width, height, width, border, constant);
+        Check(Identical(ref, out), what + " threaded");
+      }
+      SetSimdLevel(best);
+    }
+  }
+}
+
+static void CheckBordersDevice(queue &q)
+{
+  const float filter[9] = {0.5f, -1.0f, 2.0f, 0.25f, 3.0f, -0.75f, 1.5f, -2.0f, 0.125f};
+  const float constant = 0.375f;
+  std::mt19937 rng(5);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceConvolution3x3(in, filter, width, height, border, constant);
+      std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+          Convolution3x3Buffer(q, inBuf, outBuf, filter, width, height, border, constant);
+      });
+      Check(Close(ref, out, 1e-5f), Describe("Convolution3x3Buffer", width, height, border));
+    }
+  }
+}
+
+/***************************************************************
+ * StencilCpp<S> at every SIMD level, single and multi threaded,
+ * must give exactly what Convolution3x3Cpp gives with the stencil's
+ * coefficients. StencilBuffer<S> is compared with a tolerance.
+****************************************************************/
+template <typename S>
+static void CheckStencilCpp(const char *name, ThreadPool &pool)
+{
+  float filter[9];
+  for (int i = 0; i < 9; i++) filter[i] = static_cast<float>(S::coefficients[i]);
+  const float constant = 0.625f;
+  std::mt19937 rng(24);
+  SimdLevel best = GetSimdLevel();
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(in.size()), out(in.size());
+      SetSimdLevel(SimdLevel::Scalar);
+      Convolution3x3Cpp(ref.data(), in.data(), filter, width, height, width, border, constant);
+      for (SimdLevel level : SimdLevels())
+      {
+        SetSimdLevel(level);
+        std::string what = Describe(name, width, height, border) +
+                           " simd " + std::to_string(static_cast<int>(level));
+        StencilCpp<S>(out.data(), in.data(), width, height, width, border, constant);
+        Check(Identical(ref, out), what);
+        StencilCpp<S>(pool, out.data(), in.data(), width, height, width, border, constant);
+        Check(Identical(ref, out), what + " threaded");
+      }
+      SetSimdLevel(best);
+    }
+  }
+}
+
+template <typename S>
+static void CheckStencilDevice(const char *name, queue &q)
+{
+  const float constant = 0.625f;
+  std::mt19937 rng(24);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(in.size());
+      StencilCpp<S>(ref.data(), in.data(), width, height, width, border, constant);
+      std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+          StencilBuffer<S>(q, inBuf, outBuf, width, height, border, constant);
+      });
+      Check(Close(ref, out, 1e-5f), Describe(name, width, height, border) + " device");
+    }
+  }
+}
+
+static void CheckStencils(ThreadPool &pool)
+{
+  CheckStencilCpp<SobelXStencil>("SobelXStencil", pool);
+  CheckStencilCpp<SobelYStencil>("SobelYStencil", pool);
+  CheckStencilCpp<ScharrXStencil>("ScharrXStencil", pool);
+  CheckStencilCpp<ScharrYStencil>("ScharrYStencil", pool);
+  CheckStencilCpp<PrewittXStencil>("PrewittXStencil", pool);
+  CheckStencilCpp<PrewittYStencil>("PrewittYStencil", pool);
+  CheckStencilCpp<LaplacianStencil>("LaplacianStencil", pool);
+}
+
+static void CheckStencilsDevice(queue &q)
+{
+  CheckStencilDevice<SobelXStencil>("SobelXStencil", q);
+  CheckStencilDevice<SobelYStencil>("SobelYStencil", q);
+  CheckStencilDevice<ScharrXStencil>("ScharrXStencil", q);
+  CheckStencilDevice<ScharrYStencil>("ScharrYStencil", q);
+  CheckStencilDevice<PrewittXStencil>("PrewittXStencil", q);
+  CheckStencilDevice<PrewittYStencil>("PrewittYStencil", q);
+  CheckStencilDevice<LaplacianStencil>("LaplacianStencil", q);
+}
+
+/***************************************************************
+ * ConvertToGrayscaleRowSimd against luminance() for RGB and RGBA,
+ * every length up to a few vectors and unaligned starts. Whatever
+ * it converts must be bit identical, and the rest is left to the
+ * caller. Then ConvertToGrayscaleCpp and ConvertToGrayscaleBuffer
+ * on the test sizes.
+****************************************************************/
+static void CheckGrayscaleCpp()
+{
+  std::mt19937 rng(25);
+  SimdLevel best = GetSimdLevel();
+  for (int channels = 3; channels <= 4; channels++)
+  {
+    std::vector<uint8_t> pixels(70 * channels + 1);
+    for (auto &v : pixels) v = static_cast<uint8_t>(rng());
+    for (SimdLevel level : SimdLevels())
+    {
+      SetSimdLevel(level);
+      for (int start = 0; start <= 1; start++)
+      {
+        for (int n = 0; n <= 64; n++)
+        {
+          const uint8_t *pIn = pixels.data() + start;
+          std::vector<float> gray(n, -1.0f);
+          int done = ConvertToGrayscaleRowSimd(gray.data(), pIn, channels, n);
+          bool ok = done >= 0 && done <= n;
+          for (int i = 0; ok && i < n; i++)
+          {
+            const uint8_t *p = pIn + i * channels;
+            ok = i < done ? gray[i] == luminance(p[0], p[1], p[2]) : gray[i] == -1.0f;
+          }
+          std::stringstream ss;
+          ss << "ConvertToGrayscaleRowSimd " << channels << " channels, " << n << " pixels from byte "
+             << start << " simd " << static_cast<int>(level);
+          Check(ok, ss.str());
+        }
+      }
+    }
+    SetSimdLevel(best);
+
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> image(static_cast<size_t>(width) * height * channels);
+      for (auto &v : image) v = static_cast<uint8_t>(rng());
+      std::vector<float> ref(static_cast<size_t>(width) * height), gray(ref.size());
+      for (size_t i = 0; i < ref.size(); i++)
+      {
+        const uint8_t *p = &image[i * channels];
+        ref[i] = luminance(p[0], p[1], p[2]);
+      }
+      ConvertToGrayscaleCpp(image.data(), gray, width, height, channels);
+      std::stringstream ss;
+      ss << "ConvertToGrayscaleCpp " << width << "x" << height << " " << channels << " channels";
+      Check(Identical(ref, gray), ss.str());
+    }
+  }
+}
+
+static void CheckGrayscaleDevice(queue &q)
+{
+  std::mt19937 rng(25);
+  for (int channels = 3; channels <= 4; channels++)
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> image(static_cast<size_t>(width) * height * channels);
+      for (auto &v : image) v = static_cast<uint8_t>(rng());
+      std::vector<float> ref(static_cast<size_t>(width) * height);
+      ConvertToGrayscaleCpp(image.data(), ref, width, height, channels);
+      std::vector<float> gray = RunOnDevice<float>(image, ref.size(), [&](buffer<uint8_t, 1> &inBuf, buffer<float, 1> &outBuf) {
+          ConvertToGrayscaleBuffer(q, inBuf, outBuf, width, height, channels);
+      });
+      std::stringstream ss;
+      ss << "ConvertToGrayscaleBuffer " << width << "x" << height << " " << channels << " channels";
+      Check(Close(ref, gray, 1e-6f), ss.str());
+    }
+  }
+}
+
+/***************************************************************
+ * The F16C row conversions against HostHalf: every half to float,
+ * and to half every half value, the midpoints between neighbours
+ * (ties to even), the overflow and subnormal limits and random
+ * floats. NaNs only have to stay NaNs.
+****************************************************************/
+static void CheckHalfConversion()
+{
+  std::vector<uint16_t> halves(65536);
+  for (int i = 0; i < 65536; i++) halves[i] = static_cast<uint16_t>(i);
+  std::vector<float> floats(halves.size());
+  int done = HalfToFloatRowSimd(floats.data(), halves.data(), static_cast<int>(halves.size()));
+  bool ok = true;
+  for (int i = 0; i < done; i++)
+  {
+    HostHalf h;
+    h.bits = halves[i];
+    float ref = h;
+    ok = ok && (std::isnan(ref) ? std::isnan(floats[i]) : FloatBits(ref) == FloatBits(floats[i]));
+  }
+  Check(ok, "HalfToFloatRowSimd");
+
+  std::vector<float> values;
+  for (int i = 0; i < 0x7C00; i++)
+  {
+    HostHalf lo, hi;
+    lo.bits = static_cast<uint16_t>(i);
+    hi.bits = static_cast<uint16_t>(i + 1);
+    float a = lo, b = hi;
+    values.insert(values.end(), {a, -a, a + (b - a) * 0.5f, -(a + (b - a) * 0.5f)});
+  }
+  values.insert(values.end(), {65504.0f, 65519.99f, 65520.0f, 1.0e6f, 5.9604645e-8f, 2.9802322e-8f,
+                               2.9802326e-8f, 1.0e-10f, INFINITY, -INFINITY, NAN});
+  std::mt19937 rng(13);
+  std::uniform_real_distribution<float> dist(-8.0f, 8.0f);
+  for (int i = 0; i < 4096; i++) values.push_back(dist(rng));
+
+  std::vector<uint16_t> out(values.size());
+  done = FloatToHalfRowSimd(out.data(), values.data(), static_cast<int>(values.size()));
+  ok = true;
+  for (int i = 0; i < done; i++)
+  {
+    HostHalf ref(values[i]);
+    bool refNan = (ref.bits & 0x7FFFu) > 0x7C00u;
+    bool outNan = (out[i] & 0x7FFFu) > 0x7C00u;
+    ok = ok && (refNan ? outNan : ref.bits == out[i]);
+  }
+  Check(ok, "FloatToHalfRowSimd");
+}
+
+// Rounding a gradient to a p bit significand moves it by at most 2^-p of
+// its value, so the normalized magnitude can't move by more than 2^-p of
+// itself. Below 2^-14 half is subnormal and the step is a fixed 2^-24,
+// which the normalization scales up; on images whose gradients are only
+// rounding residue (e.g. 2 pixels wide with Wrap) that is all there is.
+// The slack covers that and float rounding in the magnitude.
+static bool WithinStorageBound(const std::vector<float> &ref, const std::vector<float> &out,
+                               int significandBits, float slack)
+{
+  if (ref.size() != out.size()) return false;
+  const float bound = std::ldexp(1.0f, -significandBits);
+  for (size_t i = 0; i < ref.size(); i++)
+  {
+    if (!(std::fabs(out[i] - ref[i]) <= bound * ref[i] * 1.0001f + slack)) return false;
+  }
+  return true;
+}
+
+// The normalization factor of SobelFilterCpp, 1 / the max of dx and dy
+static float SobelScale(const std::vector<float> &in, int width, int height, Border border, float constant)
+{
+  std::vector<float> dx(in.size()), dy(in.size());
+  StencilCpp<SobelXStencil>(dx.data(), in.data(), width, height, width, border, constant);
+  StencilCpp<SobelYStencil>(dy.data(), in.data(), width, height, width, border, constant);
+  float maxVal = std::max(FindMaxCpp(dx.data(), width, height), FindMaxCpp(dy.data(), width, height));
+  return maxVal > 0.0f ? 1.0f / maxVal : 0.0f;
+}
+
+// Largest error of a half subnormal after normalization, for both gradients
+static float HalfSubnormalSlack(float scale)
+{
+  return std::sqrt(2.0f) * std::ldexp(1.0f, -25) * scale;
+}
+
+/***************************************************************
+ * Sobel with Float16 and BFloat16 gradient storage against the
+ * Float32 result: within 2^-11 (half) and 2^-8 (bfloat16) of each
+ * pixel, single and multi threaded, with every border mode.
+****************************************************************/
+static void CheckStoragePrecisionCpp(ThreadPool &pool)
+{
+  const float constant = 0.5f;
+  std::mt19937 rng(13);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(in.size()), out(in.size());
+      SobelFilterCpp(in, ref, width, height, border, constant);
+      const float halfSlack = 1e-6f + HalfSubnormalSlack(SobelScale(in, width, height, border, constant));
+      SobelFilterCpp(in, out, width, height, border, constant, StoragePrecision::Float16);
+      Check(WithinStorageBound(ref, out, 11, halfSlack), Describe("SobelFilterCpp Float16", width, height, border));
+      SobelFilterCpp(pool, in, out, width, height, border, constant, StoragePrecision::Float16);
+      Check(WithinStorageBound(ref, out, 11, halfSlack), Describe("SobelFilterCpp Float16 threaded", width, height, border));
+      SobelFilterCpp(in, out, width, height, border, constant, StoragePrecision::BFloat16);
+      Check(WithinStorageBound(ref, out, 8, 1e-6f), Describe("SobelFilterCpp BFloat16", width, height, border));
+      SobelFilterCpp(pool, in, out, width, height, border, constant, StoragePrecision::BFloat16);
+      Check(WithinStorageBound(ref, out, 8, 1e-6f), Describe("SobelFilterCpp BFloat16 threaded", width, height, border));
+    }
+  }
+}
+
+static void CheckStoragePrecisionDevice(queue &q)
+{
+  const float constant = 0.5f;
+  const StoragePrecision precisions[] = {StoragePrecision::Float32, StoragePrecision::Float16,
+                                         StoragePrecision::BFloat16};
+  const int significandBits[] = {24, 11, 8};
+  const char *names[] = {"SobelFilter Float32", "SobelFilter Float16", "SobelFilter BFloat16"};
+  std::mt19937 rng(13);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(in.size());
+      SobelFilterCpp(in, ref, width, height, border, constant);
+      const float halfSlack = HalfSubnormalSlack(SobelScale(in, width, height, border, constant));
+      for (int p = 0; p < 3; p++)
+      {
+        std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+            SobelFilter(q, inBuf, outBuf, width, height, border, constant, precisions[p]);
+        });
+        float slack = 1e-5f + (precisions[p] == StoragePrecision::Float16 ? halfSlack : 0.0f);
+        Check(WithinStorageBound(ref, out, significandBits[p], slack), Describe(names[p], width, height, border));
+      }
+    }
+  }
+}
+
+// Integer Sobel as SobelFixedCpp documents it: LuminanceFixed (or the
+// first channel of 1 and 2 channel images), then the Sobel stencils on
+// the u8 gray image and SobelMagnitudeFixed
+static std::vector<uint8_t> ReferenceSobelFixed(const std::vector<uint8_t> &in, int width, int height,
+                                                int channels, int shift, Border border, uint8_t constant)
+{
+  std::vector<int> gray(static_cast<size_t>(width) * height);
+  for (size_t i = 0; i < gray.size(); i++)
+  {
+    const uint8_t *p = &in[i * channels];
+    gray[i] = channels >= 3 ? LuminanceFixed(p[0], p[1], p[2]) : p[0];
+  }
+  std::vector<uint8_t> out(gray.size());
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      int dx = 0, dy = 0;
+      for (int l = -1; l <= 1; l++)
+      {
+        for (int k = -1; k <= 1; k++)
+        {
+          int ix = ReferenceBorderIndex(border, x + k, width);
+          int iy = ReferenceBorderIndex(border, y + l, height);
+          int v = ix < 0 || iy < 0 ? constant : gray[iy * width + ix];
+          dx += SobelXStencil::coefficients[(l + 1) * 3 + k + 1] * v;
+          dy += SobelYStencil::coefficients[(l + 1) * 3 + k + 1] * v;
+        }
+      }
+      out[y * width + x] = SobelMagnitudeFixed(dx, dy, shift);
+    }
+  }
+  return out;
+}
+
+/***************************************************************
+ * SobelFixedCpp at every SIMD level, single and multi threaded,
+ * and SobelFixedBuffer must match the reference exactly: there is
+ * no float arithmetic to round differently.
+****************************************************************/
+static void CheckSobelFixedCpp(ThreadPool &pool)
+{
+  const uint8_t constant = 200;
+  std::mt19937 rng(12);
+  SimdLevel best = GetSimdLevel();
+  for (int channels : {1, 2, 3, 4})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> in(static_cast<size_t>(width) * height * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      for (Border border : allBorders)
+      {
+        for (int shift : {0, 2, 3})
+        {
+          std::vector<uint8_t> ref = ReferenceSobelFixed(in, width, height, channels, shift, border, constant);
+          std::vector<uint8_t> out(ref.size());
+          for (SimdLevel level : SimdLevels())
+          {
+            SetSimdLevel(level);
+            std::string what = Describe("SobelFixedCpp", width, height, border) + " " + std::to_string(channels) +
+                               " channels, shift " + std::to_string(shift) + " simd " + std::to_string(static_cast<int>(level));
+            SobelFixedCpp(out.data(), in.data(), width, height, channels, shift, border, constant);
+            Check(ref == out, what);
+            SobelFixedCpp(pool, out.data(), in.data(), width, height, channels, shift, border, constant);
+            Check(ref == out, what + " threaded");
+          }
+          SetSimdLevel(best);
+        }
+      }
+    }
+  }
+}
+
+static void CheckSobelFixedDevice(queue &q)
+{
+  const uint8_t constant = 200;
+  const int shift = 2;
+  std::mt19937 rng(12);
+  for (int channels : {1, 3, 4})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> in(static_cast<size_t>(width) * height * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      for (Border border : allBorders)
+      {
+        std::vector<uint8_t> ref = ReferenceSobelFixed(in, width, height, channels, shift, border, constant);
+        std::vector<uint8_t> out = RunOnDevice<uint8_t>(in, ref.size(), [&](buffer<uint8_t, 1> &inBuf, buffer<uint8_t, 1> &outBuf) {
+            SobelFixedBuffer(q, inBuf, outBuf, width, height, channels, shift, border, constant);
+        });
+        Check(ref == out, Describe("SobelFixedBuffer", width, height, border) + " " + std::to_string(channels) + " channels");
+      }
+    }
+  }
+}
+
+/***************************************************************
+ * The ThreadPool versions of the host functions must give exactly
+ * what the single threaded ones give, whatever the number of bands.
+****************************************************************/
+static void CheckThreadedCpp(ThreadPool &pool)
+{
+  const float constant = 0.25f;
+  const float kernelX[5] = {0.1f, -0.4f, 0.3f, 0.6f, -0.2f};
+  const float kernelY[3] = {0.25f, 0.5f, 0.25f};
+  std::mt19937 rng(6);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<float> in = RandomImage(rng, width, height);
+    std::vector<float> other = RandomImage(rng, width, height);
+    std::vector<float> a(numPixels), b(numPixels);
+
+    Check(FindMaxCpp(in.data(), width, height) == FindMaxCpp(pool, in.data(), width, height),
+          Describe("FindMaxCpp threaded", width, height, Border::Clamp));
+    ScaleImgCpp(in.data(), a.data(), width, height, 0.3f);
+    ScaleImgCpp(pool, in.data(), b.data(), width, height, 0.3f);
+    Check(Identical(a, b), Describe("ScaleImgCpp threaded", width, height, Border::Clamp));
+    ComputeMagnitudeCpp(in.data(), other.data(), a, width, height);
+    ComputeMagnitudeCpp(pool, in.data(), other.data(), b, width, height);
+    Check(Identical(a, b), Describe("ComputeMagnitudeCpp threaded", width, height, Border::Clamp));
+
+    for (Border border : allBorders)
+    {
+      for (StoragePrecision precision : {StoragePrecision::Float32, StoragePrecision::Float16,
+                                         StoragePrecision::BFloat16})
+      {
+        SobelFilterCpp(in, a, width, height, border, constant, precision);
+        SobelFilterCpp(pool, in, b, width, height, border, constant, precision);
+        Check(Identical(a, b), Describe("SobelFilterCpp threaded", width, height, border) +
+                               " precision " + std::to_string(static_cast<int>(precision)));
+      }
+      SeparableFilterCpp(a.data(), in.data(), kernelX, 5, kernelY, 3, width, height, width, border, constant);
+      SeparableFilterCpp(pool, b.data(), in.data(), kernelX, 5, kernelY, 3, width, height, width, border, constant);
+      Check(Identical(a, b), Describe("SeparableFilterCpp threaded", width, height, border));
+      for (float sigma : {0.8f, 2.0f})
+      {
+        GaussianBlurCpp(a.data(), in.data(), width, height, width, sigma, border, constant);
+        GaussianBlurCpp(pool, b.data(), in.data(), width, height, width, sigma, border, constant);
+        Check(Identical(a, b), Describe("GaussianBlurCpp threaded", width, height, border) +
+                               " sigma " + std::to_string(sigma));
+      }
+    }
+
+    std::vector<uint8_t> edgesA(numPixels), edgesB(numPixels);
+    CannyCpp(edgesA, in, width, height);
+    CannyCpp(pool, edgesB, in, width, height);
+    Check(edgesA == edgesB, Describe("CannyCpp threaded", width, height, Border::Clamp));
+
+    std::vector<uint8_t> binsA(numPixels), binsB(numPixels);
+    SobelMagnitudeOrientationCpp(in, a, binsA, width, height);
+    SobelMagnitudeOrientationCpp(pool, in, b, binsB, width, height);
+    Check(Identical(a, b) && binsA == binsB, Describe("SobelMagnitudeOrientationCpp threaded", width, height, Border::Clamp));
+
+    HogOptions options;
+    options.cellSize = 4;
+    std::vector<float> descriptorA(HogDescriptorSize(width, height, options));
+    std::vector<float> descriptorB(descriptorA.size());
+    Result resultA = HogCpp(descriptorA, a, binsA, width, height, options);
+    Result resultB = HogCpp(pool, descriptorB, a, binsA, width, height, options);
+    Check(resultA == resultB && Identical(descriptorA, descriptorB), Describe("HogCpp threaded", width, height, Border::Clamp));
+  }
+}
+
+/***************************************************************
+ * GaussianBlurCpp's fixed tap passes (sigma <= 1) against the
+ * generic SeparableFilterCpp with the same GaussianKernel, then
+ * the device versions against the host. The radius can exceed the
+ * image, so the borders are folded more than once.
+****************************************************************/
+static void CheckGaussianCpp()
+{
+  const float constant = 0.75f;
+  std::mt19937 rng(14);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      for (float sigma : {0.3f, 0.6f, 1.0f})
+      {
+        std::vector<float> kernel = GaussianKernel(sigma);
+        int taps = static_cast<int>(kernel.size());
+        std::vector<float> ref(in.size()), out(in.size());
+        SeparableFilterCpp(ref.data(), in.data(), kernel.data(), taps, kernel.data(), taps,
+                           width, height, width, border, constant);
+        GaussianBlurCpp(out.data(), in.data(), width, height, width, sigma, border, constant);
+        Check(Close(ref, out, 1e-6f), Describe("GaussianBlurCpp", width, height, border) +
+                                      " " + std::to_string(taps) + " taps");
+      }
+    }
+  }
+}
+
+static void CheckGaussianDevice(queue &q)
+{
+  const float constant = 0.75f;
+  std::mt19937 rng(14);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      for (float sigma : {0.6f, 2.0f})
+      {
+        std::vector<float> ref(in.size());
+        GaussianBlurCpp(ref.data(), in.data(), width, height, width, sigma, border, constant);
+        std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+            GaussianBlurBuffer(q, inBuf, outBuf, width, height, sigma, border, constant);
+        });
+        Check(Close(ref, out, 1e-5f), Describe("GaussianBlurBuffer", width, height, border) +
+                                      " sigma " + std::to_string(sigma));
+      }
+    }
+  }
+}
+
+// An image in memory read row by row, and a result written to memory
+class VectorRowSource : public RowSource
+{
+public:
+  VectorRowSource(const std::vector<uint8_t> &pixels, int width, int height, int channels)
+      : pixels_(pixels), width_(width), height_(height), channels_(channels) {}
+  int Width() const override { return width_; }
+  int Height() const override { return height_; }
+  int Channels() const override { return channels_; }
+  bool ReadRows(uint8_t *pRows, int numRows) override
+  {
+    size_t bytes = static_cast<size_t>(numRows) * width_ * channels_;
+    if (next_ + bytes > pixels_.size()) return false;
+    std::copy(pixels_.begin() + next_, pixels_.begin() + next_ + bytes, pRows);
+    next_ += bytes;
+    return true;
+  }
+
+private:
+  const std::vector<uint8_t> &pixels_;
+  int width_, height_, channels_;
+  size_t next_ = 0;
+};
+
+class VectorRowSink : public RowSink
+{
+public:
+  explicit VectorRowSink(int width) : width_(width) {}
+  bool WriteRows(const uint8_t *pRows, int numRows) override
+  {
+    rows.insert(rows.end(), pRows, pRows + static_cast<size_t>(numRows) * width_);
+    return true;
+  }
+  std::vector<uint8_t> rows;
+
+private:
+  int width_;
+};
+
+// SobelStreamCpp on the whole image at once: gray, the Sobel stencils with
+// the constant border pixel converted like the image, the fixed scale of 4
+static std::vector<uint8_t> ReferenceStream(const std::vector<uint8_t> &in, int width, int height,
+                                            int channels, Border border, uint8_t constant)
+{
+  size_t numPixels = static_cast<size_t>(width) * height;
+  std::vector<float> gray(numPixels), dx(numPixels), dy(numPixels);
+  for (size_t i = 0; i < numPixels; i++)
+  {
+    const uint8_t *p = &in[i * channels];
+    gray[i] = channels >= 3 ? luminance(p[0], p[1], p[2]) : p[0] / 255.0f;
+  }
+  float grayConstant = channels >= 3 ? luminance(constant, constant, constant) : constant / 255.0f;
+  StencilCpp<SobelXStencil>(dx.data(), gray.data(), width, height, width, border, grayConstant);
+  StencilCpp<SobelYStencil>(dy.data(), gray.data(), width, height, width, border, grayConstant);
+  std::vector<uint8_t> edges(numPixels);
+  for (size_t i = 0; i < numPixels; i++)
+  {
+    float x = dx[i] * 0.25f;
+    float y = dy[i] * 0.25f;
+    edges[i] = static_cast<uint8_t>(std::min(sqrtf(x * x + y * y) * 255.0f, 255.0f));
+  }
+  return edges;
+}
+
+/***************************************************************
+ * SobelStreamCpp must not depend on the strip height: every strip
+ * height, down to 1 row, gives the whole image result, for gray and
+ * RGB input and every border mode but Wrap, which is rejected.
+ * PnmRowSource must stretch samples of a maxval below 255.
+****************************************************************/
+static void CheckStreamCpp(ThreadPool &pool)
+{
+  std::mt19937 rng(16);
+  for (int channels : {1, 3})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> in(static_cast<size_t>(width) * height * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      for (Border border : allBorders)
+      {
+        std::vector<uint8_t> ref = ReferenceStream(in, width, height, channels, border, 180);
+        for (int stripRows : {1, 2, 5, 256})
+        {
+          VectorRowSource source(in, width, height, channels);
+          VectorRowSink sink(width);
+          StreamOptions options;
+          options.stripRows = stripRows;
+          options.border = border;
+          options.constant = 180;
+          StreamStats stats;
+          Result result = SobelStreamCpp(pool, source, sink, options, stats);
+          std::string what = Describe("SobelStreamCpp", width, height, border) + " " +
+                             std::to_string(channels) + " channels, strips of " + std::to_string(stripRows);
+          if (border == Border::Wrap) Check(result == Result::InvalidArgument, what);
+          else Check(result == Result::Ok && sink.rows == ref, what);
+        }
+      }
+    }
+  }
+
+  const char *path = "sobel_tests_maxval.pgm";
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "P5\n4 1\n15\n";
+    const char samples[4] = {0, 1, 7, 15};
+    file.write(samples, 4);
+  }
+  PnmRowSource source;
+  uint8_t row[4] = {};
+  bool ok = source.Open(path) == Result::Ok && source.ReadRows(row, 1);
+  Check(ok && row[0] == 0 && row[1] == 17 && row[2] == 119 && row[3] == 255, "PnmRowSource maxval 15");
+  std::remove(path);
+}
+
+static void CheckStreamDevice(queue &q)
+{
+  std::mt19937 rng(16);
+  for (int channels : {1, 3})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      std::vector<uint8_t> in(static_cast<size_t>(width) * height * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      for (Border border : {Border::Clamp, Border::Reflect, Border::Mirror, Border::Constant})
+      {
+        std::vector<uint8_t> ref = ReferenceStream(in, width, height, channels, border, 180);
+        VectorRowSource source(in, width, height, channels);
+        VectorRowSink sink(width);
+        StreamOptions options;
+        options.stripRows = 5;
+        options.border = border;
+        options.constant = 180;
+        StreamStats stats;
+        Result result = SobelStreamBuffer(q, source, sink, options, stats);
+        Check(result == Result::Ok && WithinOne(ref, sink.rows), Describe("SobelStreamBuffer", width, height, border) + " " + std::to_string(channels) + " channels");
+      }
+    }
+  }
+}
+
+/***************************************************************
+ * The device Sobel variants against SobelFilterCpp: the device max
+ * reduction (exact, max doesn't depend on the order), the fused
+ * kernel and a SobelContext reused for a second frame.
+****************************************************************/
+static void CheckSobelDevice(queue &q)
+{
+  const float constant = 0.25f;
+  std::mt19937 rng(1);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    std::vector<float> centered(in);
+    for (float &v : centered) v -= 0.5f;
+
+    float refMax = FindMaxCpp(in.data(), width, height);
+    float refAbsMax = 0.0f;
+    for (float v : centered) refAbsMax = std::max(refAbsMax, std::fabs(v));
+    std::vector<float> maxVal = RunOnDevice<float>(in, 1, [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+        FindMaxValBuffer(q, inBuf, outBuf, width, height);
+    });
+    Check(maxVal[0] == refMax, Describe("FindMaxValBuffer", width, height, Border::Clamp));
+    maxVal = RunOnDevice<float>(centered, 1, [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+        FindMaxValBuffer(q, inBuf, outBuf, width, height, true);
+    });
+    Check(maxVal[0] == refAbsMax, Describe("FindMaxValBuffer abs", width, height, Border::Clamp));
+
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(in.size());
+      SobelFilterCpp(in, ref, width, height, border, constant);
+      std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+          SobelFilterFused(q, inBuf, outBuf, width, height, border, constant);
+      });
+      Check(Close(ref, out, 1e-5f), Describe("SobelFilterFused", width, height, border));
+    }
+  }
+
+  // The scratch memory of the first frame must not leak into the second
+  const int width = 67, height = 19;
+  SobelContext ctx(q, width, height);
+  for (int frame = 0; frame < 2; frame++)
+  {
+    std::vector<float> in = RandomImage(rng, width, height);
+    std::vector<float> ref(in.size());
+    SobelFilterCpp(in, ref, width, height, Border::Reflect);
+    std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+        SobelFilter(ctx, inBuf, outBuf, Border::Reflect);
+    });
+    Check(Close(ref, out, 1e-5f), "SobelFilter with a SobelContext, frame " + std::to_string(frame));
+  }
+}
+
+// SobelFilterCpp of the gray image, saturated to u8
+static std::vector<uint8_t> ReferenceEdges(const std::vector<uint8_t> &in, int width, int height,
+                                           int channels, Border border, float grayConstant)
+{
+  size_t numPixels = static_cast<size_t>(width) * height;
+  std::vector<float> gray(numPixels), magnitude(numPixels);
+  for (size_t i = 0; i < numPixels; i++)
+  {
+    const uint8_t *p = &in[i * channels];
+    gray[i] = channels >= 3 ? luminance(p[0], p[1], p[2]) : p[0] / 255.0f;
+  }
+  SobelFilterCpp(gray, magnitude, width, height, border, grayConstant);
+  std::vector<uint8_t> edges(numPixels);
+  for (size_t i = 0; i < numPixels; i++)
+  {
+    edges[i] = static_cast<uint8_t>(std::min(magnitude[i] * 255.0f, 255.0f));
+  }
+  return edges;
+}
+
+/***************************************************************
+ * SobelEdgesUint8Buffer against the host: the normalized result
+ * against SobelFilterCpp of the gray image, the fixed scale one
+ * against the streaming reference. Off by 1 is allowed where a last
+ * bit difference moves the truncation to u8.
+****************************************************************/
+/***************************************************************
+ * The USM pipeline of Sobel-usm, chained with events: grayscale
+ * against ConvertToGrayscaleCpp, SobelFilterUsm against
+ * SobelFilterCpp for every border, the u8 result against the
+ * saturated device magnitude.
+****************************************************************/
+static void CheckUsmDevice(queue &q)
+{
+  const float constant = 0.25f;
+  std::mt19937 rng(9);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    const int channels = 3;
+    std::vector<uint8_t> image(numPixels * channels);
+    for (auto &v : image) v = static_cast<uint8_t>(rng());
+    std::vector<float> refGray(numPixels);
+    ConvertToGrayscaleCpp(image.data(), refGray, width, height, channels);
+
+    uint8_t *d_image = malloc_device<uint8_t>(image.size(), q);
+    float *d_gray = malloc_device<float>(numPixels, q);
+    float *d_sobel = malloc_device<float>(numPixels, q);
+    float *d_max = malloc_device<float>(1, q);
+    uint8_t *d_u8 = malloc_device<uint8_t>(numPixels, q);
+
+    event copied = q.memcpy(d_image, image.data(), image.size());
+    event grayDone = ConvertToGrayscaleUsm(q, d_image, d_gray, width, height, channels, {copied});
+    std::vector<float> gray(numPixels);
+    q.memcpy(gray.data(), d_gray, numPixels * sizeof(float), grayDone).wait();
+    Check(Close(refGray, gray, 1e-6f), Describe("ConvertToGrayscaleUsm", width, height, Border::Clamp));
+
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref(numPixels);
+      SobelFilterCpp(refGray, ref, width, height, border, constant);
+      event sobelDone = SobelFilterUsm(q, d_gray, d_sobel, d_max, width, height, border, constant, {grayDone});
+      event u8Done = ConvertToUint8Usm(q, d_sobel, d_u8, width, height, {sobelDone});
+      std::vector<float> out(numPixels);
+      std::vector<uint8_t> u8(numPixels), refU8(numPixels);
+      q.memcpy(out.data(), d_sobel, numPixels * sizeof(float), u8Done).wait();
+      q.memcpy(u8.data(), d_u8, numPixels).wait();
+      Check(Close(ref, out, 1e-5f), Describe("SobelFilterUsm", width, height, border));
+      // Unlike ConvertToUint8Cpp it saturates, the magnitude reaches sqrt(2)
+      for (size_t i = 0; i < numPixels; i++)
+        refU8[i] = static_cast<uint8_t>(std::min(std::max(out[i] * 255.0f, 0.0f), 255.0f));
+      Check(refU8 == u8, Describe("ConvertToUint8Usm", width, height, border));
+    }
+
+    free(d_image, q);
+    free(d_gray, q);
+    free(d_sobel, q);
+    free(d_max, q);
+    free(d_u8, q);
+  }
+}
+
+/***************************************************************
+ * The stages SobelFilterFused records through SetStageProfiler. q
+ * has no enable_profiling, so its events are listed with no times
+ * and counted by Unprofiled().
+****************************************************************/
+static void CheckStageProfilerDevice(queue &q)
+{
+  const int width = 33, height = 7;
+  std::mt19937 rng(11);
+  std::vector<float> in = RandomImage(rng, width, height);
+  StageProfiler profiler;
+  StageProfiler *previous = SetStageProfiler(&profiler);
+  RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+      SobelFilterFused(q, inBuf, outBuf, width, height);
+  });
+  SetStageProfiler(previous);
+
+  std::vector<StageStats> stats = profiler.Stats();
+  bool ok = stats.size() == 3 && stats[0].name == "SobelFusedMaxInit" && stats[1].name == "SobelFused" &&
+            stats[2].name == "ScaleImg";
+  for (const StageStats &s : stats) ok = ok && s.count == 0 && s.totalMs == 0.0;
+  std::stringstream report;
+  profiler.Report(report);
+  Check(ok && profiler.Unprofiled() == 3 && report.str().find("3 events without profiling info") != std::string::npos,
+        "StageProfiler events of a queue without profiling");
+}
+
+static void CheckEdgesUint8Device(queue &q)
+{
+  const uint8_t constant = 180;
+  std::mt19937 rng(8);
+  for (int channels : {1, 3, 4})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      size_t numPixels = static_cast<size_t>(width) * height;
+      std::vector<uint8_t> in(numPixels * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      float grayConstant = channels >= 3 ? luminance(constant, constant, constant) : constant / 255.0f;
+
+      for (Border border : allBorders)
+      {
+        std::vector<uint8_t> normalized = ReferenceEdges(in, width, height, channels, border, grayConstant);
+        std::vector<uint8_t> fixedScale = ReferenceStream(in, width, height, channels, border, constant);
+
+        for (bool normalize : {true, false})
+        {
+          const std::vector<uint8_t> &ref = normalize ? normalized : fixedScale;
+          std::vector<uint8_t> out = RunOnDevice<uint8_t>(in, numPixels, [&](buffer<uint8_t, 1> &inBuf, buffer<uint8_t, 1> &outBuf) {
+              SobelEdgesUint8Buffer(q, inBuf, outBuf, width, height, channels, normalize, border, grayConstant);
+          });
+          Check(WithinOne(ref, out), Describe(normalize ? "SobelEdgesUint8Buffer normalized" : "SobelEdgesUint8Buffer",
+                             width, height, border) + " " + std::to_string(channels) + " channels");
+        }
+      }
+    }
+  }
+}
+
+/***************************************************************
+ * CannyBuffer against CannyCpp, with and without the pre-blur. A
+ * magnitude within a rounding step of a threshold can go either way
+ * (and take its chain along), so up to 1% of the pixels may differ.
+****************************************************************/
+static void CheckCannyDevice(queue &q)
+{
+  std::mt19937 rng(15);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (float sigma : {0.0f, 1.0f})
+    {
+      std::vector<uint8_t> ref(numPixels);
+      CannyCpp(ref, in, width, height, sigma);
+      std::vector<uint8_t> out = RunOnDevice<uint8_t>(in, numPixels, [&](buffer<float, 1> &inBuf, buffer<uint8_t, 1> &outBuf) {
+          CannyBuffer(q, inBuf, outBuf, width, height, sigma);
+      });
+      size_t differences = 0;
+      for (size_t i = 0; i < numPixels; i++) differences += out[i] != ref[i];
+      Check(differences * 100 <= numPixels, Describe("CannyBuffer", width, height, Border::Clamp) +
+                                            " sigma " + std::to_string(sigma));
+    }
+  }
+}
+
+/***************************************************************
+ * SobelEdgesPartitioned with three bands on the one device against
+ * the whole frame result: the halos and the max over all bands
+ * must make the seams invisible. Gray input and Wrap are rejected.
+****************************************************************/
+static void CheckPartitionedDevice(queue &q)
+{
+  const uint8_t constant = 180;
+  std::vector<queue> queues = {q, q, q};
+  std::mt19937 rng(20);
+  for (int channels : {3, 4})
+  {
+    for (auto &size : testSizes)
+    {
+      int width = size.first, height = size.second;
+      size_t numPixels = static_cast<size_t>(width) * height;
+      std::vector<uint8_t> in(numPixels * channels);
+      for (auto &v : in) v = static_cast<uint8_t>(rng());
+      float grayConstant = luminance(constant, constant, constant);
+      for (Border border : allBorders)
+      {
+        std::vector<uint8_t> out(numPixels);
+        PartitionStats stats;
+        Result result = SobelEdgesPartitioned(queues, in.data(), out.data(), width, height, channels,
+                                              stats, border, grayConstant);
+        std::string what = Describe("SobelEdgesPartitioned", width, height, border) + " " +
+                           std::to_string(channels) + " channels";
+        if (border == Border::Wrap)
+        {
+          Check(result == Result::InvalidArgument, what);
+          continue;
+        }
+        std::vector<uint8_t> ref = ReferenceEdges(in, width, height, channels, border, grayConstant);
+        Check(result == Result::Ok && WithinOne(ref, out), what);
+      }
+    }
+  }
+  std::vector<uint8_t> gray(64), out(64);
+  PartitionStats stats;
+  Check(SobelEdgesPartitioned(queues, gray.data(), out.data(), 8, 8, 1, stats) == Result::InvalidArgument,
+        "SobelEdgesPartitioned 1 channel");
+}
+
+/***************************************************************
+ * SobelMagnitudeOrientationCpp: the magnitude of SobelFilterCpp and
+ * the QuantizeOrientation bin of the Sobel gradients. The device
+ * versions of it and of HOG against the host; atan2 may round
+ * differently on the device, so up to 1% of the bins may differ.
+****************************************************************/
+static void CheckOrientationCpp()
+{
+  std::mt19937 rng(21);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      for (int numBins : {ORIENTATION_BINS, 4})
+      {
+        std::vector<float> refMagnitude(numPixels), dx(numPixels), dy(numPixels);
+        SobelFilterCpp(in, refMagnitude, width, height, border);
+        StencilCpp<SobelXStencil>(dx.data(), in.data(), width, height, width, border);
+        StencilCpp<SobelYStencil>(dy.data(), in.data(), width, height, width, border);
+        std::vector<uint8_t> refBins(numPixels);
+        for (size_t i = 0; i < numPixels; i++) refBins[i] = QuantizeOrientation(dx[i], dy[i], numBins);
+
+        std::vector<float> magnitude;
+        std::vector<uint8_t> bins;
+        Result result = SobelMagnitudeOrientationCpp(in, magnitude, bins, width, height, numBins, border);
+        Check(result == Result::Ok && Close(refMagnitude, magnitude, 1e-6f) && refBins == bins,
+              Describe("SobelMagnitudeOrientationCpp", width, height, border) + " " + std::to_string(numBins) + " bins");
+      }
+    }
+  }
+}
+
+static void CheckOrientationDevice(queue &q)
+{
+  std::mt19937 rng(21);
+  std::vector<std::pair<int, int>> sizes = testSizes;
+  sizes.push_back({45, 37});
+  for (auto &size : sizes)
+  {
+    int width = size.first, height = size.second;
+    size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> refMagnitude;
+      std::vector<uint8_t> refBins;
+      SobelMagnitudeOrientationCpp(in, refMagnitude, refBins, width, height, ORIENTATION_BINS, border);
+      std::vector<float> magnitude(numPixels);
+      std::vector<uint8_t> bins(numPixels);
+      {
+        buffer<float, 1> inBuf{in.data(), range<1>(numPixels)};
+        inBuf.set_write_back(false);
+        buffer<float, 1> magnitudeBuf{magnitude.data(), range<1>(numPixels)};
+        buffer<uint8_t, 1> binsBuf{bins.data(), range<1>(numPixels)};
+        SobelMagnitudeOrientationBuffer(q, inBuf, magnitudeBuf, binsBuf, width, height, ORIENTATION_BINS, border);
+      }
+      size_t differences = 0;
+      for (size_t i = 0; i < numPixels; i++) differences += bins[i] != refBins[i];
+      Check(Close(refMagnitude, magnitude, 1e-5f) && differences * 100 <= numPixels,
+            Describe("SobelMagnitudeOrientationBuffer", width, height, border));
+    }
+
+    // HOG of the same host gradients on both sides
+    HogOptions options;
+    options.cellSize = 4;
+    std::vector<float> magnitude;
+    std::vector<uint8_t> bins;
+    SobelMagnitudeOrientationCpp(in, magnitude, bins, width, height, options.numBins);
+    std::vector<float> ref(HogDescriptorSize(width, height, options));
+    if (ref.empty()) continue;  // no full block, both sides reject it
+    HogCpp(ref, magnitude, bins, width, height, options);
+    std::vector<float> descriptor(ref.size());
+    {
+      buffer<float, 1> magnitudeBuf{magnitude.data(), range<1>(numPixels)};
+      magnitudeBuf.set_write_back(false);
+      buffer<uint8_t, 1> binsBuf{bins.data(), range<1>(numPixels)};
+      binsBuf.set_write_back(false);
+      buffer<float, 1> descriptorBuf{descriptor.data(), range<1>(descriptor.size())};
+      HogBuffer(q, magnitudeBuf, binsBuf, descriptorBuf, width, height, options);
+    }
+    Check(Close(ref, descriptor, 1e-4f), Describe("HogBuffer", width, height, Border::Clamp));
+  }
+}
+
+// Copy a packed image into a pitched Image<float> and mark its padding
+static void FillPitched(Image<float> &image, const std::vector<float> &pixels, float padding)
+{
+  for (int y = 0; y < image.Height(); y++)
+  {
+    float *pRow = image.Row(y);
+    std::copy(pixels.begin() + static_cast<size_t>(y) * image.Width(),
+              pixels.begin() + static_cast<size_t>(y + 1) * image.Width(), pRow);
+    std::fill(pRow + image.Width(), pRow + image.Pitch(), padding);
+  }
+}
+
+// The pixels of out must be ref and its padding must still hold padding
+static bool MatchesPitched(const Image<float> &out, const std::vector<float> &ref, float padding, float tolerance)
+{
+  for (int y = 0; y < out.Height(); y++)
+  {
+    const float *pRow = out.Row(y);
+    for (int x = 0; x < out.Width(); x++)
+    {
+      float r = ref[static_cast<size_t>(y) * out.Width() + x];
+      if (!(std::fabs(pRow[x] - r) <= tolerance * (1.0f + std::fabs(r)))) return false;
+    }
+    for (size_t x = out.Width(); x < out.Pitch(); x++)
+    {
+      if (pRow[x] != padding) return false;
+    }
+  }
+  return true;
+}
+
+/***************************************************************
+ * Convolution3x3 on pitched Image<float>s must give the packed
+ * result and leave the row padding of the output alone.
+****************************************************************/
+static void CheckPitchedCpp(ThreadPool &pool)
+{
+  const float filter[9] = {0.5f, -1.0f, 2.0f, 0.25f, 3.0f, -0.75f, 1.5f, -2.0f, 0.125f};
+  const float constant = 0.375f;
+  const float padding = -7.0f;
+  std::mt19937 rng(22);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> pixels = RandomImage(rng, width, height);
+    Image<float> in(width, height), out(width, height);
+    FillPitched(in, pixels, 0.0f);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceConvolution3x3(pixels, filter, width, height, border, constant);
+      FillPitched(out, std::vector<float>(pixels.size(), 0.0f), padding);
+      Convolution3x3Cpp(out, in, filter, border, constant);
+      Check(MatchesPitched(out, ref, padding, 0.0f), Describe("Convolution3x3Cpp pitched", width, height, border));
+      FillPitched(out, std::vector<float>(pixels.size(), 0.0f), padding);
+      Convolution3x3Cpp(pool, out, in, filter, border, constant);
+      Check(MatchesPitched(out, ref, padding, 0.0f), Describe("Convolution3x3Cpp pitched threaded", width, height, border));
+    }
+  }
+}
+
+static void CheckPitchedDevice(queue &q)
+{
+  const float filter[9] = {0.5f, -1.0f, 2.0f, 0.25f, 3.0f, -0.75f, 1.5f, -2.0f, 0.125f};
+  const float constant = 0.375f;
+  const float padding = -7.0f;
+  std::mt19937 rng(22);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> pixels = RandomImage(rng, width, height);
+    Image<float> in(width, height), out(width, height);
+    FillPitched(in, pixels, 0.0f);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceConvolution3x3(pixels, filter, width, height, border, constant);
+      FillPitched(out, std::vector<float>(pixels.size(), 0.0f), padding);
+      Convolution3x3Buffer(q, in, out, filter, border, constant);
+      Check(MatchesPitched(out, ref, padding, 1e-5f), Describe("Convolution3x3Buffer pitched", width, height, border));
+    }
+  }
+}
+
+// A raw float file with a header of headerSize bytes and the given pixels
+static void WriteRawFloat(const char *path, uint32_t headerSize, const std::vector<float> &pixels,
+                          int width, int height, int channels = 1)
+{
+  RawFloatHeader header;
+  header.headerSize = headerSize;
+  header.width = width;
+  header.height = height;
+  header.channels = channels;
+  std::vector<char> bytes(headerSize, 0);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  std::ofstream file(path, std::ios::binary);
+  file.write(bytes.data(), bytes.size());
+  file.write(reinterpret_cast<const char *>(pixels.data()), pixels.size() * sizeof(float));
+}
+
+/***************************************************************
+ * MappedImage: raw float headers must keep the floats 32 byte
+ * aligned, and PGM files must have the maxval 255 of the pixels
+ * used in place.
+****************************************************************/
+static void CheckMappedImage()
+{
+  const char *path = "sobel_tests_mapped.rawf";
+  const int width = 5, height = 3;
+  std::mt19937 rng(17);
+  std::vector<float> pixels = RandomImage(rng, width, height);
+  for (uint32_t headerSize : {32u, 36u, 48u, 64u})
+  {
+    WriteRawFloat(path, headerSize, pixels, width, height);
+    MappedImage image;
+    Result result = image.Open(path);
+    std::string what = "MappedImage raw float header of " + std::to_string(headerSize) + " bytes";
+    if (headerSize % 32 != 0)
+    {
+      Check(result == Result::InvalidArgument, what);
+      continue;
+    }
+    bool ok = result == Result::Ok && image.Width() == width && image.Height() == height &&
+              reinterpret_cast<uintptr_t>(image.Floats()) % 32 == 0;
+    Check(ok && std::equal(pixels.begin(), pixels.end(), image.Floats()), what);
+  }
+
+  // Headers whose sizes don't match the one float after them. 2^30 x 2^30 x
+  // 16 is 2^64 elements, 0 when multiplied in size_t.
+  struct { int width, height, channels; bool ok; } headers[] = {
+    {1, 1, 1, true}, {2, 1, 1, false}, {1, 1, 0, false}, {-1, -1, 1, false},
+    {1 << 30, 1 << 30, 16, false}, {1 << 30, 1 << 30, 4, false}, {1, 1, RAW_FLOAT_MAX_CHANNELS + 1, false},
+  };
+  for (auto &h : headers)
+  {
+    WriteRawFloat(path, 32, {0.5f}, h.width, h.height, h.channels);
+    MappedImage image;
+    Result result = image.Open(path);
+    Check(h.ok ? result == Result::Ok && image.NumElements() == 1 : result == Result::InvalidArgument,
+          "MappedImage raw float header " + std::to_string(h.width) + " x " + std::to_string(h.height) +
+          " x " + std::to_string(h.channels));
+  }
+  std::remove(path);
+
+  const char *pgmPath = "sobel_tests_mapped.pgm";
+  for (int maxVal : {255, 15})
+  {
+    {
+      std::ofstream file(pgmPath, std::ios::binary);
+      file << "P5\n2 1\n" << maxVal << "\n";
+      file.write("\x01\x02", 2);
+    }
+    MappedImage image;
+    Result result = image.Open(pgmPath);
+    Check(maxVal == 255 ? result == Result::Ok && image.Pixels()[1] == 2 : result == Result::InvalidArgument,
+          "MappedImage PGM maxval " + std::to_string(maxVal));
+  }
+  std::remove(pgmPath);
+}
+
+/***************************************************************
+ * ListBatchInputs: a directory gives its image files by extension,
+ * in any case, sorted, and a list file its non blank lines with
+ * Windows line ends stripped. A path that can't be read fails.
+****************************************************************/
+static void CheckListBatchInputs()
+{
+  namespace fs = std::filesystem;
+  const fs::path dir = "sobel_tests_batch";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "c.png");    // a directory, not an image
+  for (const char *name : {"b.png", "a.PGM", "d.txt"}) std::ofstream(dir / name) << "x";
+
+  std::vector<std::string> paths;
+  Result result = ListBatchInputs(dir.string(), paths);
+  Check(result == Result::Ok && paths == std::vector<std::string>{(dir / "a.PGM").string(), (dir / "b.png").string()},
+        "ListBatchInputs directory");
+
+  const fs::path list = dir / "list.txt";
+  std::ofstream(list, std::ios::binary) << "x.png\r\n\r\n\ny dir/z.pgm\n";
+  result = ListBatchInputs(list.string(), paths);
+  Check(result == Result::Ok && paths == std::vector<std::string>{"x.png", "y dir/z.pgm"}, "ListBatchInputs list file");
+
+  result = ListBatchInputs((dir / "missing.txt").string(), paths);
+  Check(result == Result::FileIOFailure && paths.empty(), "ListBatchInputs missing path");
+  fs::remove_all(dir);
+}
+
+/***************************************************************
+ * BoundedQueue: items come out in order through a full queue,
+ * Close drains what is left, and releases a producer blocked on a
+ * full queue and a consumer blocked on an empty one.
+****************************************************************/
+static void CheckBoundedQueue()
+{
+  BoundedQueue<int> queue(2);
+  bool ok = queue.Push(1) && queue.Push(2);
+  queue.Close();
+  int item = 0;
+  ok = ok && !queue.Push(3) && queue.Pop(item) && item == 1 && queue.Pop(item) && item == 2 && !queue.Pop(item);
+  Check(ok, "BoundedQueue Close drains");
+
+  const int count = 1000;
+  BoundedQueue<int> pipe(2);
+  std::thread producer([&] {
+      for (int i = 0; i < count; i++) pipe.Push(i);
+      pipe.Close();
+  });
+  int expected = 0;
+  ok = true;
+  while (pipe.Pop(item)) ok = ok && item == expected++;
+  producer.join();
+  Check(ok && expected == count, "BoundedQueue order through a full queue");
+
+  BoundedQueue<int> full(0);    // capacity 1
+  full.Push(1);
+  bool pushed = true;
+  std::thread blockedProducer([&] { pushed = full.Push(2); });
+  full.Close();
+  blockedProducer.join();
+  ok = !pushed && full.Pop(item) && item == 1 && !full.Pop(item);
+  Check(ok, "BoundedQueue Close releases a full queue's producer");
+
+  BoundedQueue<int> empty(1);
+  bool popped = true;
+  std::thread blockedConsumer([&] { popped = empty.Pop(item); });
+  empty.Close();
+  blockedConsumer.join();
+  Check(!popped, "BoundedQueue Close releases an empty queue's consumer");
+}
+
+/***************************************************************
+ * MemoryPool on a host pool of its own: the size classes waste at
+ * most 25%, and a sequence of allocations and frees gives the hits,
+ * misses and high water marks worked out by hand. Blocks freed with
+ * FreeAfter count as in use until Trim takes them back.
+****************************************************************/
+static void CheckMemoryPool()
+{
+  bool ok = MemoryPool::SizeClass(1) == 256 && MemoryPool::SizeClass(256) == 256 &&
+            MemoryPool::SizeClass(257) == 320 && MemoryPool::SizeClass(512) == 512 &&
+            MemoryPool::SizeClass(513) == 640 && MemoryPool::SizeClass(1000) == 1024 &&
+            MemoryPool::SizeClass(1025) == 1280;
+  for (size_t bytes = 257; bytes < 100000; bytes += 37)
+  {
+    size_t size = MemoryPool::SizeClass(bytes);
+    ok = ok && size >= bytes && size * 4 <= bytes * 5 && MemoryPool::SizeClass(size) == size;
+  }
+  Check(ok, "MemoryPool::SizeClass");
+
+  auto statsAre = [](const PoolStats &s, size_t hits, size_t misses, size_t inUse, size_t cached,
+                     size_t highInUse, size_t highTotal) {
+    return s.hits == hits && s.misses == misses && s.bytesInUse == inUse && s.bytesCached == cached &&
+           s.highWaterInUse == highInUse && s.highWaterTotal == highTotal;
+  };
+  MemoryPool pool;
+  void *a = pool.Allocate(1000);    // 1024, miss
+  void *b = pool.Allocate(100);     // 256, miss
+  pool.Free(a);
+  void *c = pool.Allocate(900);     // 1024, the cached block
+  void *d = pool.Allocate(2000);    // 2048, miss
+  Check(c == a && statsAre(pool.Stats(), 1, 3, 3328, 0, 3328, 3328), "MemoryPool hits and misses");
+  int notPooled = 0;
+  pool.Free(nullptr);
+  pool.Free(&notPooled);
+  pool.Free(b);
+  pool.Free(c);
+  pool.Free(d);
+  Check(statsAre(pool.Stats(), 1, 3, 0, 3328, 3328, 3328), "MemoryPool frees, other pointers ignored");
+
+  void *e = pool.Allocate(300);     // 320, miss
+  pool.FreeAfter(e, sycl::event());
+  Check(statsAre(pool.Stats(), 1, 4, 320, 3328, 3328, 3648), "MemoryPool FreeAfter keeps the block in use");
+  pool.Trim();
+  Check(statsAre(pool.Stats(), 1, 4, 0, 0, 3328, 3648), "MemoryPool Trim");
+
+  void *f = pool.Allocate(1000);    // miss, the cached block was trimmed
+  pool.ResetStats();
+  Check(f != nullptr && statsAre(pool.Stats(), 0, 0, 1024, 0, 1024, 1024), "MemoryPool ResetStats");
+  pool.Free(f);
+}
+
+/***************************************************************
+ * StageProfiler::Stats: per stage count, total, min, median (the
+ * mean of the middle two for an even count) and max, with the
+ * stages in the order they were first seen.
+****************************************************************/
+static void CheckStageProfiler()
+{
+  StageProfiler profiler;
+  for (auto &t : std::vector<std::pair<const char *, double>>{{"B", 3.0}, {"A", 5.0}, {"B", 1.0}, {"B", 2.0}, {"A", 1.0}})
+    profiler.AddTime(t.first, t.second);
+  std::vector<StageStats> stats = profiler.Stats();
+  auto statsAre = [](const StageStats &s, const char *name, size_t count, double total, double min,
+                     double median, double max) {
+    return s.name == name && s.count == count && s.totalMs == total && s.minMs == min &&
+           s.medianMs == median && s.maxMs == max;
+  };
+  Check(stats.size() == 2 && statsAre(stats[0], "B", 3, 6.0, 1.0, 2.0, 3.0) &&
+        statsAre(stats[1], "A", 2, 6.0, 1.0, 3.0, 5.0) && profiler.Unprofiled() == 0,
+        "StageProfiler min, median and max");
+  profiler.Clear();
+  Check(profiler.Stats().empty(), "StageProfiler Clear");
+}
+
+// Horizontal then vertical pass with every tap through ReferenceBorderIndex.
+// For Border::Constant the rows outside the image are the horizontal pass
+// of a constant row.
+static std::vector<float> ReferenceSeparable(const std::vector<float> &in, const std::vector<float> &kernelX,
+                                             const std::vector<float> &kernelY, int width, int height,
+                                             Border border, float constant)
+{
+  const int rx = static_cast<int>(kernelX.size()) / 2;
+  const int ry = static_cast<int>(kernelY.size()) / 2;
+  std::vector<float> tmp(in.size()), out(in.size());
+  float rowConstant = 0.0f;
+  for (float c : kernelX) rowConstant += c * constant;
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      float value = 0.0f;
+      for (int i = 0; i < static_cast<int>(kernelX.size()); i++)
+      {
+        int ix = ReferenceBorderIndex(border, x + i - rx, width);
+        value += kernelX[i] * (ix < 0 ? constant : in[y * width + ix]);
+      }
+      tmp[y * width + x] = value;
+    }
+  }
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      float value = 0.0f;
+      for (int i = 0; i < static_cast<int>(kernelY.size()); i++)
+      {
+        int iy = ReferenceBorderIndex(border, y + i - ry, height);
+        value += kernelY[i] * (iy < 0 ? rowConstant : tmp[iy * width + x]);
+      }
+      out[y * width + x] = value;
+    }
+  }
+  return out;
+}
+
+static const std::vector<float> separableKernelX = {0.1f, -0.4f, 0.3f, 0.6f, -0.2f, 0.05f, 0.15f};
+static const std::vector<float> separableKernelY = {0.25f, 0.5f, -0.125f};
+
+/***************************************************************
+ * SeparableFilterCpp against the plain two pass reference, with a
+ * kernel longer than some of the images so the borders fold more
+ * than once.
+****************************************************************/
+static void CheckSeparableCpp(ThreadPool &pool)
+{
+  const float constant = 0.625f;
+  std::mt19937 rng(7);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    std::vector<float> out(in.size());
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceSeparable(in, separableKernelX, separableKernelY, width, height, border, constant);
+      SeparableFilterCpp(out.data(), in.data(), separableKernelX.data(), static_cast<int>(separableKernelX.size()),
+                         separableKernelY.data(), static_cast<int>(separableKernelY.size()),
+                         width, height, width, border, constant);
+      Check(Close(ref, out, 1e-6f), Describe("SeparableFilterCpp", width, height, border));
+      SeparableFilterCpp(pool, out.data(), in.data(), separableKernelX.data(), static_cast<int>(separableKernelX.size()),
+                         separableKernelY.data(), static_cast<int>(separableKernelY.size()),
+                         width, height, width, border, constant);
+      Check(Close(ref, out, 1e-6f), Describe("SeparableFilterCpp threaded", width, height, border));
+    }
+  }
+}
+
+/***************************************************************
+ * SeparableFilterBuffer against the same reference.
+****************************************************************/
+static void CheckSeparableDevice(queue &q)
+{
+  const float constant = 0.625f;
+  std::mt19937 rng(7);
+  for (auto &size : testSizes)
+  {
+    int width = size.first, height = size.second;
+    std::vector<float> in = RandomImage(rng, width, height);
+    for (Border border : allBorders)
+    {
+      std::vector<float> ref = ReferenceSeparable(in, separableKernelX, separableKernelY, width, height, border, constant);
+      std::vector<float> out = RunOnDevice<float>(in, in.size(), [&](buffer<float, 1> &inBuf, buffer<float, 1> &outBuf) {
+          SeparableFilterBuffer(q, inBuf, outBuf, separableKernelX, separableKernelY, width, height, border, constant);
+      });
+      Check(Close(ref, out, 1e-5f), Describe("SeparableFilterBuffer", width, height, border));
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool hostOnly = argc > 1 && std::string(argv[1]) == "--host";
+  if (argc > 2 || (argc == 2 && !hostOnly))
+  {
+    cerr << "Usage: " << argv[0] << " [--host]" << std::endl;
+    return EXIT_ERROR_CODE;
+  }
+
+  // A few threads so the small images still span several bands per thread
+  ThreadPool pool(3);
+  cout << "SIMD level: " << static_cast<int>(GetSimdLevel()) << std::endl;
+  CheckBordersCpp(pool);
+  CheckStencils(pool);
+  CheckGrayscaleCpp();
+  CheckHalfConversion();
+  CheckStoragePrecisionCpp(pool);
+  CheckSobelFixedCpp(pool);
+  CheckThreadedCpp(pool);
+  CheckGaussianCpp();
+  CheckStreamCpp(pool);
+  CheckOrientationCpp();
+  CheckPitchedCpp(pool);
+  CheckMappedImage();
+  CheckListBatchInputs();
+  CheckBoundedQueue();
+  CheckMemoryPool();
+  CheckStageProfiler();
+  CheckSeparableCpp(pool);
+
+  if (!hostOnly)
+  {
+    // The default device selector will select the most performant device.
+    auto selector = default_selector_v;
+    try {
+      queue q(selector, exception_handler);
+      cout << "Running on device: " << q.get_device().get_info<info::device::name>() << std::endl;
+      CheckBordersDevice(q);
+      CheckStencilsDevice(q);
+      CheckGrayscaleDevice(q);
+      CheckStoragePrecisionDevice(q);
+      CheckSobelFixedDevice(q);
+      CheckGaussianDevice(q);
+      CheckStreamDevice(q);
+      CheckSobelDevice(q);
+      CheckStageProfilerDevice(q);
+      CheckUsmDevice(q);
+      CheckEdgesUint8Device(q);
+      CheckCannyDevice(q);
+      CheckPartitionedDevice(q);
+      CheckOrientationDevice(q);
+      CheckPitchedDevice(q);
+      CheckSeparableDevice(q);
+    } catch (std::exception const &e) {
+      cout << "An exception is caught while checking the device: " << e.what() << std::endl;
+      return EXIT_ERROR_CODE;
+    }
+  }
+
+  cout << numChecks - numFailures << " of " << numChecks << " checks passed" << std::endl;
+  return numFailures == 0 ? 0 : EXIT_ERROR_CODE;
+}
@@ -1,19 +1,12 @@
 //==============================================================
-// Iota is the equivalent of a Hello, World! sample for data parallel programs.
-// Building and running the sample verifies that your development environment
-// is setup correctly and demonstrates the use of the core features of SYCL.
-// This sample runs on both CPU and GPU (or FPGA). When run, it computes on both
-// the CPU and offload device, then compares results. If the code executes on
-// both CPU and the offload device, the name of the offload device and a success
-// message are displayed. And, your development environment is setup correctly!
+// Sobel edge detection using Unified Shared Memory (USM).
 //
-// For comprehensive instructions regarding SYCL Programming, go to
-// https://software.intel.com/en-us/oneapi-programming-guide and search based on
-// relevant terms noted in the comments.
+// Same pipeline as Sobel-buffers.cpp (grayscale, Sobel, u8 conversion) but
+// with device USM allocations, explicit copies and explicit event
+// dependencies on an in-order queue, so there is no buffer/accessor
+// dependency tracking. Run it on the same image as Sobel-buffers to compare.
 //
-// SYCL material used in the code sample:
-// •	A one dimensional array of data.
-// •	A device queue and kernel.
+// Usage: Sobel-usm [image path]
 //==============================================================
 // Copyright © 2020 Intel Corporation
 //
@@ -22,6 +15,18 @@
 #include <sycl/sycl.hpp>
 #include <array>
 #include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingUsm.h"
+#include "image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 #if FPGA_HARDWARE || FPGA_EMULATOR || FPGA_SIMULATOR
   #include <sycl/ext/intel/fpga_extensions.hpp>
@@ -30,6 +35,8 @@
 using namespace sycl;
 using namespace std;
 
+const int EXIT_ERROR_CODE = 1;
+
 // Create an exception handler for asynchronous SYCL exceptions
 static auto exception_handler = [](sycl::exception_list e_list) {
   for (std::exception_ptr const &e : e_list) {
@@ -45,89 +52,91 @@ static auto exception_handler = [](sycl::exception_list e_list) {
   }
 };
 
-// Array size for this example.
-constexpr size_t array_size = 10000;
-
-//************************************
-// Iota in SYCL on device.
-//************************************
-void IotaParallel(queue &q, int *a, size_t size, int value) {
-  // Create the range object for the array.
-  range num_items{size};
-
-  // Use parallel_for to populate consecutive numbers starting with a specified
-  // value in parallel on device. This executes the kernel.
-  //    1st parameter is the number of work items to use.
-  //    2nd parameter is the kernel, a lambda that specifies what to do per
-  //    work item. The parameter of the lambda is the work item id.
-  // SYCL supports unnamed lambda kernel by default.
-  auto e = q.parallel_for(num_items, [=](auto i) { a[i] = value + i; });
-
-  // q.parallel_for() is an asynchronous call. SYCL runtime enqueues and runs
-  // the kernel asynchronously. Wait for the asynchronous call to complete.
-  e.wait();
-}
-
-//************************************
-// Demonstrate iota both sequential on CPU and parallel on device.
-//************************************
-int main() {
+//**************************************************************************
+// Load an image, find its edges on the device with USM, write them out.
+//**************************************************************************
+int main(int argc, char *argv[]) {
   // Create device selector for the device of your interest.
+  // The default device selector will select the most performant device.
   auto selector = default_selector_v;
+  cout << "Starting main" << std::endl;
+
+  int channels;
+  int width; 
+  int height; 
+  string path = "../images/HummingBirdAtFeeder.png";
+  if (argc > 1) path = argv[1];
+  const int LOAD_IMAGE_AS_IS = 0;
+  int numIterations = 100;
+
+  uint8_t* u8_image_in = stbi_load(path.c_str(), &width, &height, &channels, LOAD_IMAGE_AS_IS);
+  if (u8_image_in == nullptr) 
+  {
+    cout << "ERROR: could not load image " << path << std::endl;
+    exit(EXIT_ERROR_CODE);
+  }
+  cout << "Loaded image " << path << " of width = " << width << ", height = " << height << ", num channels = " << channels << std::endl;
 
-  constexpr int value = 100000;
+  const size_t numPixels = static_cast<size_t>(width) * height;
+  std::vector<uint8_t> u8_image_out(numPixels);
+  float procTimeMs = 0.0f;
 
   try {
-    queue q(selector, exception_handler);
+    // In-order: kernels run in submission order, the events below make the
+    // dependencies explicit anyway so the functions also work on other queues.
+    queue q(selector, exception_handler, property::queue::in_order());
 
-    // Print out the device information used for the kernel code.
     cout << "Running on device: "
-         << q.get_device().get_info<info::device::name>() << "\n";
-    cout << "Array size: " << array_size << "\n";
-
-    int *sequential = malloc_shared<int>(array_size, q);
-    int *parallel = malloc_shared<int>(array_size, q);
-
-    if ((sequential == nullptr) || (parallel == nullptr)) {
-      if (sequential != nullptr) free(sequential, q);
-      if (parallel != nullptr) free(parallel, q);
-
-      cout << "Shared memory allocation failure.\n";
-      return -1;
+        << q.get_device().get_info<info::device::name>() << "\n";
+
+    uint8_t *d_image_in  = malloc_device<uint8_t>(numPixels * channels, q);
+    float   *d_gray      = malloc_device<float>(numPixels, q);
+    float   *d_sobel     = malloc_device<float>(numPixels, q);
+    float   *d_max       = malloc_device<float>(1, q);
+    uint8_t *d_image_out = malloc_device<uint8_t>(numPixels, q);
+
+    if (d_image_in == nullptr || d_gray == nullptr || d_sobel == nullptr ||
+        d_max == nullptr || d_image_out == nullptr) {
+      cout << "Device memory allocation failure.\n";
+      exit(EXIT_ERROR_CODE);
     }
 
-    // Sequential iota.
-    for (size_t i = 0; i < array_size; i++) sequential[i] = value + i;
-
-    // Parallel iota in SYCL.
-    IotaParallel(q, parallel, array_size, value);
-
-    // Verify two results are equal.
-    for (size_t i = 0; i < array_size; i++) {
-      if (parallel[i] != sequential[i]) {
-        cout << "Failed on device.\n";
-        return -1;
-      }
-    }
-
-    int indices[]{0, 1, 2, (array_size - 1)};
-    constexpr size_t indices_size = sizeof(indices) / sizeof(int);
-
-    // Print out iota result.
-    for (int i = 0; i < indices_size; i++) {
-      int j = indices[i];
-      if (i == indices_size - 1) cout << "...\n";
-      cout << "[" << j << "]: " << j << " + " << value << " = "
-           << sequential[j] << "\n";
+    event copyIn = q.memcpy(d_image_in, u8_image_in, numPixels * channels);
+    event grayDone = ConvertToGrayscaleUsm(q, d_image_in, d_gray, width, height, channels, {copyIn});
+    grayDone.wait();
+
+    // The timed region includes the wait, so it measures execution and
+    // not just submission.
+    auto timeBegin = std::chrono::steady_clock::now();
+    event sobelDone;
+    for(int i = 0; i < numIterations; i++)
+    {
+      sobelDone = SobelFilterUsm(q, d_gray, d_sobel, d_max, width, height,
+                                 Border::Constant, 0.0f, {sobelDone});
     }
-
-    free(sequential, q);
-    free(parallel, q);
+    sobelDone.wait();
+    auto timeEnd = std::chrono::steady_clock::now();
+    procTimeMs = std::chrono::duration<float, std::milli>(timeEnd - timeBegin).count() / numIterations;
+
+    event u8Done = ConvertToUint8Usm(q, d_sobel, d_image_out, width, height, {sobelDone});
+    q.memcpy(u8_image_out.data(), d_image_out, numPixels, u8Done).wait();
+
+    free(d_image_in, q);
+    free(d_gray, q);
+    free(d_sobel, q);
+    free(d_max, q);
+    free(d_image_out, q);
   } catch (std::exception const &e) {
-    cout << "An exception is caught while computing on device.\n";
+    cout << "An exception is caught while computing on device: " << e.what() << std::endl;
     terminate();
   }
 
+  std::cout << "Processing Time " << procTimeMs << " msec" << std::endl;
+
+  stbi_write_png("image_sobel_usm.png", width, height, 1, u8_image_out.data(), width);
+
+  // Reclaim now unused memory
+  stbi_image_free(u8_image_in);
   cout << "Successfully completed on device.\n";
   return 0;
 }
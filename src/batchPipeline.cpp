@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "batchPipeline.h"
+#include "boundedQueue.h"
+#include "imageIO.h"
+#include "imageUtilsUsingBuffers.h"
+
+// The implementations are compiled into the programs, Sobel-buffers.cpp
+// and Sobel-tests.cpp
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+using namespace sycl;
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// One image travelling down the pipeline
+struct BatchImage
+{
+    std::string path;
+    MappedImage mapped;             // PGM and PPM are used in place
+    uint8_t *decoded = nullptr;     // from stbi_load, for everything else
+    const uint8_t *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<uint8_t> edges;     // width * height, 1 channel
+
+    ~BatchImage() { if (decoded) stbi_image_free(decoded); }
+};
+
+using BatchImagePtr = std::unique_ptr<BatchImage>;
+
+// An image on the device. Destroying the buffers waits for the kernels and
+// copies the edges back into image->edges.
+struct InFlightImage
+{
+    BatchImagePtr image;
+    std::unique_ptr<buffer<uint8_t, 1>> in;
+    std::unique_ptr<buffer<uint8_t, 1>> out;
+};
+
+double ElapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int DefaultStageThreads(int requested)
+{
+    if (requested > 0) return requested;
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(1, cores / 4);
+}
+
+bool IsImageFile(const fs::path &p)
+{
+    std::string ext = p.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" ||
+           ext == ".tga" || ext == ".pgm" || ext == ".ppm";
+}
+
+} // namespace
+
+/***************************************************************
+ *
+ ****************************************************************/
+Result ListBatchInputs(const std::string &path, std::vector<std::string> &paths)
+{
+    paths.clear();
+    std::error_code ec;
+    if (fs::is_directory(path, ec))
+    {
+        for (auto &entry : fs::directory_iterator(path, ec))
+        {
+            if (entry.is_regular_file() && IsImageFile(entry.path())) paths.push_back(entry.path().string());
+        }
+        if (ec) return Result::FileIOFailure;
+        std::sort(paths.begin(), paths.end());
+        return Result::Ok;
+    }
+
+    std::ifstream list(path);
+    if (!list) return Result::FileIOFailure;
+    std::string line;
+    while (std::getline(list, line))
+    {
+        // Tolerate Windows line ends and blank lines
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) paths.push_back(line);
+    }
+    return Result::Ok;
+}
+
+/***************************************************************
+ *
+ ****************************************************************/
+Result SobelBatchBuffer(sycl::queue &q, const std::vector<std::string> &paths,
+                        const BatchOptions &options, BatchStats &stats)
+{
+    stats = BatchStats();
+    auto wallBegin = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    fs::create_directories(options.outDir, ec);
+
+    BoundedQueue<BatchImagePtr> decoded(options.queueDepth);
+    BoundedQueue<BatchImagePtr> computed(options.queueDepth);
+    std::mutex statsMutex;
+    std::atomic<int> failed{0};
+
+    // Decode stage: each thread takes the next path until none are left.
+    // The last thread to finish closes the queue to the compute stage.
+    int numDecoders = DefaultStageThreads(options.decodeThreads);
+    std::atomic<size_t> nextPath{0};
+    std::atomic<int> decodersLeft{numDecoders};
+    auto decodeLoop = [&]() {
+        double busyMs = 0.0;
+        for (size_t i = nextPath++; i < paths.size(); i = nextPath++)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            BatchImagePtr image(new BatchImage);
+            image->path = paths[i];
+            if (IsMappedImagePath(paths[i]))
+            {
+                if (image->mapped.Open(paths[i]) == Result::Ok &&
+                    image->mapped.Format() != ImageFileFormat::RawFloat)
+                {
+                    image->pixels = image->mapped.Pixels();
+                    image->width = image->mapped.Width();
+                    image->height = image->mapped.Height();
+                    image->channels = image->mapped.Channels();
+                }
+            }
+            else
+            {
+                image->decoded = stbi_load(paths[i].c_str(), &image->width, &image->height, &image->channels, 0);
+                image->pixels = image->decoded;
+            }
+            busyMs += ElapsedMs(begin);
+            if (image->pixels == nullptr)
+            {
+                cout << "ERROR: could not load image " << paths[i] << std::endl;
+                failed++;
+                continue;
+            }
+            if (!decoded.Push(std::move(image))) break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats.decodeMs += busyMs;
+        }
+        if (--decodersLeft == 0) decoded.Close();
+    };
+
+    // Encode stage
+    int numEncoders = DefaultStageThreads(options.encodeThreads);
+    std::atomic<int> written{0};
+    auto encodeLoop = [&]() {
+        double busyMs = 0.0;
+        BatchImagePtr image;
+        while (computed.Pop(image))
+        {
+            auto begin = std::chrono::steady_clock::now();
+            std::string stem = fs::path(image->path).stem().string();
+            fs::path outPath = fs::path(options.outDir) / (stem + (options.pgmOutput ? "_sobel.pgm" : "_sobel.png"));
+            bool ok = options.pgmOutput
+                ? WriteMappedImage(outPath.string(), ImageFileFormat::Pgm, image->edges.data(),
+                                   image->width, image->height) == Result::Ok
+                : stbi_write_png(outPath.string().c_str(), image->width, image->height, 1,
+                                 image->edges.data(), image->width) != 0;
+            busyMs += ElapsedMs(begin);
+            if (ok) written++;
+            else
+            {
+                cout << "ERROR: could not write image " << outPath.string() << std::endl;
+                failed++;
+            }
+            image.reset();
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.encodeMs += busyMs;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numDecoders; i++) threads.emplace_back(decodeLoop);
+    for (int i = 0; i < numEncoders; i++) threads.emplace_back(encodeLoop);
+
+    // Compute stage, on the calling thread. Up to imagesInFlight images are
+    // submitted before the oldest is waited on, so the device always has the
+    // next image queued while the host copies the previous one back.
+    size_t maxInFlight = static_cast<size_t>(std::max(1, options.imagesInFlight));
+    std::deque<InFlightImage> inFlight;
+    auto retireOldest = [&]() {
+        InFlightImage done = std::move(inFlight.front());
+        inFlight.pop_front();
+        done.out.reset();   // waits for the kernels, edges are now on the host
+        done.in.reset();
+        computed.Push(std::move(done.image));
+    };
+
+    double computeMs = 0.0;
+    BatchImagePtr image;
+    while (decoded.Pop(image))
+    {
+        auto begin = std::chrono::steady_clock::now();
+        int width = image->width;
+        int height = image->height;
+        size_t numPixels = static_cast<size_t>(width) * height;
+        image->edges.resize(numPixels);
+
+        InFlightImage job;
+        job.in.reset(new buffer<uint8_t, 1>(image->pixels, range<1>(numPixels * image->channels)));
+        job.in->set_write_back(false);  // the input is never modified
+        job.out.reset(new buffer<uint8_t, 1>(image->edges.data(), range<1>(numPixels)));
+        SobelEdgesUint8Buffer(q, *job.in, *job.out, width, height, image->channels,
+                              options.normalize, options.border);
+        job.image = std::move(image);
+        inFlight.push_back(std::move(job));
+
+        if (inFlight.size() >= maxInFlight) retireOldest();
+        computeMs += ElapsedMs(begin);
+    }
+    auto drainBegin = std::chrono::steady_clock::now();
+    while (!inFlight.empty()) retireOldest();
+    computeMs += ElapsedMs(drainBegin);
+    computed.Close();
+
+    for (auto &t : threads) t.join();
+
+    stats.computeMs = computeMs;
+    stats.imagesDone = written;
+    stats.imagesFailed = failed;
+    stats.wallMs = ElapsedMs(wallBegin);
+    return stats.imagesFailed == 0 ? Result::Ok : Result::FileIOFailure;
+}
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "imageIO.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// True if the sizes are positive and width * height * channels is at most
+// maxElements and fits in an int. Divides instead of multiplying, the sizes
+// of an opened file come from its header and the product can overflow.
+bool SizeFits(int width, int height, int channels, size_t maxElements)
+{
+    if (width <= 0 || height <= 0 || channels <= 0 || channels > RAW_FLOAT_MAX_CHANNELS) return false;
+    maxElements = std::min(maxElements, static_cast<size_t>(std::numeric_limits<int>::max()));
+    return static_cast<size_t>(width) <= maxElements / height / channels;
+}
+
+// Parse a decimal field of a PNM header at pos, skipping whitespace and
+// # comments before it
+bool ParsePnmField(const uint8_t *pData, size_t size, size_t &pos, int &value)
+{
+    while (pos < size && (std::isspace(pData[pos]) || pData[pos] == '#'))
+    {
+        if (pData[pos] == '#') { while (pos < size && pData[pos] != '\n') pos++; }
+        else pos++;
+    }
+    if (pos >= size || !std::isdigit(pData[pos])) return false;
+    long long v = 0;
+    while (pos < size && std::isdigit(pData[pos]) && v <= 0x7FFFFFFF) v = v * 10 + (pData[pos++] - '0');
+    if (v > 0x7FFFFFFF) return false;
+    value = static_cast<int>(v);
+    return true;
+}
+
+size_t ElementSize(ImageFileFormat format)
+{
+    return format == ImageFileFormat::RawFloat ? sizeof(float) : 1;
+}
+
+} // namespace
+
+/***************************************************************
+ *
+ ****************************************************************/
+#ifdef _WIN32
+
+Result MappedFile::OpenRead(const std::string &path)
+{
+    Close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return Result::FileIOFailure;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return Result::FileIOFailure;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (data == nullptr)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return Result::FileIOFailure;
+    }
+    file_ = file;
+    mapping_ = mapping;
+    data_ = data;
+    size_ = static_cast<size_t>(size.QuadPart);
+    writable_ = false;
+    return Result::Ok;
+}
+
+Result MappedFile::Create(const std::string &path, size_t size)
+{
+    Close();
+    if (size == 0) return Result::InvalidArgument;
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return Result::FileIOFailure;
+    // Mapping more than the file holds grows the file to that size
+    uint64_t size64 = size;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+                                        static_cast<DWORD>(size64 & 0xFFFFFFFFu), nullptr);
+    void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+    if (data == nullptr)
+    {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return Result::FileIOFailure;
+    }
+    file_ = file;
+    mapping_ = mapping;
+    data_ = data;
+    size_ = size;
+    writable_ = true;
+    return Result::Ok;
+}
+
+void MappedFile::Close()
+{
+    if (data_)
+    {
+        if (writable_) FlushViewOfFile(data_, 0);
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) CloseHandle(static_cast<HANDLE>(mapping_));
+    if (file_) CloseHandle(static_cast<HANDLE>(file_));
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    size_ = 0;
+    writable_ = false;
+}
+
+#else
+
+Result MappedFile::OpenRead(const std::string &path)
+{
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return Result::FileIOFailure;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return Result::FileIOFailure;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return Result::FileIOFailure;
+    }
+    // The image is usually read front to back, once
+    madvise(data, size, MADV_SEQUENTIAL);
+    fd_ = fd;
+    data_ = data;
+    size_ = size;
+    writable_ = false;
+    return Result::Ok;
+}
+
+Result MappedFile::Create(const std::string &path, size_t size)
+{
+    Close();
+    if (size == 0) return Result::InvalidArgument;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return Result::FileIOFailure;
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        close(fd);
+        return Result::FileIOFailure;
+    }
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return Result::FileIOFailure;
+    }
+    fd_ = fd;
+    data_ = data;
+    size_ = size;
+    writable_ = true;
+    return Result::Ok;
+}
+
+void MappedFile::Close()
+{
+    // munmap writes the dirty pages back, no msync needed: the file
+    // is only read after the mapping is gone
+    if (data_) munmap(data_, size_);
+    if (fd_ >= 0) close(fd_);
+    data_ = nullptr;
+    fd_ = -1;
+    size_ = 0;
+    writable_ = false;
+}
+
+#endif
+
+/***************************************************************
+ *
+ ****************************************************************/
+Result MappedImage::Open(const std::string &path)
+{
+    Close();
+    Result result = file_.OpenRead(path);
+    if (result != Result::Ok) return result;
+
+    const uint8_t *pData = file_.Data();
+    const size_t size = file_.Size();
+    size_t offset = 0;
+    if (size >= sizeof(RawFloatHeader) && std::memcmp(pData, "RAWF", 4) == 0)
+    {
+        RawFloatHeader header;
+        std::memcpy(&header, pData, sizeof(header));
+        // A larger header keeps the 32 byte alignment of the floats
+        if (header.headerSize < sizeof(header) || header.headerSize % sizeof(header) != 0) return Result::InvalidArgument;
+        format_ = ImageFileFormat::RawFloat;
+        width_ = header.width;
+        height_ = header.height;
+        channels_ = header.channels;
+        offset = header.headerSize;
+    }
+    else if (size >= 2 && pData[0] == 'P' && (pData[1] == '5' || pData[1] == '6'))
+    {
+        format_ = pData[1] == '5' ? ImageFileFormat::Pgm : ImageFileFormat::Ppm;
+        channels_ = pData[1] == '5' ? 1 : 3;
+        size_t pos = 2;
+        int maxVal = 0;
+        if (!ParsePnmField(pData, size, pos, width_) || !ParsePnmField(pData, size, pos, height_) ||
+            !ParsePnmField(pData, size, pos, maxVal) || maxVal != 255)   // used in place, can't be rescaled
+        {
+            return Result::InvalidArgument;
+        }
+        offset = pos + 1;   // the single whitespace before the pixels
+    }
+    else
+    {
+        return Result::InvalidArgument;
+    }
+
+    if (!SizeFits(width_, height_, channels_, offset <= size ? (size - offset) / ElementSize(format_) : 0))
+    {
+        return Result::InvalidArgument;
+    }
+    pixels_ = const_cast<uint8_t *>(pData) + offset;
+    return Result::Ok;
+}
+
+Result MappedImage::Create(const std::string &path, ImageFileFormat format, int width, int height, int channels)
+{
+    Close();
+    if (format == ImageFileFormat::Pgm) channels = 1;
+    if (format == ImageFileFormat::Ppm) channels = 3;
+    if (!SizeFits(width, height, channels, std::numeric_limits<size_t>::max())) return Result::InvalidArgument;
+    format_ = format;
+    width_ = width;
+    height_ = height;
+    channels_ = channels;
+
+    char pnmHeader[64];
+    size_t offset;
+    if (format == ImageFileFormat::RawFloat)
+    {
+        offset = sizeof(RawFloatHeader);
+    }
+    else
+    {
+        offset = std::snprintf(pnmHeader, sizeof(pnmHeader), "P%c\n%d %d\n255\n",
+                               format == ImageFileFormat::Pgm ? '5' : '6', width, height);
+    }
+
+    Result result = file_.Create(path, offset + NumElements() * ElementSize(format));
+    if (result != Result::Ok) return result;
+
+    if (format == ImageFileFormat::RawFloat)
+    {
+        RawFloatHeader header;
+        header.width = width;
+        header.height = height;
+        header.channels = channels;
+        std::memcpy(file_.Data(), &header, sizeof(header));
+    }
+    else
+    {
+        std::memcpy(file_.Data(), pnmHeader, offset);
+    }
+    pixels_ = file_.Data() + offset;
+    return Result::Ok;
+}
+
+bool IsMappedImagePath(const std::string &path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == ".pgm" || ext == ".ppm" || ext == ".rawf";
+}
+
+Result WriteMappedImage(const std::string &path, ImageFileFormat format, const void *pData,
+                        int width, int height, int channels)
+{
+    MappedImage image;
+    Result result = image.Create(path, format, width, height, channels);
+    if (result != Result::Ok) return result;
+    std::memcpy(image.WritablePixels(), pData, image.NumElements() * ElementSize(format));
+    return Result::Ok;
+}
@@ -1,16 +1,41 @@
 #include "imageUtilsAgnostic.h"
 
+// Keep the multiplies and adds of luminance() separate, like the SIMD
+// grayscale converter, so both give the same gray values
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#pragma clang fp reassociate(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
 /*************************************************
  Convert rbb to gray scale
 */
 float luminance(uint8_t r, uint8_t g, uint8_t b)
 {
-    float r_lin = static_cast<float>(r) / 255.0f;
-    float g_lin = static_cast<float>(g) / 255.0f;
-    float b_lin = static_cast<float>(b) / 255.0f;
-
-    // Perceptual luminance (CIE 1931)
-    return 0.2126f * r_lin + 0.7152f * g_lin + 0.0722f * b_lin;
+    // Perceptual luminance (CIE 1931), the weights include the 1/255
+    return LUMA_SCALED_R * static_cast<float>(r) + LUMA_SCALED_G * static_cast<float>(g) +
+           LUMA_SCALED_B * static_cast<float>(b);
     //return r_lin;
     //return 0.5;
-}
\ No newline at end of file
+}
+/*************************************************
+ Gaussian kernel, shared by the C++ and SYCL paths
+*/
+std::vector<float> GaussianKernel(float sigma)
+{
+    int radius = static_cast<int>(std::ceil(3.0f * sigma));
+    if (radius < 1) radius = 1;
+
+    std::vector<float> kernel(2 * radius + 1);
+    double sum = 0.0;
+    for (int i = -radius; i <= radius; i++)
+    {
+        double w = std::exp(-0.5 * (double(i) * i) / (double(sigma) * sigma));
+        kernel[i + radius] = static_cast<float>(w);
+        sum += w;
+    }
+    for (float &w : kernel) w = static_cast<float>(w / sum);
+    return kernel;
+}
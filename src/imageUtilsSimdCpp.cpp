@@ -0,0 +1,464 @@
+#include "imageUtilsSimdCpp.h"
+#include "imageUtilsAgnostic.h"
+#include <utility>
+
+#if IMAGE_UTILS_X86_SIMD
+#include <immintrin.h>
+
+// Keep multiplies and adds separate so the results match the scalar code
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#pragma clang fp reassociate(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#define TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#define TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#endif
+
+/***************************************************************
+ * 
+ ****************************************************************/
+static SimdLevel DetectSimdLevel()
+{
+#if IMAGE_UTILS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+static SimdLevel g_simdLevel = DetectSimdLevel();
+
+// The 16 bit integer kernels need AVX-512BW on top of the AVX-512 level
+static bool DetectAvx512bw()
+{
+#if IMAGE_UTILS_X86_SIMD
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512bw");
+#else
+    return false;
+#endif
+}
+
+static const bool g_hasAvx512bw = DetectAvx512bw();
+
+// Half precision conversions need F16C, which every AVX2 CPU has in practice
+static bool DetectF16c()
+{
+#if IMAGE_UTILS_X86_SIMD
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c");
+#else
+    return false;
+#endif
+}
+
+static const bool g_hasF16c = DetectF16c();
+
+SimdLevel GetSimdLevel()
+{
+    return g_simdLevel;
+}
+
+SimdLevel SetSimdLevel(SimdLevel level)
+{
+    SimdLevel supported = DetectSimdLevel();
+    g_simdLevel = static_cast<int>(level) < static_cast<int>(supported) ? level : supported;
+    return g_simdLevel;
+}
+
+#if IMAGE_UTILS_X86_SIMD
+/***************************************************************
+ * 8 pixels per iteration
+ ****************************************************************/
+TARGET_AVX2
+static int Convolution3x3RowAvx2(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, const float* pFilter, int x0, int x1)
+{
+    const float* rows[3] = {pUp, pMid, pDown};
+    __m256 c[9];
+    for (int i = 0; i < 9; i++) c[i] = _mm256_set1_ps(pFilter[i]);
+
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        __m256 value = _mm256_setzero_ps();
+        int cIdx = 0;
+        for (int l = 0; l < 3; l++)  // filter row
+        {
+            for (int k = -1; k <= 1; k++)  // filter col
+            {
+                __m256 v = _mm256_loadu_ps(rows[l] + x + k);
+                value = _mm256_add_ps(value, _mm256_mul_ps(v, c[cIdx++]));
+            }
+        }
+        _mm256_storeu_ps(pOut + x, value);
+    }
+    return x;
+}
+
+/***************************************************************
+ * 16 pixels per iteration
+ ****************************************************************/
+TARGET_AVX512
+static int Convolution3x3RowAvx512(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, const float* pFilter, int x0, int x1)
+{
+    const float* rows[3] = {pUp, pMid, pDown};
+    __m512 c[9];
+    for (int i = 0; i < 9; i++) c[i] = _mm512_set1_ps(pFilter[i]);
+
+    int x = x0;
+    for (; x + 16 <= x1; x += 16)
+    {
+        __m512 value = _mm512_setzero_ps();
+        int cIdx = 0;
+        for (int l = 0; l < 3; l++)  // filter row
+        {
+            for (int k = -1; k <= 1; k++)  // filter col
+            {
+                __m512 v = _mm512_loadu_ps(rows[l] + x + k);
+                value = _mm512_add_ps(value, _mm512_mul_ps(v, c[cIdx++]));
+            }
+        }
+        _mm512_storeu_ps(pOut + x, value);
+    }
+    return x;
+}
+#endif
+
+/***************************************************************
+ * 
+ ****************************************************************/
+int Convolution3x3RowSimd(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, const float* pFilter, int x0, int x1)
+{
+#if IMAGE_UTILS_X86_SIMD
+    switch (g_simdLevel)
+    {
+    case SimdLevel::Avx512:
+        x0 = Convolution3x3RowAvx512(pOut, pUp, pMid, pDown, pFilter, x0, x1);
+        // The AVX2 version picks up a remaining 8 pixels, if any
+        return Convolution3x3RowAvx2(pOut, pUp, pMid, pDown, pFilter, x0, x1);
+    case SimdLevel::Avx2:
+        return Convolution3x3RowAvx2(pOut, pUp, pMid, pDown, pFilter, x0, x1);
+    default:
+        break;
+    }
+#endif
+    return x0;
+}
+
+#if IMAGE_UTILS_X86_SIMD
+/***************************************************************
+ * Stencil versions of the above. The taps are unrolled over the
+ * stencil's coefficients at compile time, so only the non zero ones
+ * are loaded and only those other than +-1 multiply.
+ ****************************************************************/
+template <int C>
+TARGET_AVX2
+static inline __m256 StencilTapAvx2(__m256 value, const float* p)
+{
+    if constexpr (C == 0) return value;
+    else if constexpr (C == 1) return _mm256_add_ps(value, _mm256_loadu_ps(p));
+    else if constexpr (C == -1) return _mm256_sub_ps(value, _mm256_loadu_ps(p));
+    else return _mm256_add_ps(value, _mm256_mul_ps(_mm256_loadu_ps(p), _mm256_set1_ps(static_cast<float>(C))));
+}
+
+template <typename S, int... I>
+TARGET_AVX2
+static int StencilRowAvx2(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, int x0, int x1, std::integer_sequence<int, I...>)
+{
+    const float* rows[3] = {pUp, pMid, pDown};
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        __m256 value = _mm256_setzero_ps();
+        ((value = StencilTapAvx2<S::coefficients[I]>(value, rows[I / 3] + x + I % 3 - 1)), ...);
+        _mm256_storeu_ps(pOut + x, value);
+    }
+    return x;
+}
+
+template <int C>
+TARGET_AVX512
+static inline __m512 StencilTapAvx512(__m512 value, const float* p)
+{
+    if constexpr (C == 0) return value;
+    else if constexpr (C == 1) return _mm512_add_ps(value, _mm512_loadu_ps(p));
+    else if constexpr (C == -1) return _mm512_sub_ps(value, _mm512_loadu_ps(p));
+    else return _mm512_add_ps(value, _mm512_mul_ps(_mm512_loadu_ps(p), _mm512_set1_ps(static_cast<float>(C))));
+}
+
+template <typename S, int... I>
+TARGET_AVX512
+static int StencilRowAvx512(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, int x0, int x1, std::integer_sequence<int, I...>)
+{
+    const float* rows[3] = {pUp, pMid, pDown};
+    int x = x0;
+    for (; x + 16 <= x1; x += 16)
+    {
+        __m512 value = _mm512_setzero_ps();
+        ((value = StencilTapAvx512<S::coefficients[I]>(value, rows[I / 3] + x + I % 3 - 1)), ...);
+        _mm512_storeu_ps(pOut + x, value);
+    }
+    return x;
+}
+#endif
+
+template <typename S>
+int StencilRowSimd(float* pOut, const float* pUp, const float* pMid,
+                      const float* pDown, int x0, int x1)
+{
+#if IMAGE_UTILS_X86_SIMD
+    const auto taps = std::make_integer_sequence<int, 9>();
+    switch (g_simdLevel)
+    {
+    case SimdLevel::Avx512:
+        x0 = StencilRowAvx512<S>(pOut, pUp, pMid, pDown, x0, x1, taps);
+        return StencilRowAvx2<S>(pOut, pUp, pMid, pDown, x0, x1, taps);
+    case SimdLevel::Avx2:
+        return StencilRowAvx2<S>(pOut, pUp, pMid, pDown, x0, x1, taps);
+    default:
+        break;
+    }
+#endif
+    return x0;
+}
+
+template int StencilRowSimd<SobelXStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<SobelYStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<ScharrXStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<ScharrYStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<PrewittXStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<PrewittYStencil>(float*, const float*, const float*, const float*, int, int);
+template int StencilRowSimd<LaplacianStencil>(float*, const float*, const float*, const float*, int, int);
+
+#if IMAGE_UTILS_X86_SIMD
+/***************************************************************
+ * 16 u8 pixels per iteration, widened to int16
+ ****************************************************************/
+TARGET_AVX2
+static inline __m256i LoadU8AsI16Avx2(const uint8_t* p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+TARGET_AVX2
+static int SobelFixedRowAvx2(uint8_t* pOut, const uint8_t* pUp, const uint8_t* pMid,
+                      const uint8_t* pDown, int x0, int x1, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = x0;
+    for (; x + 16 <= x1; x += 16)
+    {
+        __m256i tl = LoadU8AsI16Avx2(pUp + x - 1);
+        __m256i t  = LoadU8AsI16Avx2(pUp + x);
+        __m256i tr = LoadU8AsI16Avx2(pUp + x + 1);
+        __m256i l  = LoadU8AsI16Avx2(pMid + x - 1);
+        __m256i r  = LoadU8AsI16Avx2(pMid + x + 1);
+        __m256i bl = LoadU8AsI16Avx2(pDown + x - 1);
+        __m256i b  = LoadU8AsI16Avx2(pDown + x);
+        __m256i br = LoadU8AsI16Avx2(pDown + x + 1);
+
+        // |dx|, |dy| <= 1020 so nothing overflows int16
+        __m256i dx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(tl, tr),
+                                                       _mm256_slli_epi16(_mm256_sub_epi16(l, r), 1)),
+                                      _mm256_sub_epi16(bl, br));
+        __m256i dy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(tl, tr), _mm256_slli_epi16(t, 1)),
+                                      _mm256_add_epi16(_mm256_add_epi16(bl, br), _mm256_slli_epi16(b, 1)));
+        __m256i mag = _mm256_add_epi16(_mm256_abs_epi16(dx), _mm256_abs_epi16(dy));
+        mag = _mm256_srl_epi16(mag, count);
+
+        // Saturating pack works within 128 bit lanes, gather the two halves
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(mag, mag), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + x), _mm256_castsi256_si128(packed));
+    }
+    return x;
+}
+
+/***************************************************************
+ * 32 u8 pixels per iteration
+ ****************************************************************/
+TARGET_AVX512BW
+static inline __m512i LoadU8AsI16Avx512(const uint8_t* p)
+{
+    return _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+TARGET_AVX512BW
+static int SobelFixedRowAvx512(uint8_t* pOut, const uint8_t* pUp, const uint8_t* pMid,
+                      const uint8_t* pDown, int x0, int x1, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int x = x0;
+    for (; x + 32 <= x1; x += 32)
+    {
+        __m512i tl = LoadU8AsI16Avx512(pUp + x - 1);
+        __m512i t  = LoadU8AsI16Avx512(pUp + x);
+        __m512i tr = LoadU8AsI16Avx512(pUp + x + 1);
+        __m512i l  = LoadU8AsI16Avx512(pMid + x - 1);
+        __m512i r  = LoadU8AsI16Avx512(pMid + x + 1);
+        __m512i bl = LoadU8AsI16Avx512(pDown + x - 1);
+        __m512i b  = LoadU8AsI16Avx512(pDown + x);
+        __m512i br = LoadU8AsI16Avx512(pDown + x + 1);
+
+        __m512i dx = _mm512_add_epi16(_mm512_add_epi16(_mm512_sub_epi16(tl, tr),
+                                                       _mm512_slli_epi16(_mm512_sub_epi16(l, r), 1)),
+                                      _mm512_sub_epi16(bl, br));
+        __m512i dy = _mm512_sub_epi16(_mm512_add_epi16(_mm512_add_epi16(tl, tr), _mm512_slli_epi16(t, 1)),
+                                      _mm512_add_epi16(_mm512_add_epi16(bl, br), _mm512_slli_epi16(b, 1)));
+        __m512i mag = _mm512_add_epi16(_mm512_abs_epi16(dx), _mm512_abs_epi16(dy));
+        mag = _mm512_srl_epi16(mag, count);
+
+        // Unsigned saturation to u8, the magnitudes are never negative
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOut + x), _mm512_cvtusepi16_epi8(mag));
+    }
+    return x;
+}
+#endif
+
+/***************************************************************
+ * 
+ ****************************************************************/
+int SobelFixedRowSimd(uint8_t* pOut, const uint8_t* pUp, const uint8_t* pMid,
+                      const uint8_t* pDown, int x0, int x1, int shift)
+{
+#if IMAGE_UTILS_X86_SIMD
+    switch (g_simdLevel)
+    {
+    case SimdLevel::Avx512:
+        if (g_hasAvx512bw) x0 = SobelFixedRowAvx512(pOut, pUp, pMid, pDown, x0, x1, shift);
+        return SobelFixedRowAvx2(pOut, pUp, pMid, pDown, x0, x1, shift);
+    case SimdLevel::Avx2:
+        return SobelFixedRowAvx2(pOut, pUp, pMid, pDown, x0, x1, shift);
+    default:
+        break;
+    }
+#endif
+    return x0;
+}
+
+#if IMAGE_UTILS_X86_SIMD
+/***************************************************************
+ * luminance() of 8 pixels with R, G and B in the low three bytes
+ * of each 32 bit lane
+ ****************************************************************/
+TARGET_AVX2
+static inline __m256 LuminanceAvx2(__m256i rgbx)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(rgbx, mask));
+    __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(rgbx, 8), mask));
+    __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(rgbx, 16), mask));
+    __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(LUMA_SCALED_R), r),
+                                 _mm256_mul_ps(_mm256_set1_ps(LUMA_SCALED_G), g));
+    return _mm256_add_ps(value, _mm256_mul_ps(_mm256_set1_ps(LUMA_SCALED_B), b));
+}
+
+// 8 RGB pixels from p, 4 per 128 bit lane, spread to one per 32 bit lane
+TARGET_AVX2
+static inline __m256i LoadRgbAvx2(const uint8_t* p)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    return _mm256_shuffle_epi8(v, spread);
+}
+
+/***************************************************************
+ * 16 pixels per iteration. An RGB load reads 4 bytes past its 8
+ * pixels, so the RGB loop stops while that is still in the row.
+ ****************************************************************/
+TARGET_AVX2
+static int ConvertToGrayscaleRowAvx2(float* pOut, const uint8_t* pIn, int numChannels, int n)
+{
+    int x = 0;
+    if (numChannels == 4)
+    {
+        for (; x + 16 <= n; x += 16)
+        {
+            const uint8_t* p = pIn + static_cast<size_t>(x) * 4;
+            __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+            _mm256_storeu_ps(pOut + x, LuminanceAvx2(v0));
+            _mm256_storeu_ps(pOut + x + 8, LuminanceAvx2(v1));
+        }
+    }
+    else if (numChannels == 3)
+    {
+        for (; x + 16 <= n - 2; x += 16)
+        {
+            const uint8_t* p = pIn + static_cast<size_t>(x) * 3;
+            _mm256_storeu_ps(pOut + x, LuminanceAvx2(LoadRgbAvx2(p)));
+            _mm256_storeu_ps(pOut + x + 8, LuminanceAvx2(LoadRgbAvx2(p + 24)));
+        }
+    }
+    return x;
+}
+#endif
+
+int ConvertToGrayscaleRowSimd(float* pOut, const uint8_t* pIn, int numChannels, int n)
+{
+#if IMAGE_UTILS_X86_SIMD
+    if (g_simdLevel != SimdLevel::Scalar) return ConvertToGrayscaleRowAvx2(pOut, pIn, numChannels, n);
+#endif
+    return 0;
+}
+
+#if IMAGE_UTILS_X86_SIMD
+/***************************************************************
+ * 8 values per iteration
+ ****************************************************************/
+TARGET_AVX2_F16C
+static int FloatToHalfRowF16c(uint16_t* pDst, const float* pSrc, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(pSrc + x), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + x), h);
+    }
+    return x;
+}
+
+TARGET_AVX2_F16C
+static int HalfToFloatRowF16c(float* pDst, const uint16_t* pSrc, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + x));
+        _mm256_storeu_ps(pDst + x, _mm256_cvtph_ps(h));
+    }
+    return x;
+}
+#endif
+
+/***************************************************************
+ * 
+ ****************************************************************/
+int FloatToHalfRowSimd(uint16_t* pDst, const float* pSrc, int n)
+{
+#if IMAGE_UTILS_X86_SIMD
+    if (g_simdLevel != SimdLevel::Scalar && g_hasF16c) return FloatToHalfRowF16c(pDst, pSrc, n);
+#endif
+    return 0;
+}
+
+int HalfToFloatRowSimd(float* pDst, const uint16_t* pSrc, int n)
+{
+#if IMAGE_UTILS_X86_SIMD
+    if (g_simdLevel != SimdLevel::Scalar && g_hasF16c) return HalfToFloatRowF16c(pDst, pSrc, n);
+#endif
+    return 0;
+}
@@ -1,42 +1,88 @@
 #include <cstdio>
+#include <stdexcept>
 #include "imageUtilsAgnostic.h"
 #include "imageUtilsUsingBuffers.h"
+#include "memoryPool.h"
+#include "stageProfiler.h"
+#include "workGroupTuner.h"
 
 using namespace sycl;
 using namespace std;
 
 
-int FindMaxValBuffer(sycl::queue &q,
-                      sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
-                      int width, int height, int numChannels)
+/***************************************************************
+ * Max value of a float buffer, or the max of the absolute values
+ * when absMax is set. Like FindMaxCpp the max starts at 0.
+ * The result is written to max_out_buffer[0] and stays on the
+ * device, so ScaleImgBuffer can read it without a host round trip.
+****************************************************************/
+void FindMaxValBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &max_out_buffer,
+                      int width, int height, bool absMax)
 {
-  int maxGray = 0;
-
-  sycl::buffer<float, 1> sum_buf{1};
   try
   {  
+      ProfileStage("FindMaxInit", q.submit([&max_out_buffer](sycl::handler& h) {
+        sycl::accessor maxVal(max_out_buffer, h, sycl::write_only, sycl::no_init);
+        h.fill(maxVal, 0.0f);
+      }));
 
-      q.submit([&u8_image_in_buffer, width, height, numChannels, &sum_buf](
+      // The reduction combines with the 0 written above
+      ProfileStage("FindMax", q.submit([&fl_in_buffer, &max_out_buffer, width, height, absMax](
                 sycl::handler& h) {
-        auto image_accessor = u8_image_in_buffer.get_access<sycl::access::mode::read>(h);
-      
-        sycl::accessor sum_accessor(sum_buf, h, sycl::write_only, sycl::no_init); // todo how to init to zero
-      
-        h.parallel_for(sycl::range<1>(width * height),
-                    [image_accessor, sum_accessor, numChannels](sycl::id<1> idx) {
-                        int offset   = numChannels * idx[0];
-                        int gray = luminance(image_accessor[offset], image_accessor[offset + 1],
-                                                 image_accessor[offset + 2]);
-                        // ejp todo: finish
+        auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+        auto maxReduction = sycl::reduction(max_out_buffer, h, sycl::maximum<float>());
+
+        h.parallel_for(sycl::range<1>(width * height), maxReduction,
+                    [data, absMax](sycl::id<1> idx, auto &maxVal) {
+                        float v = data[idx[0]];
+                        maxVal.combine(absMax ? sycl::fabs(v) : v);
                     });
-      });
+      }));
   } catch (std::exception const &e) {
-    cout << "convertToGrayscale exception: " << e.what() << std::endl;
+    cout << "FindMaxValBuffer exception: " << e.what() << std::endl;
     terminate();
   }  
-  return maxGray;
 }                      
 
+/***************************************************************
+ * Scale the image in place by 1 / max_buffer[0], with max_buffer
+ * typically written by FindMaxValBuffer. If the max is not positive
+ * the image is set to 0.
+****************************************************************/
+static void ScaleImgKernel(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_image_buffer,
+                      sycl::buffer<float, 1> &max_buffer,
+                      int width, int height)
+{
+  ProfileStage("ScaleImg", q.submit([&fl_image_buffer, &max_buffer, width, height](sycl::handler& h) {
+    auto image = fl_image_buffer.get_access<sycl::access::mode::read_write>(h);
+    auto maxVal = max_buffer.get_access<sycl::access::mode::read>(h);
+
+    h.parallel_for(sycl::range<1>(width * height),
+                [image, maxVal](sycl::id<1> idx) {
+                    float m = maxVal[0];
+                    float scale = m > 0.0f ? 1.0f / m : 0.0f;
+                    image[idx[0]] *= scale;
+                });
+  }));
+}
+
+void ScaleImgBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_image_buffer, // input and output
+                      sycl::buffer<float, 1> &max_buffer,
+                      int width, int height)
+{
+  try
+  {  
+      ScaleImgKernel(q, fl_image_buffer, max_buffer, width, height);
+  } catch (std::exception const &e) {
+    cout << "ScaleImgBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }  
+}
+
 /***************************************************************
  * 
 ****************************************************************/
@@ -47,7 +93,7 @@ void ConvertToGrayscaleBuffer(queue &q,
 {
   try
   {  
-      q.submit([&fl_grayscale_buffer, &u8_image_in_buffer, width, height, numChannels](
+      ProfileStage("ConvertToGrayscale", q.submit([&fl_grayscale_buffer, &u8_image_in_buffer, width, height, numChannels](
                 sycl::handler& h) {
       auto image = u8_image_in_buffer.get_access<sycl::access::mode::read>(h);
       // A discard_write is a write access that doesn't need to preserve existing
@@ -60,7 +106,7 @@ void ConvertToGrayscaleBuffer(queue &q,
                         gray[idx[0]] = luminance(image[offset], image[offset + 1],
                                                  image[offset + 2]);
                     });
-      });
+      }));
   } catch (std::exception const &e) {
     cout << "convertToGrayscale exception: " << e.what() << std::endl;
     terminate();
@@ -80,7 +126,7 @@ void ConvertToUint8Buffer(queue &q,
       range num_items(width * height);
       //q.submit([&fl_in_buffer, &u8_out_buffer, width, height](
       //          sycl::handler& h) 
-      q.submit([&](auto &h)                 
+      ProfileStage("ConvertToUint8", q.submit([&](auto &h)                 
       {
         // A discard_write is a write access that doesn't need to preserve existing
         // memory contents
@@ -94,7 +140,7 @@ void ConvertToUint8Buffer(queue &q,
                           //u8_out[idx[0]] = fl_in[idx[0]] * 255;
                           u8_out[idx] = fl_in[idx] * 255;
                       });
-      });
+      }));
   } catch (std::exception const &e) {
     cout << "convertToGrayscale exception: " << e.what() << std::endl;
     terminate();
@@ -116,7 +162,7 @@ void InitUint8SyclBuffer(queue &q,
   {  
       //q.submit([&u8_buffer, width, height, value](
       //          sycl::handler& h) {
-      q.submit([&](auto &h) {
+      ProfileStage("InitUint8", q.submit([&](auto &h) {
       // A discard_write is a write access that doesn't need to preserve existing
       // memory contents
       //auto u8 = u8_buffer.get_access<sycl::access::mode::write>(h);
@@ -129,7 +175,7 @@ void InitUint8SyclBuffer(queue &q,
       h.parallel_for(numItems, [=](auto idx) {
                         u8[idx] = value;
                     });
-      });
+      }));
   } catch (std::exception const &e) {
     cout << "initUint8SyclBuffer exception: " << e.what() << std::endl;
     terminate();
@@ -150,7 +196,7 @@ void InitUint8SyclBuffer1(queue &q,
   {  
       //q.submit([&u8_buffer, width, height, value](
       //          sycl::handler& h) {
-      q.submit([&](auto &h) {
+      ProfileStage("InitUint8", q.submit([&](auto &h) {
       // A discard_write is a write access that doesn't need to preserve existing
       // memory contents
       //auto u8 = u8_buffer.get_access<sycl::access::mode::write>(h);
@@ -163,13 +209,630 @@ void InitUint8SyclBuffer1(queue &q,
       h.parallel_for(numItems, [=](auto idx) {
                         u8[idx] = value;
                     });
-      });
+      }));
   } catch (std::exception const &e) {
     cout << "initUint8SyclBuffer exception: " << e.what() << std::endl;
     terminate();
   }
 }
 
+/***************************************************************
+ * 
+****************************************************************/
+void ComputeMagnitudeBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in0_buffer, // input
+                      sycl::buffer<float, 1> &fl_in1_buffer, // input
+                      sycl::buffer<float, 1> &fl_out_buffer, // output
+                      int width, int height)
+{
+  try
+  {  
+      ProfileStage("ComputeMagnitude", q.submit([&fl_in0_buffer, &fl_in1_buffer, &fl_out_buffer, width, height](sycl::handler& h) {
+        auto in0 = fl_in0_buffer.get_access<sycl::access::mode::read>(h);
+        auto in1 = fl_in1_buffer.get_access<sycl::access::mode::read>(h);
+        auto out = fl_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+        h.parallel_for(sycl::range<1>(width * height),
+                    [in0, in1, out](sycl::id<1> idx) {
+                        float i0 = in0[idx[0]];
+                        float i1 = in1[idx[0]];
+                        out[idx[0]] = sycl::sqrt(i0 * i0 + i1 * i1);
+                    });
+      }));
+  } catch (std::exception const &e) {
+    cout << "ComputeMagnitudeBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }  
+}
+
+/***************************************************************
+ * Kernel of Convolution3x3Buffer for border mode B
+****************************************************************/
+template <Border B>
+static void Convolution3x3Kernel(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      std::array<float, 9> filter,
+                      int width, int height, int pitch, float constant)
+{
+  WorkGroupShape shape = GetWorkGroupShape(q, TunedKernel::Convolution3x3, width, height);
+  ProfileStage("Convolution3x3", q.submit([&fl_in_buffer, &fl_out_buffer, filter, width, height, pitch, constant, shape](sycl::handler& h) {
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    // Only width elements of each row are written: with padding the rest of
+    // the output must be kept, so it isn't discarded
+    sycl::property_list outProperties;
+    if (pitch == width) outProperties = sycl::property_list{sycl::no_init};
+    sycl::accessor out(fl_out_buffer, h, sycl::write_only, outProperties);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, out, filter, width, height, pitch, constant](int y, int x) {
+                        float value = 0.0f;
+                        int cIdx = 0;
+                        for (int l = -1; l <= 1; l++)  // filter row
+                        {
+                            for (int k = -1; k <= 1; k++)  // filter col
+                            {
+                                value += BorderFetch<B>(data, x + k, y + l, width, height, pitch, constant) *
+                                         filter[cIdx++];
+                            }
+                        }
+                        out[y * pitch + x] = value;
+                    });
+  }));
+}
+
+/***************************************************************
+ * Device version of Convolution3x3Cpp, same tap order.
+****************************************************************/
+Result Convolution3x3BufferOrThrow(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      const float *pFilter,
+                      int width, int height,
+                      Border border, float constant)
+{
+  if (pFilter == nullptr) return Result::InvalidArgument;
+
+  std::array<float, 9> filter;
+  for (int i = 0; i < 9; i++) filter[i] = pFilter[i];
+
+  return DispatchBorder(border, [&](auto tag) {
+      Convolution3x3Kernel<decltype(tag)::value>(q, fl_in_buffer, fl_out_buffer, filter,
+                                                 width, height, width, constant);
+      return Result::Ok;
+  });
+}
+
+Result Convolution3x3Buffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      const float *pFilter,
+                      int width, int height,
+                      Border border, float constant)
+{
+  try
+  {
+    return Convolution3x3BufferOrThrow(q, fl_in_buffer, fl_out_buffer, pFilter, width, height,
+                                       border, constant);
+  } catch (std::exception const &e) {
+    cout << "Convolution3x3Buffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Kernel of StencilBuffer for border mode B
+****************************************************************/
+template <typename S, Border B>
+static void StencilKernel(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height, float constant)
+{
+  WorkGroupShape shape = GetWorkGroupShape(q, TunedKernel::Stencil, width, height);
+  ProfileStage("Stencil", q.submit([&fl_in_buffer, &fl_out_buffer, width, height, constant, shape](sycl::handler& h) {
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = fl_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, out, width, height, constant](int y, int x) {
+                        out[y * width + x] = S::template Apply<float>([&](int k, int l) {
+                            return BorderFetch<B>(data, x + k, y + l, width, height, width, constant);
+                        });
+                    });
+  }));
+}
+
+/***************************************************************
+ * Device version of StencilCpp, same tap order.
+****************************************************************/
+template <typename S>
+Result StencilBufferOrThrow(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height,
+                      Border border, float constant)
+{
+  return DispatchBorder(border, [&](auto tag) {
+      StencilKernel<S, decltype(tag)::value>(q, fl_in_buffer, fl_out_buffer, width, height, constant);
+      return Result::Ok;
+  });
+}
+
+template <typename S>
+Result StencilBuffer(sycl::queue &q,
+                      sycl::buffer<float, 1> &fl_in_buffer,
+                      sycl::buffer<float, 1> &fl_out_buffer,
+                      int width, int height,
+                      Border border, float constant)
+{
+  try
+  {
+    return StencilBufferOrThrow<S>(q, fl_in_buffer, fl_out_buffer, width, height, border, constant);
+  } catch (std::exception const &e) {
+    cout << "StencilBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+#define INSTANTIATE_STENCIL_BUFFER(S) \
+    template Result StencilBuffer<S>(sycl::queue&, sycl::buffer<float, 1>&, sycl::buffer<float, 1>&, \
+                                     int, int, Border, float); \
+    template Result StencilBufferOrThrow<S>(sycl::queue&, sycl::buffer<float, 1>&, sycl::buffer<float, 1>&, \
+                                            int, int, Border, float);
+
+INSTANTIATE_STENCIL_BUFFER(SobelXStencil)
+INSTANTIATE_STENCIL_BUFFER(SobelYStencil)
+INSTANTIATE_STENCIL_BUFFER(ScharrXStencil)
+INSTANTIATE_STENCIL_BUFFER(ScharrYStencil)
+INSTANTIATE_STENCIL_BUFFER(PrewittXStencil)
+INSTANTIATE_STENCIL_BUFFER(PrewittYStencil)
+INSTANTIATE_STENCIL_BUFFER(LaplacianStencil)
+#undef INSTANTIATE_STENCIL_BUFFER
+
+/***************************************************************
+ * Image version. The kernel reads and writes the images in place
+ * through Image::Buffer(), with their pitch, and the result is in
+ * out when this returns.
+****************************************************************/
+Result Convolution3x3Buffer(sycl::queue &q,
+                      Image<float> &in,
+                      Image<float> &out,
+                      const float *pFilter,
+                      Border border, float constant)
+{
+  if (pFilter == nullptr || in.Empty() || out.Empty() || in.Channels() != 1 || out.Channels() != 1 ||
+      in.Width() != out.Width() || in.Height() != out.Height())
+  {
+    return Result::InvalidArgument;
+  }
+
+  std::array<float, 9> filter;
+  for (int i = 0; i < 9; i++) filter[i] = pFilter[i];
+
+  try
+  {
+    sycl::buffer<float, 1> fl_in_buffer = in.Buffer();
+    sycl::buffer<float, 1> fl_out_buffer = out.Buffer();
+    return DispatchBorder(border, [&](auto tag) {
+        Convolution3x3Kernel<decltype(tag)::value>(q, fl_in_buffer, fl_out_buffer, filter,
+                                                   in.Width(), in.Height(), static_cast<int>(in.Pitch()),
+                                                   constant);
+        return Result::Ok;
+    });
+  } catch (std::exception const &e) {
+    cout << "Convolution3x3Buffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Kernels of SeparableFilterBuffer for border mode B. Work-item
+ * dim 1 is x so neighbouring work-items read neighbouring pixels.
+****************************************************************/
+template <Border B>
+static void SeparableFilterKernels(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 sycl::buffer<float, 1> &kx_buffer,
+                 sycl::buffer<float, 1> &ky_buffer,
+                 int width, int height, float constant, float rowConstant)
+{
+  sycl::buffer<float, 1> tmp_buffer{static_cast<size_t>(width) * height};
+  const int rx = static_cast<int>(kx_buffer.size()) / 2;
+  const int ry = static_cast<int>(ky_buffer.size()) / 2;
+  WorkGroupShape shape = GetWorkGroupShape(queue, TunedKernel::SeparableFilter, width, height);
+
+  // Horizontal pass
+  ProfileStage("SeparableHorizontal", queue.submit([&fl_in_buffer, &tmp_buffer, &kx_buffer, width, height, rx, constant, shape](sycl::handler& h)
+  {
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto kx   = kx_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = tmp_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, kx, out, width, height, rx, constant](int y, int x) {
+                        float value = 0.0f;
+                        for (int i = -rx; i <= rx; i++)
+                        {
+                            value += kx[i + rx] * BorderFetch<B>(data, x + i, y, width, height, width, constant);
+                        }
+                        out[y * width + x] = value;
+                    });
+  }));
+
+  // Vertical pass. For Border::Constant the rows outside the image are the
+  // horizontal kernel applied to a constant row.
+  ProfileStage("SeparableVertical", queue.submit([&tmp_buffer, &fl_out_buffer, &ky_buffer, width, height, ry, rowConstant, shape](sycl::handler& h)
+  {
+    auto data = tmp_buffer.get_access<sycl::access::mode::read>(h);
+    auto ky   = ky_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = fl_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, ky, out, width, height, ry, rowConstant](int y, int x) {
+                        float value = 0.0f;
+                        for (int i = -ry; i <= ry; i++)
+                        {
+                            value += ky[i + ry] * BorderFetch<B>(data, x, y + i, width, height, width, rowConstant);
+                        }
+                        out[y * width + x] = value;
+                    });
+  }));
+}
+
+/***************************************************************
+ * Separable filter on the device: kernelX along rows, then kernelY
+ * along columns, correlated the same way as SeparableFilterCpp.
+ * Any odd kernel length, any border mode.
+****************************************************************/
+Result SeparableFilterBufferOrThrow(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 const std::vector<float> &kernelX,
+                 const std::vector<float> &kernelY,
+                 int width, int height,
+                 Border border, float constant)
+{
+  if (kernelX.empty() || kernelY.empty() || (kernelX.size() & 1) == 0 || (kernelY.size() & 1) == 0)
+    return Result::InvalidArgument;
+
+  float sumKx = 0.0f;
+  for (float k : kernelX) sumKx += k;
+
+  sycl::buffer<float, 1> kx_buffer{kernelX.data(), sycl::range<1>(kernelX.size())};
+  sycl::buffer<float, 1> ky_buffer{kernelY.data(), sycl::range<1>(kernelY.size())};
+
+  return DispatchBorder(border, [&](auto tag) {
+      SeparableFilterKernels<decltype(tag)::value>(queue, fl_in_buffer, fl_out_buffer,
+                                                   kx_buffer, ky_buffer, width, height,
+                                                   constant, constant * sumKx);
+      return Result::Ok;
+  });
+}
+
+Result SeparableFilterBuffer(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 const std::vector<float> &kernelX,
+                 const std::vector<float> &kernelY,
+                 int width, int height,
+                 Border border, float constant)
+{
+  try
+  {
+    return SeparableFilterBufferOrThrow(queue, fl_in_buffer, fl_out_buffer, kernelX, kernelY,
+                                        width, height, border, constant);
+  } catch (std::exception const &e) {
+    cout << "SeparableFilterBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Fixed tap Gaussian kernels for border mode B and radius R. The
+ * R + 1 weights (center out) are captured by value, so they live in
+ * registers and the tap loops unroll. The kernel is symmetric, so
+ * the taps at distance i share one multiply.
+****************************************************************/
+template <Border B, int R>
+static void GaussianFixedKernels(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 std::array<float, R + 1> coeff,
+                 int width, int height, float constant)
+{
+  sycl::buffer<float, 1> tmp_buffer{static_cast<size_t>(width) * height};
+  WorkGroupShape shape = GetWorkGroupShape(queue, TunedKernel::GaussianBlur, width, height);
+
+  // Horizontal pass
+  ProfileStage("GaussianHorizontal", queue.submit([&fl_in_buffer, &tmp_buffer, coeff, width, height, constant, shape](sycl::handler& h)
+  {
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = tmp_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, out, coeff, width, height, constant](int y, int x) {
+                        float value = coeff[0] * data[y * width + x];
+                        #pragma unroll
+                        for (int i = 1; i <= R; i++)
+                        {
+                            value += coeff[i] * (BorderFetch<B>(data, x - i, y, width, height, width, constant) +
+                                                 BorderFetch<B>(data, x + i, y, width, height, width, constant));
+                        }
+                        out[y * width + x] = value;
+                    });
+  }));
+
+  // Vertical pass. The weights sum to 1, so a constant row stays constant.
+  ProfileStage("GaussianVertical", queue.submit([&tmp_buffer, &fl_out_buffer, coeff, width, height, constant, shape](sycl::handler& h)
+  {
+    auto data = tmp_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = fl_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, out, coeff, width, height, constant](int y, int x) {
+                        float value = coeff[0] * data[y * width + x];
+                        #pragma unroll
+                        for (int i = 1; i <= R; i++)
+                        {
+                            value += coeff[i] * (BorderFetch<B>(data, x, y - i, width, height, width, constant) +
+                                                 BorderFetch<B>(data, x, y + i, width, height, width, constant));
+                        }
+                        out[y * width + x] = value;
+                    });
+  }));
+}
+
+template <Border B, int R>
+static void GaussianFixedKernels(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 const std::vector<float> &kernel,
+                 int width, int height, float constant)
+{
+  std::array<float, R + 1> coeff;
+  for (int i = 0; i <= R; i++) coeff[i] = kernel[R + i];
+  GaussianFixedKernels<B, R>(queue, fl_in_buffer, fl_out_buffer, coeff, width, height, constant);
+}
+
+/***************************************************************
+ * Gaussian blur on the device, see GaussianBlurCpp. Radii up to
+ * GAUSSIAN_FIXED_MAX_RADIUS run the fixed tap kernels, larger ones
+ * SeparableFilterBuffer.
+****************************************************************/
+Result GaussianBlurBufferOrThrow(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height, float sigma,
+                 Border border, float constant)
+{
+  if (!(sigma > 0.0f)) return Result::InvalidArgument;
+
+  std::vector<float> kernel = GaussianKernel(sigma);
+  const int r = static_cast<int>(kernel.size()) / 2;
+  if (r > GAUSSIAN_FIXED_MAX_RADIUS)
+  {
+    return SeparableFilterBufferOrThrow(queue, fl_in_buffer, fl_out_buffer, kernel, kernel,
+                                        width, height, border, constant);
+  }
+
+  return DispatchBorder(border, [&](auto tag) {
+      constexpr Border B = decltype(tag)::value;
+      switch (r)
+      {
+      case 1:  GaussianFixedKernels<B, 1>(queue, fl_in_buffer, fl_out_buffer, kernel, width, height, constant); break;
+      case 2:  GaussianFixedKernels<B, 2>(queue, fl_in_buffer, fl_out_buffer, kernel, width, height, constant); break;
+      default: GaussianFixedKernels<B, 3>(queue, fl_in_buffer, fl_out_buffer, kernel, width, height, constant); break;
+      }
+      return Result::Ok;
+  });
+}
+
+Result GaussianBlurBuffer(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height, float sigma,
+                 Border border, float constant)
+{
+  try
+  {
+    return GaussianBlurBufferOrThrow(queue, fl_in_buffer, fl_out_buffer, width, height, sigma,
+                                     border, constant);
+  } catch (std::exception const &e) {
+    cout << "GaussianBlurBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * SobelContext owns the device only scratch memory used by the
+ * separable SobelFilter. Create it once per (width, height, device)
+ * and reuse it for every frame so the per frame call does no
+ * allocations.
+****************************************************************/
+SobelContext::SobelContext(sycl::queue &q, int width, int height, StoragePrecision precision)
+  : queue_(q), width_(width), height_(height), precision_(precision)
+{
+  size_t numPixels = static_cast<size_t>(width) * height;
+  size_t bytes = numPixels * (precision == StoragePrecision::Float32 ? sizeof(float) : sizeof(sycl::half));
+  // From the device pool, so contexts created per call (e.g. the one shot
+  // SobelFilter) reuse the memory of the previous one
+  MemoryPool &pool = UsmMemoryPool(queue_);
+  dx_    = pool.Allocate(bytes);
+  dy_    = pool.Allocate(bytes);
+  dxTmp_ = pool.Allocate(bytes);
+  dyTmp_ = pool.Allocate(bytes);
+  maxVal_ = static_cast<float *>(pool.Allocate(2 * sizeof(float)));
+  if (dx_ == nullptr || dy_ == nullptr || dxTmp_ == nullptr || dyTmp_ == nullptr ||
+      maxVal_ == nullptr)
+  {
+    Release();
+    throw std::runtime_error("SobelContext: device allocation failed");
+  }
+  bytesAllocated_ = 4 * bytes + 2 * sizeof(float);
+}
+
+SobelContext::~SobelContext()
+{
+  Release();
+}
+
+void SobelContext::Release()
+{
+  // Kernels from the last frame may still be using the scratch memory. The
+  // pool takes it back once they are done, so this doesn't block.
+  MemoryPool &pool = UsmMemoryPool(queue_);
+  pool.FreeAfter(dx_, lastUse_);
+  pool.FreeAfter(dy_, lastUse_);
+  pool.FreeAfter(dxTmp_, lastUse_);
+  pool.FreeAfter(dyTmp_, lastUse_);
+  pool.FreeAfter(maxVal_, lastUse_);
+  dx_ = dy_ = dxTmp_ = dyTmp_ = nullptr;
+  maxVal_ = nullptr;
+  bytesAllocated_ = 0;
+}
+
+bool SobelContext::IsCompatible(const sycl::queue &q, int width, int height) const
+{
+  return width == width_ && height == height_ && q.get_device() == queue_.get_device();
+}
+
+/***************************************************************
+ * Call f with a value of the device storage type for precision,
+ * like DispatchBorder does for the border mode.
+****************************************************************/
+template <typename F>
+static Result DispatchStorage(StoragePrecision precision, F &&f)
+{
+  switch (precision)
+  {
+  case StoragePrecision::Float32:  return f(float());
+  case StoragePrecision::Float16:  return f(sycl::half());
+  case StoragePrecision::BFloat16: return f(sycl::ext::oneapi::bfloat16());
+  default: return Result::InvalidArgument;
+  }
+}
+
+/***************************************************************
+ * Kernels of the separable SobelFilter for border mode B, with the
+ * intermediate images stored as T (float, sycl::half or bfloat16).
+ * Values are computed in float and rounded once when stored; the max
+ * is taken before rounding. Returns the event of the last kernel.
+ *
+ * With Border::Constant the vertical passes see rows outside the
+ * image as the horizontal kernel applied to a constant row, i.e.
+ * constant * sum(kernel): 0 for [1, 0, -1] and 4 * constant for
+ * [1, 2, 1]. That matches the 2D 3x3 filter.
+****************************************************************/
+template <Border B, typename T>
+static sycl::event SobelSeparableKernels(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 T *dx, T *dy, T *dx_tmp, T *dy_tmp,
+                 float *maxVal, // [0] max of dx, [1] max of dy
+                 int width, int height, float constant,
+                 sycl::event prevFrame)
+{
+  WorkGroupShape shape = GetWorkGroupShape(queue, TunedKernel::SobelSeparable, width, height);
+
+  // the horizontal convolution
+  // Extract a 3x1 window around (x, y) and compute the dot product
+  // between the window and the kernel [1, 0, -1]
+  sycl::event dxTmpDone = ProfileStage("SobelDxHorizontal", queue.submit([&fl_in_buffer, dx_tmp, width, height, constant, prevFrame, shape](sycl::handler& h)
+  {
+    h.depends_on(prevFrame);
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                    [data, width, height, constant, dx_tmp](int y, int x) {
+                        float left  = BorderFetch<B>(data, x - 1, y, width, height, width, constant);
+                        float right = BorderFetch<B>(data, x + 1, y, width, height, width, constant);
+                        dx_tmp[y * width + x] = static_cast<T>(left - right);
+                    });
+  }));
+
+  // Extract a 1x3 window around (x, y) and compute the dot product
+  // between the window and the kernel [1, 2, 1]
+  // Like FindMaxCpp the max starts at 0
+  sycl::event maxInit = ProfileStage("SobelMaxInit", queue.submit([maxVal, prevFrame](sycl::handler& h)
+  {
+    h.depends_on(prevFrame);
+    h.fill(maxVal, 0.0f, 2);
+  }));
+
+  sycl::event dxDone = ProfileStage("SobelDxVertical", queue.submit([dx, dx_tmp, maxVal, width, height, dxTmpDone, maxInit, shape](sycl::handler& h) 
+  {
+    h.depends_on({dxTmpDone, maxInit});
+    ParallelFor2D(h, shape, height, width,
+          sycl::reduction(maxVal, sycl::maximum<float>()),
+          [dx_tmp, width, height, dx](int y, int x, auto &maxDx) {
+              // Convolve vertically
+              float up     = BorderFetch<B>(dx_tmp, x, y - 1, width, height, width, 0.0f);
+              float down   = BorderFetch<B>(dx_tmp, x, y + 1, width, height, width, 0.0f);
+              float center = static_cast<float>(dx_tmp[y * width + x]);
+              float value  = up + 2 * center + down;
+              dx[y * width + x] = static_cast<T>(value);
+              maxDx.combine(value);
+          });
+  }));
+
+  // The vertical convolution is then performed in the same way, except with different kernels:
+  sycl::event dyTmpDone = ProfileStage("SobelDyHorizontal", queue.submit([&fl_in_buffer, dy_tmp, width, height, constant, prevFrame, shape](
+               sycl::handler& h) 
+  {
+    h.depends_on(prevFrame);
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+
+    ParallelFor2D(h, shape, height, width,
+                  [data, width, height, constant, dy_tmp](int y, int x) {
+                      // Convolve horizontally
+                      float left   = BorderFetch<B>(data, x - 1, y, width, height, width, constant);
+                      float right  = BorderFetch<B>(data, x + 1, y, width, height, width, constant);
+                      float center = data[y * width + x];
+                      dy_tmp[y * width + x] = static_cast<T>(left + 2 * center + right);
+                    });
+  }));
+
+  sycl::event dyDone = ProfileStage("SobelDyVertical", queue.submit([dy, dy_tmp, maxVal, width, height, constant, dyTmpDone, maxInit, shape](sycl::handler& h) 
+  {
+    h.depends_on({dyTmpDone, maxInit});
+    ParallelFor2D(h, shape, height, width,
+        sycl::reduction(maxVal + 1, sycl::maximum<float>()),
+        [dy_tmp, width, height, constant, dy](int y, int x, auto &maxDy) {
+            // Convolve vertically
+            float up    = BorderFetch<B>(dy_tmp, x, y - 1, width, height, width, 4 * constant);
+            float down  = BorderFetch<B>(dy_tmp, x, y + 1, width, height, width, 4 * constant);
+            float value = up - down;
+            dy[y * width + x] = static_cast<T>(value);
+            maxDy.combine(value);
+        });
+  }));
+  
+  // Notice that the above vertical and horizontal gradients have no dependence 
+  // on one another, so SYCL may execute them in parallel.
+
+  // For each pixel, we can have the gradient projected on the x and y axes, 
+  // so it's a simple matter to compute the magnitude of the gradient.
+  // Both gradients are normalized by the larger of the two maxima, which is
+  // read straight from device memory.
+  return ProfileStage("SobelMagnitude", queue.submit([dx, dy, maxVal, width, height, &fl_out_buffer, dxDone, dyDone](sycl::handler& h) {
+      h.depends_on({dxDone, dyDone});
+      auto fl_out = fl_out_buffer.get_access<sycl::access::mode::write>(h);
+
+      h.parallel_for(sycl::range<1>(width * height),
+          [dx, dy, maxVal, fl_out](sycl::id<1> idx) {
+              float maxValXY = sycl::max(maxVal[0], maxVal[1]);
+              float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
+              float dx_val = static_cast<float>(dx[idx[0]]) * scale;
+              float dy_val = static_cast<float>(dy[idx[0]]) * scale;
+              // NOTE: if deploying to an accelerated device, math
+              // functions MUST be used from the sycl namespace
+              fl_out[idx[0]] = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
+      });
+  }));
+}
+
 /***************************************************************
  * Sobel Filter implemented using horizontal and vertical convolutions
  * |1  0 -1|
@@ -185,115 +848,840 @@ void InitUint8SyclBuffer1(queue &q,
  * |2  0 -2| = |2| * [1  0 -1]
  * |1  0 -1|   |1| 
  * 
+ * The intermediate results live in the context's device memory. The
+ * scratch pointers are USM so the kernels that touch them are ordered
+ * with explicit events, including against the previous frame.
+ *
+ * The vertical passes also reduce the max of dx and dy on the device,
+ * and the magnitude kernel reads it from there to normalize the result
+ * the same way SobelFilterCpp does.
+ *
+ * The border mode is a template parameter of the kernels, so there
+ * is no per tap switch. Border::Constant with 0 zero pads like the
+ * original kernel; the default is Border::Clamp, as in SobelFilterCpp.
+ *
  * Ref: 
  * https://www.codeproject.com/Articles/5284847/5-Minutes-to-Your-First-oneAPI-App-on-DevCloud
 ****************************************************************/
+void SobelFilter(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer, // a grayscale buffer with 1 channel
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 Border border, float constant)
+{
+  // Don't overwrite the scratch memory while the previous frame still uses it
+  sycl::event prevFrame = ctx.lastUse_;
+
+  Result result = DispatchStorage(ctx.Precision(), [&](auto storage) {
+      using T = decltype(storage);
+      return DispatchBorder(border, [&](auto tag) {
+          ctx.lastUse_ = SobelSeparableKernels<decltype(tag)::value, T>(ctx.Queue(),
+                            fl_in_buffer, fl_out_buffer,
+                            static_cast<T *>(ctx.dx_), static_cast<T *>(ctx.dy_),
+                            static_cast<T *>(ctx.dxTmp_), static_cast<T *>(ctx.dyTmp_), ctx.maxVal_,
+                            ctx.Width(), ctx.Height(), constant, prevFrame);
+          return Result::Ok;
+      });
+  });
+  if (result != Result::Ok)
+  {
+    cout << "SobelFilter: invalid border mode" << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * One shot version of the above. Takes the scratch memory from the
+ * device pool on every call, use a SobelContext in loops. Returns
+ * once the kernels are submitted: the context's destructor hands
+ * the memory back to the pool to be reused after they are done.
+****************************************************************/
 void SobelFilter(sycl::queue &queue,
                  sycl::buffer<float, 1> &fl_in_buffer, // a grayscale buffer with 1 channel
                  sycl::buffer<float, 1> &fl_out_buffer,
-                 int width, int height)
+                 int width, int height,
+                 Border border, float constant, StoragePrecision precision)
 {
-  sycl::buffer<float, 1> dx{width * height};  // todo make these device only memory
-  sycl::buffer<float, 1> dy{width * height};
+  SobelContext ctx(queue, width, height, precision);
+  SobelFilter(ctx, fl_in_buffer, fl_out_buffer, border, constant);
+}
 
-  // the horizontal convolution
+/***************************************************************
+ * Fused Sobel Filter. Same result as SobelFilter(), but the gradients
+ * and the magnitude come from a single kernel.
+ *
+ * Each work-group loads a tile of its own size (SOBEL_TILE_HEIGHT x
+ * SOBEL_TILE_WIDTH unless tuned, see GetWorkGroupShape)
+ * plus a one pixel halo into local memory once, then every work-item
+ * computes both gradients and the magnitude from local memory:
+ *
+ * dx = (tl - tr) + 2 * (l - r) + (bl - br)
+ * dy = (tl + 2 * t + tr) - (bl + 2 * b + br)
+ *
+ * No intermediate full frame buffers are allocated, and every input
+ * pixel is read from global memory about once instead of ~10 times
+ * for the separable version.
+ *
+ * The max of dx and dy is reduced in the same kernel, then the
+ * magnitude is normalized in place by the ScaleImgBuffer kernel, a
+ * second pass over the output. With the fill of the max that is
+ * three submissions.
+****************************************************************/
+template <Border B>
+static void SobelFilterFusedKernel(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer, // a grayscale buffer with 1 channel
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height, float constant)
+{
+  const WorkGroupShape tileShape = GetWorkGroupShape(queue, TunedKernel::SobelFused, width, height);
+  const int tileW = tileShape.x;
+  const int tileH = tileShape.y;
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
+
+  // Round the global range up to whole tiles. Work-items that fall outside
+  // the image still help load the halo, they just don't write a result.
+  size_t globalW = ((width + tileW - 1) / tileW) * tileW;
+  size_t globalH = ((height + tileH - 1) / tileH) * tileH;
+
+  sycl::buffer<float, 1> maxBuf{1};
+
+  ProfileStage("SobelFusedMaxInit", queue.submit([&maxBuf](sycl::handler& h) {
+    sycl::accessor maxVal(maxBuf, h, sycl::write_only, sycl::no_init);
+    h.fill(maxVal, 0.0f);
+  }));
+
+  ProfileStage("SobelFused", queue.submit([&fl_in_buffer, &fl_out_buffer, &maxBuf, width, height, constant, globalW, globalH,
+                tileW, tileH, haloW, haloH](sycl::handler& h)
   {
-    // Open a new scope so that dx_tmp is deallocated once no longer needed
-    sycl::buffer<float, 1> dx_tmp{width * height};
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto out  = fl_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+    sycl::local_accessor<float, 1> tile(sycl::range<1>(haloW * haloH), h);
+    auto maxReduction = sycl::reduction(maxBuf, h, sycl::maximum<float>());
+
+    // dim 1 is x so that neighbouring work-items read neighbouring pixels
+    h.parallel_for(sycl::nd_range<2>(sycl::range<2>(globalH, globalW),
+                                     sycl::range<2>(tileH, tileW)),
+        maxReduction,
+        [data, out, tile, width, height, constant](sycl::nd_item<2> item, auto &maxVal) {
+            const int tileW = item.get_local_range(1);
+            const int tileH = item.get_local_range(0);
+            const int haloW = tileW + 2;
+            const int haloH = tileH + 2;
+            const int lx = item.get_local_id(1);
+            const int ly = item.get_local_id(0);
+            // Image coordinates of the top left corner of the halo
+            const int x0 = item.get_group(1) * tileW - 1;
+            const int y0 = item.get_group(0) * tileH - 1;
+
+            // Cooperative load of the tile plus halo
+            for (int i = ly * tileW + lx; i < haloW * haloH; i += tileW * tileH)
+            {
+                int gx = x0 + i % haloW;
+                int gy = y0 + i / haloW;
+                tile[i] = BorderFetch<B>(data, gx, gy, width, height, width, constant);
+            }
+            sycl::group_barrier(item.get_group());
+
+            const int x = x0 + 1 + lx;
+            const int y = y0 + 1 + ly;
+            if (x >= width || y >= height) return;
+
+            float dx_val, dy_val;
+            SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+            out[y * width + x] = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
+            maxVal.combine(sycl::max(dx_val, dy_val));
+        });
+  }));
+
+  ScaleImgKernel(queue, fl_out_buffer, maxBuf, width, height);
+}
 
-    // Extract a 3x1 window around (x, y) and compute the dot product
-    // between the window and the kernel [1, 0, -1]
-    queue.submit([&fl_in_buffer, &dx_tmp, width, height](sycl::handler& h)
+Result SobelFilterFusedOrThrow(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height,
+                 Border border, float constant)
+{
+  return DispatchBorder(border, [&](auto tag) {
+      SobelFilterFusedKernel<decltype(tag)::value>(queue, fl_in_buffer, fl_out_buffer,
+                                                   width, height, constant);
+      return Result::Ok;
+  });
+}
+
+void SobelFilterFused(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer, // a grayscale buffer with 1 channel
+                 sycl::buffer<float, 1> &fl_out_buffer,
+                 int width, int height,
+                 Border border, float constant)
+{
+  try
+  {
+    Result result = SobelFilterFusedOrThrow(queue, fl_in_buffer, fl_out_buffer, width, height,
+                                            border, constant);
+    if (result != Result::Ok)
     {
-      auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
-      auto out = dx_tmp.get_access<sycl::access::mode::discard_write>(h);
-
-      h.parallel_for(sycl::range<2>(width, height),
-                      [data, width, out](sycl::id<2> idx) {
-                          int offset = idx[1] * width + idx[0];
-                          float left = idx[0] == 0 ? 0 : data[offset - 1];
-                          float right = idx[0] == width - 1 ? 0 : data[offset + 1];
-                          out[offset] = left - right;
-                      });
-    });
+      cout << "SobelFilterFused: invalid border mode" << std::endl;
+      terminate();
+    }
+  } catch (std::exception const &e) {
+    cout << "SobelFilterFused exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Load a work-group sized tile plus a one pixel
+ * halo of luminance, computed on the fly from interleaved u8 RGB(A)
+ * (or taken as is from 1 channel gray), into local memory. Ends with a work-group barrier.
+****************************************************************/
+template <Border B, typename Image, typename Tile>
+static inline void LoadLuminanceTile(const sycl::nd_item<2> &item, const Image &image,
+                 const Tile &tile, int width, int height, int numChannels, float constant)
+{
+  // The tile is the work-group, its size comes from the tuner
+  const int tileW = item.get_local_range(1);
+  const int tileH = item.get_local_range(0);
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
 
-    // Extract a 1x3 window around (x, y) and compute the dot product
-    // between the window and the kernel [1, 2, 1]
-    queue.submit([&dx, &dx_tmp, width, height](sycl::handler& h) 
+  const int x0 = item.get_group(1) * tileW - 1;
+  const int y0 = item.get_group(0) * tileH - 1;
+  for (int i = item.get_local_id(0) * tileW + item.get_local_id(1); i < haloW * haloH;
+       i += tileW * tileH)
+  {
+    int gx = BorderIndex<B>(x0 + i % haloW, width);
+    int gy = BorderIndex<B>(y0 + i / haloW, height);
+    if (gx < 0 || gy < 0)
     {
-      auto data = dx_tmp.get_access<sycl::access::mode::read>(h);
-      auto out  = dx.get_access<sycl::access::mode::discard_write>(h);
-      h.parallel_for(
-            sycl::range<2>(width, height),
-            [data, width, height, out](sycl::id<2> idx) {
-                // Convolve vertically
-                int offset = idx[1] * width + idx[0];
-                float up   = idx[1] == 0 ? 0 : data[offset - width];
-                float down = idx[1] == height - 1 ? 0 : data[offset + width];
-                float center = data[offset];
-                out[offset]  = up + 2 * center + down;
-            });
-    });
+      tile[i] = constant;   // only for Border::Constant
+      continue;
+    }
+    int offset = numChannels * (gy * width + gx);
+    tile[i] = numChannels >= 3 ? luminance(image[offset], image[offset + 1], image[offset + 2])
+                               : image[offset] / 255.0f;
   }
-  //#if 0
-  // The vertical convolution is then performed in the same way, except with different kernels:
+  sycl::group_barrier(item.get_group());
+}
+
+/***************************************************************
+ * Kernels of SobelEdgesUint8Buffer for border mode B.
+****************************************************************/
+template <Border B>
+static void SobelEdgesUint8Kernels(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 bool normalize, float constant)
+{
+  const WorkGroupShape tileShape = GetWorkGroupShape(queue, TunedKernel::SobelEdgesUint8, width, height);
+  const int tileW = tileShape.x;
+  const int tileH = tileShape.y;
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
+  sycl::nd_range<2> ndRange(sycl::range<2>(((height + tileH - 1) / tileH) * tileH,
+                                           ((width + tileW - 1) / tileW) * tileW),
+                            sycl::range<2>(tileH, tileW));
+
+  // Without normalization the gradients are scaled by their largest possible
+  // value for a 0 ... 1 luminance, which is 4.
+  sycl::buffer<float, 1> maxBuf{1};
+  ProfileStage("SobelEdgesMaxInit", queue.submit([&maxBuf, normalize](sycl::handler& h) {
+    sycl::accessor maxVal(maxBuf, h, sycl::write_only, sycl::no_init);
+    h.fill(maxVal, normalize ? 0.0f : 4.0f);
+  }));
+
+  if (normalize)
   {
-    sycl::buffer<float, 1> dy_tmp{width * height};
+    // Max of dx and dy, reading the RGB input once more but writing nothing
+    ProfileStage("SobelEdgesMax", queue.submit([&u8_image_in_buffer, &maxBuf, ndRange, width, height, numChannels, constant, haloW, haloH](sycl::handler& h)
+    {
+      auto image = u8_image_in_buffer.get_access<sycl::access::mode::read>(h);
+      sycl::local_accessor<float, 1> tile(sycl::range<1>(haloW * haloH), h);
+      auto maxReduction = sycl::reduction(maxBuf, h, sycl::maximum<float>());
+
+      h.parallel_for(ndRange, maxReduction,
+          [image, tile, width, height, numChannels, constant](sycl::nd_item<2> item, auto &maxVal) {
+              LoadLuminanceTile<B>(item, image, tile, width, height, numChannels, constant);
+
+              const int haloW = item.get_local_range(1) + 2;
+              const int lx = item.get_local_id(1);
+              const int ly = item.get_local_id(0);
+              const int x = item.get_global_id(1);
+              const int y = item.get_global_id(0);
+              if (x >= width || y >= height) return;
+
+              float dx_val, dy_val;
+              SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+              maxVal.combine(sycl::max(dx_val, dy_val));
+          });
+    }));
+  }
+
+  ProfileStage("SobelEdges", queue.submit([&u8_image_in_buffer, &u8_edges_out_buffer, &maxBuf, ndRange, width, height, numChannels, constant,
+                haloW, haloH](sycl::handler& h)
+  {
+    auto image = u8_image_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto maxVal = maxBuf.get_access<sycl::access::mode::read>(h);
+    auto out = u8_edges_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+    sycl::local_accessor<float, 1> tile(sycl::range<1>(haloW * haloH), h);
+
+    h.parallel_for(ndRange,
+        [image, maxVal, out, tile, width, height, numChannels, constant](sycl::nd_item<2> item) {
+            LoadLuminanceTile<B>(item, image, tile, width, height, numChannels, constant);
+
+            const int haloW = item.get_local_range(1) + 2;
+            const int lx = item.get_local_id(1);
+            const int ly = item.get_local_id(0);
+            const int x = item.get_global_id(1);
+            const int y = item.get_global_id(0);
+            if (x >= width || y >= height) return;
+
+            float dx_val, dy_val;
+            SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+            float scale = maxVal[0] > 0.0f ? 1.0f / maxVal[0] : 0.0f;
+            dx_val *= scale;
+            dy_val *= scale;
+            // The magnitude can reach sqrt(2), saturate instead of wrapping
+            float magnitude = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
+            out[y * width + x] = static_cast<uint8_t>(sycl::min(magnitude * 255.0f, 255.0f));
+        });
+  }));
+}
+
+/***************************************************************
+ * End to end edge detection: interleaved u8 RGB or RGBA in, u8
+ * Sobel magnitude out. Does ConvertToGrayscaleBuffer, SobelFilter
+ * and ConvertToUint8Buffer in one pass with no full frame float
+ * buffers in between: each work-group converts its tile (plus halo)
+ * to luminance in local memory and computes the edges from there.
+ *
+ * With normalize set the result is scaled by the max gradient like
+ * SobelFilter, which needs a second pass over the input to find it
+ * (~7 bytes of traffic per RGB pixel, against ~40 for the 3 stage
+ * pipeline). Without it the scale is fixed and it is a single pass.
+****************************************************************/
+Result SobelEdgesUint8BufferOrThrow(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 bool normalize, Border border, float constant)
+{
+  return DispatchBorder(border, [&](auto tag) {
+      SobelEdgesUint8Kernels<decltype(tag)::value>(queue, u8_image_in_buffer, u8_edges_out_buffer,
+                                                   width, height, numChannels, normalize, constant);
+      return Result::Ok;
+  });
+}
 
-    queue.submit([&fl_in_buffer, &dy_tmp, width, height](
-                 sycl::handler& h) 
+void SobelEdgesUint8Buffer(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 bool normalize, Border border, float constant)
+{
+  try
+  {
+    Result result = SobelEdgesUint8BufferOrThrow(queue, u8_image_in_buffer, u8_edges_out_buffer,
+                                                 width, height, numChannels, normalize, border, constant);
+    if (result != Result::Ok)
     {
-      auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
-      auto out  = dy_tmp.get_access<sycl::access::mode::discard_write>(h);
-
-      // Create a scratch buffer for the intermediate computation
-      h.parallel_for(sycl::range<2>(width, height),
-                    [data, width, out](sycl::id<2> idx) {
-                        // Convolve horizontally
-                        int offset = idx[1] * width + idx[0];
-                        float left = idx[0] == 0 ? 0 : data[offset - 1];
-                        float right = idx[0] == width - 1 ? 0 : data[offset + 1];
-                        float center = data[offset];
-                        out[offset]  = left + 2 * center + right;
-                      });
-    });
+      cout << "SobelEdgesUint8Buffer: invalid border mode" << std::endl;
+      terminate();
+    }
+  } catch (std::exception const &e) {
+    cout << "SobelEdgesUint8Buffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Kernel of SobelFixedBuffer for border mode B. Same tiling as
+ * SobelEdgesUint8Kernels, but the tile holds u8 fixed point
+ * luminance (a quarter of the local memory) and the gradients are
+ * integers.
+****************************************************************/
+template <Border B>
+static void SobelFixedKernel(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels, int shift, uint8_t constant)
+{
+  const WorkGroupShape tileShape = GetWorkGroupShape(queue, TunedKernel::SobelFixed, width, height);
+  const int tileW = tileShape.x;
+  const int tileH = tileShape.y;
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
+  sycl::nd_range<2> ndRange(sycl::range<2>(((height + tileH - 1) / tileH) * tileH,
+                                           ((width + tileW - 1) / tileW) * tileW),
+                            sycl::range<2>(tileH, tileW));
+
+  ProfileStage("SobelFixed", queue.submit([&u8_image_in_buffer, &u8_edges_out_buffer, ndRange, width, height, numChannels, shift, constant,
+                haloW, haloH](sycl::handler& h)
+  {
+    auto image = u8_image_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto out = u8_edges_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+    sycl::local_accessor<uint8_t, 1> tile(sycl::range<1>(haloW * haloH), h);
+
+    h.parallel_for(ndRange,
+        [image, out, tile, width, height, numChannels, shift, constant](sycl::nd_item<2> item) {
+            const int tileW = item.get_local_range(1);
+            const int tileH = item.get_local_range(0);
+            const int haloW = tileW + 2;
+            const int haloH = tileH + 2;
+            const int x0 = item.get_group(1) * tileW - 1;
+            const int y0 = item.get_group(0) * tileH - 1;
+            for (int i = item.get_local_id(0) * tileW + item.get_local_id(1); i < haloW * haloH;
+                 i += tileW * tileH)
+            {
+              int gx = BorderIndex<B>(x0 + i % haloW, width);
+              int gy = BorderIndex<B>(y0 + i / haloW, height);
+              if (gx < 0 || gy < 0)
+              {
+                tile[i] = constant;   // only for Border::Constant
+                continue;
+              }
+              int offset = numChannels * (gy * width + gx);
+              tile[i] = numChannels >= 3 ? LuminanceFixed(image[offset], image[offset + 1], image[offset + 2])
+                                         : image[offset];
+            }
+            sycl::group_barrier(item.get_group());
+
+            const int lx = item.get_local_id(1);
+            const int ly = item.get_local_id(0);
+            const int x = item.get_global_id(1);
+            const int y = item.get_global_id(0);
+            if (x >= width || y >= height) return;
+
+            int dx_val, dy_val;
+            SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+            out[y * width + x] = SobelMagnitudeFixed(dx_val, dy_val, shift);
+        });
+  }));
+}
+
+/***************************************************************
+ * Integer version of SobelEdgesUint8Buffer, in a single pass. Gives
+ * the same result as SobelFixedCpp.
+****************************************************************/
+Result SobelFixedBufferOrThrow(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 int shift, Border border, uint8_t constant)
+{
+  if (shift < 0 || shift > 15 || numChannels <= 0) return Result::InvalidArgument;
 
-    queue.submit([&dy, &dy_tmp, width, height](sycl::handler& h) 
+  return DispatchBorder(border, [&](auto tag) {
+      SobelFixedKernel<decltype(tag)::value>(queue, u8_image_in_buffer, u8_edges_out_buffer,
+                                             width, height, numChannels, shift, constant);
+      return Result::Ok;
+  });
+}
+
+void SobelFixedBuffer(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &u8_image_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height, int numChannels,
+                 int shift, Border border, uint8_t constant)
+{
+  try
+  {
+    Result result = SobelFixedBufferOrThrow(queue, u8_image_in_buffer, u8_edges_out_buffer,
+                                            width, height, numChannels, shift, border, constant);
+    if (result != Result::Ok)
     {
-      auto data = dy_tmp.get_access<sycl::access::mode::read>(h);
-      auto out  = dy.get_access<sycl::access::mode::discard_write>(h);
-      h.parallel_for(
-          sycl::range<2>(width, height),
-          [data, width, height, out](sycl::id<2> idx) {
-              // Convolve vertically
-              int offset = idx[1] * width + idx[0];
-              float up   = idx[1] == 0 ? 0 : data[offset - width];
-              float down = idx[1] == height - 1 ? 0 : data[offset + width];
-              out[offset] = up - down;
-          });
-    });
+      cout << "SobelFixedBuffer: invalid argument" << std::endl;
+      terminate();
+    }
+  } catch (std::exception const &e) {
+    cout << "SobelFixedBuffer exception: " << e.what() << std::endl;
+    terminate();
   }
-  #if 1
-  
-  // Notice that the above vertical and horizontal gradients have no dependence 
-  // on one another, so SYCL may execute them in parallel.
+}
 
-  // For each pixel, we can have the gradient projected on the x and y axes, 
-  // so it's a simple matter to compute the magnitude of the gradient.
-  queue.submit([&dx, &dy, width, height, &fl_out_buffer](sycl::handler& h) {
-      auto dx_data = dx.get_access<sycl::access::mode::read>(h);
-      auto dy_data = dy.get_access<sycl::access::mode::read>(h);
-      auto fl_out = fl_out_buffer.get_access<sycl::access::mode::write>(h);
+/***************************************************************
+ * Canny step 2: non-maximum suppression and double threshold of the
+ * normalized magnitude, with the orientation from the raw gradients
+ * that SobelFilter left in the context's scratch memory.
+****************************************************************/
+template <typename T>
+static sycl::event CannyClassifyKernel(sycl::queue &queue,
+                 sycl::buffer<float, 1> &mag_buffer,
+                 sycl::buffer<uint8_t, 1> &state_buffer,
+                 const T *dx, const T *dy, int width, int height,
+                 float lowThreshold, float highThreshold, sycl::event gradientsDone)
+{
+  WorkGroupShape shape = GetWorkGroupShape(queue, TunedKernel::CannyClassify, width, height);
+  return ProfileStage("CannyClassify", queue.submit([&mag_buffer, &state_buffer, dx, dy, width, height, lowThreshold, highThreshold,
+                       gradientsDone, shape](sycl::handler& h)
+  {
+    h.depends_on(gradientsDone);
+    auto mag = mag_buffer.get_access<sycl::access::mode::read>(h);
+    auto state = state_buffer.get_access<sycl::access::mode::discard_write>(h);
 
-      h.parallel_for(sycl::range<1>(width * height),
-          [dx_data, dy_data, fl_out](sycl::id<1> idx) {
-              float dx_val = dx_data[idx[0]];
-              float dy_val = dy_data[idx[0]];
-              // NOTE: if deploying to an accelerated device, math
-              // functions MUST be used from the sycl namespace
-              fl_out[idx[0]] = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
-      });
+    ParallelFor2D(h, shape, height, width,
+        [mag, state, dx, dy, width, height, lowThreshold, highThreshold](int y, int x) {
+            int i = y * width + x;
+            state[i] = CannyClassify(mag, x, y, width, height, static_cast<float>(dx[i]),
+                                     static_cast<float>(dy[i]), lowThreshold, highThreshold);
+        });
+  }));
+}
+
+/***************************************************************
+ * Canny step 3, one round of hysteresis: weak pixels connected to a
+ * strong one become strong. Each work-group loads its tile plus a one
+ * pixel halo into local memory and propagates inside the tile until
+ * nothing changes, so a round crosses a whole tile instead of one
+ * pixel. Reads src and writes dst, so rounds never race with each
+ * other. changed[0] is set if any pixel was promoted.
+****************************************************************/
+static void CannyHysteresisRound(sycl::queue &queue,
+                 sycl::buffer<uint8_t, 1> &src_buffer,
+                 sycl::buffer<uint8_t, 1> &dst_buffer,
+                 sycl::buffer<int, 1> &changed_buffer,
+                 int width, int height)
+{
+  const WorkGroupShape tileShape = GetWorkGroupShape(queue, TunedKernel::CannyHysteresis, width, height);
+  const int tileW = tileShape.x;
+  const int tileH = tileShape.y;
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
+  sycl::nd_range<2> ndRange(sycl::range<2>(((height + tileH - 1) / tileH) * tileH,
+                                           ((width + tileW - 1) / tileW) * tileW),
+                            sycl::range<2>(tileH, tileW));
+
+  ProfileStage("CannyHysteresis", queue.submit([&src_buffer, &dst_buffer, &changed_buffer, ndRange, width, height, haloW, haloH](sycl::handler& h)
+  {
+    auto src = src_buffer.get_access<sycl::access::mode::read>(h);
+    auto dst = dst_buffer.get_access<sycl::access::mode::discard_write>(h);
+    auto changed = changed_buffer.get_access<sycl::access::mode::read_write>(h);
+    sycl::local_accessor<uint8_t, 1> tile(sycl::range<1>(haloW * haloH), h);
+
+    h.parallel_for(ndRange, [src, dst, changed, tile, width, height](sycl::nd_item<2> item) {
+        const int tileW = item.get_local_range(1);
+        const int tileH = item.get_local_range(0);
+        const int haloW = tileW + 2;
+        const int haloH = tileH + 2;
+        auto group = item.get_group();
+        const int x0 = item.get_group(1) * tileW - 1;
+        const int y0 = item.get_group(0) * tileH - 1;
+        for (int i = item.get_local_id(0) * tileW + item.get_local_id(1); i < haloW * haloH;
+             i += tileW * tileH)
+        {
+          int gx = x0 + i % haloW;
+          int gy = y0 + i / haloW;
+          bool inside = gx >= 0 && gx < width && gy >= 0 && gy < height;
+          tile[i] = inside ? src[gy * width + gx] : static_cast<uint8_t>(CANNY_NONE);
+        }
+        sycl::group_barrier(group);
+
+        const int x = item.get_global_id(1);
+        const int y = item.get_global_id(0);
+        const bool inside = x < width && y < height;
+        const int c = (item.get_local_id(0) + 1) * haloW + item.get_local_id(1) + 1;
+
+        // Every work-item stays in the loop, any_of_group is a collective
+        bool groupChanged = false;
+        for (;;)
+        {
+          bool promote = inside && tile[c] == CANNY_WEAK && CannyHasStrongNeighbour(tile, c, haloW);
+          sycl::group_barrier(group);
+          if (promote) tile[c] = CANNY_STRONG;
+          if (!sycl::any_of_group(group, promote)) break;
+          groupChanged = true;
+          // any_of_group is not a local memory fence: make the promotions
+          // visible before the next round reads the neighbours
+          sycl::group_barrier(group);
+        }
+
+        if (inside) dst[y * width + x] = tile[c];
+        if (groupChanged && item.get_local_linear_id() == 0)
+        {
+          sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device,
+                           sycl::access::address_space::global_space> flag(changed[0]);
+          flag.store(1);
+        }
+    });
+  }));
+}
+
+/***************************************************************
+ * Canny edge detection on the device, built on SobelFilter:
+ *
+ * 1. Gaussian pre-blur (GaussianBlurBuffer), skipped if sigma is 0
+ * 2. SobelFilter with Border::Clamp: its normalized magnitude, and
+ *    the raw dx and dy it leaves in the context for the orientation
+ * 3. Non-maximum suppression and double threshold (CannyClassify)
+ * 4. Hysteresis in rounds of CannyHysteresisRound until no pixel
+ *    changes. Only the one int flag comes back to the host per round.
+ *
+ * All intermediates are device buffers without host memory, so the
+ * only transfer is the u8 result: 255 on edges, 0 elsewhere.
+ * The thresholds apply to the normalized magnitude, 0 ... ~1.41.
+****************************************************************/
+Result CannyBufferOrThrow(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 float sigma, float lowThreshold, float highThreshold)
+{
+  if (sigma < 0.0f || lowThreshold < 0.0f || highThreshold < lowThreshold) return Result::InvalidArgument;
+
+  sycl::queue &queue = ctx.Queue();
+  const int width = ctx.Width();
+  const int height = ctx.Height();
+  const size_t numPixels = static_cast<size_t>(width) * height;
+
+  sycl::buffer<float, 1> blurred_buffer{numPixels};
+  sycl::buffer<float, 1> mag_buffer{numPixels};
+  sycl::buffer<uint8_t, 1> state_buffer{numPixels};
+  sycl::buffer<uint8_t, 1> state2_buffer{numPixels};
+  sycl::buffer<int, 1> changed_buffer{1};
+
+  sycl::buffer<float, 1> *sobel_in = &fl_in_buffer;
+  if (sigma > 0.0f)
+  {
+    GaussianBlurBufferOrThrow(queue, fl_in_buffer, blurred_buffer, width, height, sigma, Border::Clamp, 0.0f);
+    sobel_in = &blurred_buffer;
+  }
+  SobelFilter(ctx, *sobel_in, mag_buffer, Border::Clamp);
+
+  Result result = DispatchStorage(ctx.Precision(), [&](auto storage) {
+      using T = decltype(storage);
+      ctx.lastUse_ = CannyClassifyKernel<T>(queue, mag_buffer, state_buffer,
+                          static_cast<const T *>(ctx.dx_), static_cast<const T *>(ctx.dy_),
+                          width, height, lowThreshold, highThreshold, ctx.lastUse_);
+      return Result::Ok;
   });
-  
-  #endif
+  if (result != Result::Ok) return result;
+
+  sycl::buffer<uint8_t, 1> *src = &state_buffer;
+  sycl::buffer<uint8_t, 1> *dst = &state2_buffer;
+  for (;;)
+  {
+    ProfileStage("CannyResetChanged", queue.submit([&changed_buffer](sycl::handler& h) {
+      sycl::accessor changed(changed_buffer, h, sycl::write_only, sycl::no_init);
+      h.fill(changed, 0);
+    }));
+    CannyHysteresisRound(queue, *src, *dst, changed_buffer, width, height);
+    std::swap(src, dst);
+    sycl::host_accessor changed(changed_buffer, sycl::read_only);
+    if (changed[0] == 0) break;
+  }
+
+  ProfileStage("CannyEdges", queue.submit([src, &u8_edges_out_buffer, numPixels](sycl::handler& h) {
+    auto state = src->get_access<sycl::access::mode::read>(h);
+    auto out = u8_edges_out_buffer.get_access<sycl::access::mode::discard_write>(h);
+    h.parallel_for(sycl::range<1>(numPixels), [state, out](sycl::id<1> idx) {
+        out[idx[0]] = state[idx[0]] == CANNY_STRONG ? 255 : 0;
+    });
+  }));
+  return Result::Ok;
+}
+
+Result CannyBuffer(SobelContext &ctx,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 float sigma, float lowThreshold, float highThreshold)
+{
+  try
+  {
+    return CannyBufferOrThrow(ctx, fl_in_buffer, u8_edges_out_buffer, sigma, lowThreshold, highThreshold);
+  } catch (std::exception const &e) {
+    cout << "CannyBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * One shot version of the above. It waits for the hysteresis
+ * rounds, but not for the final kernel or the scratch memory.
+****************************************************************/
+Result CannyBuffer(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_edges_out_buffer,
+                 int width, int height,
+                 float sigma, float lowThreshold, float highThreshold)
+{
+  SobelContext ctx(queue, width, height);
+  return CannyBuffer(ctx, fl_in_buffer, u8_edges_out_buffer, sigma, lowThreshold, highThreshold);
+}
+
+/***************************************************************
+ * Kernel of SobelMagnitudeOrientationBuffer for border mode B.
+ * SobelFilterFused with a second output: the orientation bin of
+ * each pixel is taken from the same dx and dy as its magnitude.
+ * It uses the fused kernel's tuned tile.
+****************************************************************/
+template <Border B>
+static void SobelMagnitudeOrientationKernel(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_magnitude_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_orientation_buffer,
+                 int width, int height, int numBins, float constant)
+{
+  const WorkGroupShape tileShape = GetWorkGroupShape(queue, TunedKernel::SobelFused, width, height);
+  const int tileW = tileShape.x;
+  const int tileH = tileShape.y;
+  const int haloW = tileW + 2;
+  const int haloH = tileH + 2;
+  sycl::nd_range<2> ndRange(sycl::range<2>(((height + tileH - 1) / tileH) * tileH,
+                                           ((width + tileW - 1) / tileW) * tileW),
+                            sycl::range<2>(tileH, tileW));
+
+  sycl::buffer<float, 1> maxBuf{1};
+  ProfileStage("SobelOrientationMaxInit", queue.submit([&maxBuf](sycl::handler& h) {
+    sycl::accessor maxVal(maxBuf, h, sycl::write_only, sycl::no_init);
+    h.fill(maxVal, 0.0f);
+  }));
+
+  ProfileStage("SobelMagnitudeOrientation", queue.submit([&fl_in_buffer, &fl_magnitude_buffer, &u8_orientation_buffer,
+                &maxBuf, ndRange, width, height, numBins, constant, haloW, haloH](sycl::handler& h)
+  {
+    auto data = fl_in_buffer.get_access<sycl::access::mode::read>(h);
+    auto mag  = fl_magnitude_buffer.get_access<sycl::access::mode::discard_write>(h);
+    auto orientation = u8_orientation_buffer.get_access<sycl::access::mode::discard_write>(h);
+    sycl::local_accessor<float, 1> tile(sycl::range<1>(haloW * haloH), h);
+    auto maxReduction = sycl::reduction(maxBuf, h, sycl::maximum<float>());
+
+    h.parallel_for(ndRange, maxReduction,
+        [data, mag, orientation, tile, width, height, numBins, constant](sycl::nd_item<2> item, auto &maxVal) {
+            const int tileW = item.get_local_range(1);
+            const int tileH = item.get_local_range(0);
+            const int haloW = tileW + 2;
+            const int haloH = tileH + 2;
+            const int lx = item.get_local_id(1);
+            const int ly = item.get_local_id(0);
+            const int x0 = item.get_group(1) * tileW - 1;
+            const int y0 = item.get_group(0) * tileH - 1;
+
+            for (int i = ly * tileW + lx; i < haloW * haloH; i += tileW * tileH)
+            {
+                tile[i] = BorderFetch<B>(data, x0 + i % haloW, y0 + i / haloW, width, height, width, constant);
+            }
+            sycl::group_barrier(item.get_group());
+
+            const int x = x0 + 1 + lx;
+            const int y = y0 + 1 + ly;
+            if (x >= width || y >= height) return;
+
+            float dx_val, dy_val;
+            SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+            mag[y * width + x] = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
+            orientation[y * width + x] = QuantizeOrientation(dx_val, dy_val, numBins);
+            maxVal.combine(sycl::max(dx_val, dy_val));
+        });
+  }));
+
+  ScaleImgBuffer(queue, fl_magnitude_buffer, maxBuf, width, height);
+}
+
+Result SobelMagnitudeOrientationBuffer(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_in_buffer,
+                 sycl::buffer<float, 1> &fl_magnitude_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_orientation_buffer,
+                 int width, int height, int numBins,
+                 Border border, float constant)
+{
+  if (width <= 0 || height <= 0 || numBins <= 0 || numBins > 255) return Result::InvalidArgument;
+
+  try
+  {
+    return DispatchBorder(border, [&](auto tag) {
+        SobelMagnitudeOrientationKernel<decltype(tag)::value>(queue, fl_in_buffer, fl_magnitude_buffer,
+                                                              u8_orientation_buffer, width, height,
+                                                              numBins, constant);
+        return Result::Ok;
+    });
+  } catch (std::exception const &e) {
+    cout << "SobelMagnitudeOrientationBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * HOG on the device in two kernels. One work-group per cell sums
+ * the magnitudes of its pixels into a histogram in local memory
+ * with work-group scope atomics, then writes it out once. One
+ * work-item per block then normalizes the block with
+ * HogNormalizeBlock, the same code as HogCpp.
+****************************************************************/
+Result HogBuffer(sycl::queue &queue,
+                 sycl::buffer<float, 1> &fl_magnitude_buffer,
+                 sycl::buffer<uint8_t, 1> &u8_orientation_buffer,
+                 sycl::buffer<float, 1> &fl_descriptor_buffer,
+                 int width, int height, const HogOptions &options)
+{
+  const size_t size = HogDescriptorSize(width, height, options);
+  if (width <= 0 || height <= 0 || !HogOptionsValid(options) || size == 0 ||
+      fl_descriptor_buffer.size() < size)
+  {
+    return Result::InvalidArgument;
+  }
+  const int cellSize = options.cellSize;
+  if (static_cast<size_t>(cellSize) * cellSize >
+      queue.get_device().get_info<sycl::info::device::max_work_group_size>())
+  {
+    return Result::InvalidArgument;
+  }
+
+  const int numBins = options.numBins;
+  const int blockSize = options.blockSize;
+  const float clip = options.clip;
+  const int cellsX = width / cellSize;
+  const int cellsY = height / cellSize;
+  const int blocksX = HogBlocksX(width, options);
+  const int blocksY = HogBlocksY(height, options);
+  const int blockLength = blockSize * blockSize * numBins;
+
+  try
+  {
+    sycl::buffer<float, 1> cells_buffer{static_cast<size_t>(cellsX) * cellsY * numBins};
+
+    ProfileStage("HogCells", queue.submit([&fl_magnitude_buffer, &u8_orientation_buffer, &cells_buffer, width,
+                  cellSize, cellsX, cellsY, numBins](sycl::handler& h)
+    {
+      auto mag = fl_magnitude_buffer.get_access<sycl::access::mode::read>(h);
+      auto orientation = u8_orientation_buffer.get_access<sycl::access::mode::read>(h);
+      sycl::accessor cells(cells_buffer, h, sycl::write_only, sycl::no_init);
+      sycl::local_accessor<float, 1> hist(sycl::range<1>(numBins), h);
+
+      h.parallel_for(sycl::nd_range<2>(sycl::range<2>(cellsY * cellSize, cellsX * cellSize),
+                                       sycl::range<2>(cellSize, cellSize)),
+          [mag, orientation, cells, hist, width, cellsX, numBins](sycl::nd_item<2> item) {
+              const int lid = item.get_local_linear_id();
+              const int localSize = item.get_local_range(0) * item.get_local_range(1);
+              for (int b = lid; b < numBins; b += localSize) hist[b] = 0.0f;
+              sycl::group_barrier(item.get_group());
+
+              const size_t i = item.get_global_id(0) * width + item.get_global_id(1);
+              const int bin = sycl::min(static_cast<int>(orientation[i]), numBins - 1);
+              sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::work_group,
+                               sycl::access::address_space::local_space> binRef(hist[bin]);
+              binRef.fetch_add(mag[i]);
+              sycl::group_barrier(item.get_group());
+
+              const size_t cell = item.get_group(0) * cellsX + item.get_group(1);
+              for (int b = lid; b < numBins; b += localSize) cells[cell * numBins + b] = hist[b];
+          });
+    }));
+
+    ProfileStage("HogBlocks", queue.submit([&cells_buffer, &fl_descriptor_buffer, blocksX, blocksY, cellsX,
+                  blockSize, numBins, blockLength, clip](sycl::handler& h)
+    {
+      sycl::accessor cells(cells_buffer, h, sycl::read_only);
+      // Read back while normalizing, but nothing from before is kept
+      sycl::accessor descriptor(fl_descriptor_buffer, h, sycl::read_write, sycl::no_init);
+      ParallelFor2D(h, WorkGroupShape(), blocksY, blocksX,
+          [cells, descriptor, blocksX, cellsX, blockSize, numBins, blockLength, clip](int by, int bx) {
+              HogNormalizeBlock(cells, descriptor, (static_cast<size_t>(by) * blocksX + bx) * blockLength,
+                                bx, by, cellsX, blockSize, numBins, clip);
+          });
+    }));
+    return Result::Ok;
+  } catch (std::exception const &e) {
+    cout << "HogBuffer exception: " << e.what() << std::endl;
+    terminate();
+  }
 }
@@ -1,10 +1,26 @@
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include "imageUtilsAgnostic.h"
 #include "imageUtilsUsingCpp.h"
+#include "imageUtilsSimdCpp.h"
+#include "floatStorage.h"
+#include "memoryPool.h"
 
 using namespace std;
 
+// Keep multiplies and adds separate and in source order, as in
+// imageUtilsSimdCpp.cpp, so the scalar, SIMD and stencil paths give the
+// same results under a fast floating point model
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#pragma clang fp reassociate(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
 /***************************************************************
  * 
  ****************************************************************/
@@ -52,6 +68,54 @@ void ComputeMagnitudeCpp(
     }  
 }
 
+/***************************************************************
+ * Each band finds its own max, then the band maxima are combined.
+ * Max doesn't depend on the order, so this is exactly FindMaxCpp.
+ ****************************************************************/
+float FindMaxCpp(ThreadPool &pool, const float *fl_image_in, // input const
+                      int width, int height)
+{
+    int numBands = (height + HOST_BAND_ROWS - 1) / HOST_BAND_ROWS;
+    vector<float> bandMax(numBands, 0.0f);
+    pool.ParallelFor(height, HOST_BAND_ROWS, [&](int y0, int y1) {
+        bandMax[y0 / HOST_BAND_ROWS] = FindMaxCpp(fl_image_in + y0 * width, width, y1 - y0);
+    });
+    return FindMaxCpp(bandMax.data(), numBands, 1);
+}
+
+/***************************************************************
+ * 
+ ****************************************************************/
+void ScaleImgCpp(ThreadPool &pool,
+                      const float *fl_image_in, // input const
+                            float *fl_image_out, // output
+                      int width, int height, 
+                      float scale)
+{
+    pool.ParallelFor(height, HOST_BAND_ROWS, [&](int y0, int y1) {
+        ScaleImgCpp(fl_image_in + y0 * width, fl_image_out + y0 * width, width, y1 - y0, scale);
+    });
+}
+
+/***************************************************************
+ * 
+ ****************************************************************/
+void ComputeMagnitudeCpp(ThreadPool &pool,
+                      const float *fl_image_in0, // input const
+                      const float *fl_image_in1, // input const
+                      vector<float> &fl_image_out, // output
+                      int width, int height)
+{
+    pool.ParallelFor(height, HOST_BAND_ROWS, [&](int y0, int y1) {
+        for(int idx = y0 * width; idx < (y1 * width); idx++)
+        {
+            float i0 = fl_image_in0[idx];
+            float i1 = fl_image_in1[idx];
+            fl_image_out[idx] = sqrtf(i0 * i0 + i1 * i1);
+        }
+    });
+}
+
 /***************************************************************
  * 
  ****************************************************************/
@@ -62,7 +126,9 @@ void ConvertToGrayscaleCpp(
 {
   try
   {  
-      for(int idx = 0; idx < (width * height); idx++)
+      // The SIMD converter takes RGB and RGBA, the scalar loop the rest
+      int idx = ConvertToGrayscaleRowSimd(fl_gray.data(), u8_image_in, numChannels, width * height);
+      for(; idx < (width * height); idx++)
       {
         int offset   = numChannels * idx;
         fl_gray[idx] = luminance(u8_image_in[offset],
@@ -95,77 +161,643 @@ void ConvertToUint8Cpp(
   }
 }
 /***************************************************************
- * 
+ * One output pixel with the taps read through border mode B. Only
+ * used on the outer ring of the image.
+ ****************************************************************/
+template <Border B>
+static inline float Convolution3x3PixelBorder(const float* pIn, const float* pFilter, 
+                      int x, int y, int sx, int sy, int pitch, float constant)
+{
+    float value = 0.0f;
+    int cIdx = 0;
+    for (int l = -1; l <= 1; l++)  // filter row
+    {
+        for (int k = -1; k <= 1; k++)  // filter col
+        {
+            float v = BorderFetch<B>(pIn, x + k, y + l, sx, sy, pitch, constant);
+            float c = pFilter[cIdx++];
+            value += v * c;
+        }
+    }
+    return value;
+}
+
+/***************************************************************
+ * One output pixel whose taps are all inside the image.
+ ****************************************************************/
+static inline float Convolution3x3PixelInterior(const float* pIn, const float* pFilter, 
+                      int x, int y, int pitch)
+{
+    float value = 0.0f;
+    int cIdx = 0;
+    for (int l = -1; l <= 1; l++)  // filter row
+    {
+        for (int k = -1; k <= 1; k++)  // filter col
+        {
+            float v = pIn[(y + l) * pitch + x + k];
+            float c = pFilter[cIdx++];
+            value += v * c;
+        }
+    }
+    return value;
+}
+
+/***************************************************************
+ * Border mode specialization of Convolution3x3Cpp for output rows
+ * [y0, y1), so bands of rows can run on different threads. The
+ * interior of each row is handed to the SIMD kernels (8 or 16 pixels at a time)
+ * and only the outer ring runs the border logic. Both accumulate the
+ * taps in the same order, so the result doesn't depend on the SIMD
+ * level.
+ ****************************************************************/
+template <Border B>
+static void Convolution3x3RowCpp(float* pOutRow, const float* pIn, const float* pFilter, 
+                      int y, int sx, int sy, int pitch, float constant)
+{
+    if (y == 0 || y == sy - 1 || sx < 3)
+    {
+        for (int x = 0; x < sx; x++)
+        {
+            pOutRow[x] = Convolution3x3PixelBorder<B>(pIn, pFilter, x, y, sx, sy, pitch, constant);
+        }
+        return;
+    }
+
+    pOutRow[0] = Convolution3x3PixelBorder<B>(pIn, pFilter, 0, y, sx, sy, pitch, constant);
+    int x = Convolution3x3RowSimd(pOutRow, pIn + (y - 1) * pitch, pIn + y * pitch,
+                                  pIn + (y + 1) * pitch, pFilter, 1, sx - 1);
+    for (; x < sx - 1; x++)
+    {
+        pOutRow[x] = Convolution3x3PixelInterior(pIn, pFilter, x, y, pitch);
+    }
+    pOutRow[sx - 1] = Convolution3x3PixelBorder<B>(pIn, pFilter, sx - 1, y, sx, sy, pitch, constant);
+}
+
+template <Border B>
+static Result Convolution3x3BorderCpp(float* pOut, const float* pIn, const float* pFilter, 
+                      int sx, int sy, int pitch, float constant, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        Convolution3x3RowCpp<B>(pOut + y * pitch, pIn, pFilter, y, sx, sy, pitch, constant);
+    }
+    return Result::Ok;
+}
+
+/***************************************************************
+ * The border mode is resolved once here, not per tap.
  ****************************************************************/
 Result Convolution3x3Cpp(float* pOut, const float* pIn, const float* pFilter, 
-                      int sx, int sy, int pitch, Border border)
+                      int sx, int sy, int pitch, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr || pFilter == nullptr) return InvalidArgument;
+
+    return DispatchBorder(border, [&](auto tag) {
+        return Convolution3x3BorderCpp<decltype(tag)::value>(pOut, pIn, pFilter, sx, sy, pitch,
+                                                             constant, 0, sy);
+    });
+}
+
+/***************************************************************
+ * Multithreaded version of the above, bands of HOST_BAND_ROWS rows
+ * run on the pool. Gives the same result as the single threaded one.
+ ****************************************************************/
+Result Convolution3x3Cpp(ThreadPool &pool, float* pOut, const float* pIn, const float* pFilter, 
+                      int sx, int sy, int pitch, Border border, float constant)
 {
     if (pOut == nullptr || pIn == nullptr || pFilter == nullptr) return InvalidArgument;
 
-    for (int y = 0; y < sy; y++)
+    return DispatchBorder(border, [&](auto tag) {
+        pool.ParallelFor(sy, HOST_BAND_ROWS, [&](int y0, int y1) {
+            Convolution3x3BorderCpp<decltype(tag)::value>(pOut, pIn, pFilter, sx, sy, pitch,
+                                                          constant, y0, y1);
+        });
+        return Result::Ok;
+    });
+}
+
+// Single channel images of the same size, so they share a pitch
+static bool IsFilterPair(const Image<float> &out, const Image<float> &in)
+{
+    return !in.Empty() && !out.Empty() && in.Channels() == 1 && out.Channels() == 1 &&
+           in.Width() == out.Width() && in.Height() == out.Height();
+}
+
+/***************************************************************
+ * Image versions of the above, rows Pitch() apart.
+ ****************************************************************/
+Result Convolution3x3Cpp(Image<float> &out, const Image<float> &in, const float* pFilter,
+                      Border border, float constant)
+{
+    if (!IsFilterPair(out, in)) return InvalidArgument;
+    return Convolution3x3Cpp(out.Data(), in.Data(), pFilter, in.Width(), in.Height(),
+                             static_cast<int>(in.Pitch()), border, constant);
+}
+
+Result Convolution3x3Cpp(ThreadPool &pool, Image<float> &out, const Image<float> &in, const float* pFilter,
+                      Border border, float constant)
+{
+    if (!IsFilterPair(out, in)) return InvalidArgument;
+    return Convolution3x3Cpp(pool, out.Data(), in.Data(), pFilter, in.Width(), in.Height(),
+                             static_cast<int>(in.Pitch()), border, constant);
+}
+
+/***************************************************************
+ * Convolution3x3RowCpp with the coefficients of the Stencil3x3 S
+ * fixed at compile time, for output row y.
+ ****************************************************************/
+template <typename S, Border B>
+static void StencilRowCpp(float* pOutRow, const float* pIn,
+                      int y, int sx, int sy, int pitch, float constant)
+{
+    auto borderPixel = [&](int x) {
+        return S::template Apply<float>([&](int k, int l) {
+            return BorderFetch<B>(pIn, x + k, y + l, sx, sy, pitch, constant);
+        });
+    };
+    if (y == 0 || y == sy - 1 || sx < 3)
+    {
+        for (int x = 0; x < sx; x++) pOutRow[x] = borderPixel(x);
+        return;
+    }
+
+    const float* pUp = pIn + (y - 1) * pitch;
+    const float* pMid = pIn + y * pitch;
+    const float* pDown = pIn + (y + 1) * pitch;
+    const float* rows[3] = {pUp, pMid, pDown};
+    pOutRow[0] = borderPixel(0);
+    int x = StencilRowSimd<S>(pOutRow, pUp, pMid, pDown, 1, sx - 1);
+    for (; x < sx - 1; x++)
+    {
+        pOutRow[x] = S::template Apply<float>([&](int k, int l) { return rows[l + 1][x + k]; });
+    }
+    pOutRow[sx - 1] = borderPixel(sx - 1);
+}
+
+template <typename S, Border B>
+static void StencilBorderCpp(float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, float constant, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        StencilRowCpp<S, B>(pOut + y * pitch, pIn, y, sx, sy, pitch, constant);
+    }
+}
+
+/***************************************************************
+ * 
+ ****************************************************************/
+template <typename S>
+Result StencilCpp(float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr) return InvalidArgument;
+
+    return DispatchBorder(border, [&](auto tag) {
+        StencilBorderCpp<S, decltype(tag)::value>(pOut, pIn, sx, sy, pitch, constant, 0, sy);
+        return Result::Ok;
+    });
+}
+
+template <typename S>
+Result StencilCpp(ThreadPool &pool, float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr) return InvalidArgument;
+
+    return DispatchBorder(border, [&](auto tag) {
+        pool.ParallelFor(sy, HOST_BAND_ROWS, [&](int y0, int y1) {
+            StencilBorderCpp<S, decltype(tag)::value>(pOut, pIn, sx, sy, pitch, constant, y0, y1);
+        });
+        return Result::Ok;
+    });
+}
+
+#define INSTANTIATE_STENCIL_CPP(S) \
+    template Result StencilCpp<S>(float*, const float*, int, int, int, Border, float); \
+    template Result StencilCpp<S>(ThreadPool&, float*, const float*, int, int, int, Border, float);
+
+INSTANTIATE_STENCIL_CPP(SobelXStencil)
+INSTANTIATE_STENCIL_CPP(SobelYStencil)
+INSTANTIATE_STENCIL_CPP(ScharrXStencil)
+INSTANTIATE_STENCIL_CPP(ScharrYStencil)
+INSTANTIATE_STENCIL_CPP(PrewittXStencil)
+INSTANTIATE_STENCIL_CPP(PrewittYStencil)
+INSTANTIATE_STENCIL_CPP(LaplacianStencil)
+#undef INSTANTIATE_STENCIL_CPP
+
+/***************************************************************
+ * Horizontal 1D pass over one row: pOut[x] = sum k[i] * pIn[x + i - r].
+ * The interior accumulates one tap at a time over the whole run of
+ * pixels so the compiler can vectorize it; only the r pixels at each
+ * end go through the border mode.
+ ****************************************************************/
+template <Border B>
+static void SeparableRowCpp(float* pOut, const float* pIn, const float* pKernel, int kSize,
+                      int sx, float constant)
+{
+    const int r = kSize / 2;
+    const int xBegin = std::min(r, sx);
+    const int xEnd = std::max(xBegin, sx - r);
+
+    for (int x = 0; x < sx; x++) pOut[x] = 0.0f;
+
+    for (int i = 0; i < kSize; i++)
+    {
+        const float c = pKernel[i];
+        for (int x = 0; x < xBegin; x++)
+        {
+            pOut[x] += c * BorderFetch<B>(pIn, x + i - r, 0, sx, 1, 0, constant);
+        }
+        const float* pTap = pIn + i - r;
+        for (int x = xBegin; x < xEnd; x++)
+        {
+            pOut[x] += c * pTap[x];
+        }
+        for (int x = xEnd; x < sx; x++)
+        {
+            pOut[x] += c * BorderFetch<B>(pIn, x + i - r, 0, sx, 1, 0, constant);
+        }
+    }
+}
+
+/***************************************************************
+ * Vertical 1D pass for output row y: a weighted sum of whole rows.
+ * Rows outside the image come from the border mode. For
+ * Border::Constant they are the horizontal kernel applied to a
+ * constant row, i.e. rowConstant = constant * sum(kernelX).
+ ****************************************************************/
+template <Border B>
+static void SeparableColumnCpp(float* pOut, const float* pTmp, const float* pKernel, int kSize,
+                      int sx, int sy, int pitch, int y, float rowConstant)
+{
+    const int r = kSize / 2;
+    for (int x = 0; x < sx; x++) pOut[x] = 0.0f;
+
+    for (int i = 0; i < kSize; i++)
     {
+        const float c = pKernel[i];
+        int yi = BorderIndex<B>(y + i - r, sy);
+        if (yi < 0)
+        {
+            for (int x = 0; x < sx; x++) pOut[x] += c * rowConstant;
+            continue;
+        }
+        const float* pRow = pTmp + yi * pitch;
         for (int x = 0; x < sx; x++)
         {
-            float value = 0.0f;
-            int cIdx = 0;
-            switch (border)
+            pOut[x] += c * pRow[x];
+        }
+    }
+}
+
+static bool IsValidSeparableKernel(const float* pKernel, int kSize)
+{
+    return pKernel != nullptr && kSize > 0 && (kSize & 1) == 1;
+}
+
+template <Border B>
+static void SeparableFilterRowsCpp(float* pTmp, const float* pIn, const float* pKernelX, int kxSize,
+                      int sx, int pitch, float constant, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        SeparableRowCpp<B>(pTmp + y * pitch, pIn + y * pitch, pKernelX, kxSize, sx, constant);
+    }
+}
+
+template <Border B>
+static void SeparableFilterColumnsCpp(float* pOut, const float* pTmp, const float* pKernelY, int kySize,
+                      int sx, int sy, int pitch, float rowConstant, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        SeparableColumnCpp<B>(pOut + y * pitch, pTmp, pKernelY, kySize, sx, sy, pitch, y, rowConstant);
+    }
+}
+
+/***************************************************************
+ * Separable filter: the horizontal kernel is applied to every row,
+ * then the vertical kernel to every column of the result. Costs
+ * kxSize + kySize multiply-adds per pixel instead of kxSize * kySize.
+ ****************************************************************/
+Result SeparableFilterCpp(float* pOut, const float* pIn,
+                      const float* pKernelX, int kxSize,
+                      const float* pKernelY, int kySize,
+                      int sx, int sy, int pitch, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr || pOut == pIn) return InvalidArgument;
+    if (!IsValidSeparableKernel(pKernelX, kxSize) || !IsValidSeparableKernel(pKernelY, kySize))
+        return InvalidArgument;
+
+    float sumKx = 0.0f;
+    for (int i = 0; i < kxSize; i++) sumKx += pKernelX[i];
+
+    vector<float> tmp(static_cast<size_t>(sy) * pitch);
+    return DispatchBorder(border, [&](auto tag) {
+        constexpr Border B = decltype(tag)::value;
+        SeparableFilterRowsCpp<B>(tmp.data(), pIn, pKernelX, kxSize, sx, pitch, constant, 0, sy);
+        SeparableFilterColumnsCpp<B>(pOut, tmp.data(), pKernelY, kySize, sx, sy, pitch,
+                                     constant * sumKx, 0, sy);
+        return Result::Ok;
+    });
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result SeparableFilterCpp(ThreadPool &pool, float* pOut, const float* pIn,
+                      const float* pKernelX, int kxSize,
+                      const float* pKernelY, int kySize,
+                      int sx, int sy, int pitch, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr || pOut == pIn) return InvalidArgument;
+    if (!IsValidSeparableKernel(pKernelX, kxSize) || !IsValidSeparableKernel(pKernelY, kySize))
+        return InvalidArgument;
+
+    float sumKx = 0.0f;
+    for (int i = 0; i < kxSize; i++) sumKx += pKernelX[i];
+
+    vector<float> tmp(static_cast<size_t>(sy) * pitch);
+    return DispatchBorder(border, [&](auto tag) {
+        constexpr Border B = decltype(tag)::value;
+        pool.ParallelFor(sy, HOST_BAND_ROWS, [&](int y0, int y1) {
+            SeparableFilterRowsCpp<B>(tmp.data(), pIn, pKernelX, kxSize, sx, pitch, constant, y0, y1);
+        });
+        // The vertical pass needs the rows above and below each band
+        pool.ParallelFor(sy, HOST_BAND_ROWS, [&](int y0, int y1) {
+            SeparableFilterColumnsCpp<B>(pOut, tmp.data(), pKernelY, kySize, sx, sy, pitch,
+                                         constant * sumKx, y0, y1);
+        });
+        return Result::Ok;
+    });
+}
+
+/***************************************************************
+ * Fixed tap horizontal Gaussian pass over one row. pCoeff holds the
+ * R + 1 weights from the center out; the kernel is symmetric, so the
+ * two taps at distance i share one multiply.
+ ****************************************************************/
+template <Border B, int R>
+static void GaussianRowFixedCpp(float* pOut, const float* pIn, const float* pCoeff,
+                      int sx, float constant)
+{
+    const int xBegin = std::min(R, sx);
+    const int xEnd = std::max(xBegin, sx - R);
+    auto borderPixel = [&](int x) {
+        float value = pCoeff[0] * BorderFetch<B>(pIn, x, 0, sx, 1, 0, constant);
+        for (int i = 1; i <= R; i++)
+        {
+            value += pCoeff[i] * (BorderFetch<B>(pIn, x - i, 0, sx, 1, 0, constant) +
+                                  BorderFetch<B>(pIn, x + i, 0, sx, 1, 0, constant));
+        }
+        return value;
+    };
+
+    for (int x = 0; x < xBegin; x++) pOut[x] = borderPixel(x);
+    for (int x = xBegin; x < xEnd; x++)
+    {
+        float value = pCoeff[0] * pIn[x];
+        for (int i = 1; i <= R; i++)  // unrolled, R is a constant
+        {
+            value += pCoeff[i] * (pIn[x - i] + pIn[x + i]);
+        }
+        pOut[x] = value;
+    }
+    for (int x = xEnd; x < sx; x++) pOut[x] = borderPixel(x);
+}
+
+/***************************************************************
+ * Fixed tap vertical Gaussian pass for output row y. Rows outside
+ * the image with Border::Constant read pConstRow.
+ ****************************************************************/
+template <Border B, int R>
+static void GaussianColumnFixedCpp(float* pOut, const float* pTmp, const float* pCoeff,
+                      int sx, int sy, int pitch, int y, const float* pConstRow)
+{
+    const float* rows[2 * R + 1];
+    for (int i = -R; i <= R; i++)
+    {
+        int yi = BorderIndex<B>(y + i, sy);
+        rows[i + R] = yi < 0 ? pConstRow : pTmp + yi * pitch;
+    }
+    for (int x = 0; x < sx; x++)
+    {
+        float value = pCoeff[0] * rows[R][x];
+        for (int i = 1; i <= R; i++)
+        {
+            value += pCoeff[i] * (rows[R - i][x] + rows[R + i][x]);
+        }
+        pOut[x] = value;
+    }
+}
+
+/***************************************************************
+ * Both passes of the fixed tap Gaussian for rows [y0, y1). pool may
+ * be null to run on the calling thread.
+ ****************************************************************/
+template <Border B, int R>
+static void GaussianBlurFixedCpp(ThreadPool *pool, float* pOut, const float* pIn, const float* pCoeff,
+                      int sx, int sy, int pitch, float constant)
+{
+    vector<float> tmp(static_cast<size_t>(sy) * pitch);
+    // The weights sum to 1, so a constant row stays constant
+    vector<float> constRow(sx, constant);
+    auto runBands = [&](const std::function<void(int, int)> &fn) {
+        if (pool) pool->ParallelFor(sy, HOST_BAND_ROWS, fn);
+        else fn(0, sy);
+    };
+
+    runBands([&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            GaussianRowFixedCpp<B, R>(tmp.data() + y * pitch, pIn + y * pitch, pCoeff, sx, constant);
+        }
+    });
+    runBands([&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            GaussianColumnFixedCpp<B, R>(pOut + y * pitch, tmp.data(), pCoeff, sx, sy, pitch, y,
+                                         constRow.data());
+        }
+    });
+}
+
+static Result GaussianBlurCpp(ThreadPool *pool, float* pOut, const float* pIn,
+                      int sx, int sy, int pitch, float sigma, Border border, float constant)
+{
+    if (pOut == nullptr || pIn == nullptr || pOut == pIn || !(sigma > 0.0f)) return InvalidArgument;
+
+    vector<float> kernel = GaussianKernel(sigma);
+    const int r = static_cast<int>(kernel.size()) / 2;
+    if (r > GAUSSIAN_FIXED_MAX_RADIUS)
+    {
+        return pool ? SeparableFilterCpp(*pool, pOut, pIn, kernel.data(), kernel.size(), kernel.data(),
+                                         kernel.size(), sx, sy, pitch, border, constant)
+                    : SeparableFilterCpp(pOut, pIn, kernel.data(), kernel.size(), kernel.data(),
+                                         kernel.size(), sx, sy, pitch, border, constant);
+    }
+
+    const float* pCoeff = kernel.data() + r;   // center out
+    return DispatchBorder(border, [&](auto tag) {
+        constexpr Border B = decltype(tag)::value;
+        switch (r)
+        {
+        case 1:  GaussianBlurFixedCpp<B, 1>(pool, pOut, pIn, pCoeff, sx, sy, pitch, constant); break;
+        case 2:  GaussianBlurFixedCpp<B, 2>(pool, pOut, pIn, pCoeff, sx, sy, pitch, constant); break;
+        default: GaussianBlurFixedCpp<B, 3>(pool, pOut, pIn, pCoeff, sx, sy, pitch, constant); break;
+        }
+        return Result::Ok;
+    });
+}
+
+/***************************************************************
+ * Gaussian blur with the normalized kernel from GaussianKernel().
+ * Radii up to GAUSSIAN_FIXED_MAX_RADIUS (3, 5 and 7 taps, sigma up
+ * to 1) run fixed tap, symmetric passes; larger ones go through
+ * the generic separable filter.
+ ****************************************************************/
+Result GaussianBlurCpp(float* pOut, const float* pIn, int sx, int sy, int pitch,
+                      float sigma, Border border, float constant)
+{
+    return GaussianBlurCpp(nullptr, pOut, pIn, sx, sy, pitch, sigma, border, constant);
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result GaussianBlurCpp(ThreadPool &pool, float* pOut, const float* pIn, int sx, int sy, int pitch,
+                      float sigma, Border border, float constant)
+{
+    return GaussianBlurCpp(&pool, pOut, pIn, sx, sy, pitch, sigma, border, constant);
+}
+
+/***************************************************************
+ * Image versions of the above, rows Pitch() apart.
+ ****************************************************************/
+Result GaussianBlurCpp(Image<float> &out, const Image<float> &in, float sigma, Border border, float constant)
+{
+    if (!IsFilterPair(out, in)) return InvalidArgument;
+    return GaussianBlurCpp(nullptr, out.Data(), in.Data(), in.Width(), in.Height(),
+                           static_cast<int>(in.Pitch()), sigma, border, constant);
+}
+
+Result GaussianBlurCpp(ThreadPool &pool, Image<float> &out, const Image<float> &in, float sigma,
+                      Border border, float constant)
+{
+    if (!IsFilterPair(out, in)) return InvalidArgument;
+    return GaussianBlurCpp(&pool, out.Data(), in.Data(), in.Width(), in.Height(),
+                           static_cast<int>(in.Pitch()), sigma, border, constant);
+}
+
+/***************************************************************
+ * Row conversions between float and the 16 bit storage types.
+ * Half uses F16C when the CPU has it.
+****************************************************************/
+static void StoreRow(HostHalf* pDst, const float* pSrc, int n)
+{
+    int x = FloatToHalfRowSimd(reinterpret_cast<uint16_t*>(pDst), pSrc, n);
+    for (; x < n; x++) pDst[x] = HostHalf(pSrc[x]);
+}
+
+static void LoadRow(float* pDst, const HostHalf* pSrc, int n)
+{
+    int x = HalfToFloatRowSimd(pDst, reinterpret_cast<const uint16_t*>(pSrc), n);
+    for (; x < n; x++) pDst[x] = static_cast<float>(pSrc[x]);
+}
+
+static void StoreRow(HostBFloat16* pDst, const float* pSrc, int n)
+{
+    for (int x = 0; x < n; x++) pDst[x] = HostBFloat16(pSrc[x]);
+}
+
+static void LoadRow(float* pDst, const HostBFloat16* pSrc, int n)
+{
+    for (int x = 0; x < n; x++) pDst[x] = static_cast<float>(pSrc[x]);
+}
+
+/***************************************************************
+ * SobelFilterCpp with the gradients stored as T (HostHalf or
+ * HostBFloat16). Each row of dx and dy is computed in float into a
+ * one row scratch, its max taken before rounding, then stored as T.
+ * The magnitude pass converts rows of T back to float. The full frame
+ * intermediates are half the size of the float path's.
+ * pool may be null to run the bands on the calling thread.
+****************************************************************/
+template <Border B, typename T>
+static void SobelFilterStorageBorderCpp(ThreadPool *pool, const float *pIn, float *pOut,
+                 int width, int height, float constant)
+{
+    size_t numPixels = static_cast<size_t>(width) * height;
+    PooledArray<T> dx(HostMemoryPool(), numPixels);
+    PooledArray<T> dy(HostMemoryPool(), numPixels);
+    int numBands = (height + HOST_BAND_ROWS - 1) / HOST_BAND_ROWS;
+    vector<float> bandMax(numBands, 0.0f);
+
+    auto runBands = [&](const std::function<void(int, int)> &fn) {
+        if (pool) pool->ParallelFor(height, HOST_BAND_ROWS, fn);
+        else fn(0, height);
+    };
+
+    runBands([&](int y0, int y1) {
+        vector<float> rowX(width), rowY(width);
+        float maxVal = 0.0f;    // like FindMaxCpp
+        for (int y = y0; y < y1; y++)
+        {
+            StencilRowCpp<SobelXStencil, B>(rowX.data(), pIn, y, width, height, width, constant);
+            StencilRowCpp<SobelYStencil, B>(rowY.data(), pIn, y, width, height, width, constant);
+            for (int x = 0; x < width; x++)
             {
-            case Border::Clamp:
-                for (int l = -1; l <= 1; l++)  // filter col
-                {
-                    for (int k = -1; k <= 1; k++)  // filter row
-                    {
-                        //float v = pIn->atClamp(x + k, y + l);
-                        int x1 = std::max(0, std::min(x + k, sx - 1));
-                        int y1 = std::max(0, std::min(y + l, sy - 1));
-                        float v = pIn[y1 * pitch + x1];
-                        float c = pFilter[cIdx++];
-                        value += v * c;
-                        //value = pIn[y1 * pitch + x1];
-                    }
-                }
-                break;
-#if 0
-            case Border::Wrap:
-                for (int l = -1; l <= 1; l++)
-                {
-                    for (int k = -1; k <= 1; k++)
-                    {
-                        float v = pIn->atWrap(x + k, y + l);
-                        float c = pFilter[cIdx++];
-                        value += v * c;
-                    }
-                }
-                break;
-            case Border::Reflect:
-                for (int l = -1; l <= 1; l++)
-                {
-                    for (int k = -1; k <= 1; k++)
-                    {
-                        float v = pIn->atReflect(x + k, y + l);
-                        float c = pFilter[cIdx++];
-                        value += v * c;
-                    }
-                }
-                break;
-            case Border::Mirror:
-                for (int l = -1; l <= 1; l++)
-                {
-                    for (int k = -1; k <= 1; k++)
-                    {
-                        float v = pIn->atMirror(x + k, y + l);
-                        float c = pFilter[cIdx++];
-                        value += v * c;
-                    }
-                }
-                break;
-#endif
-            default:return Result::InvalidArgument;
+                maxVal = std::max(maxVal, std::max(rowX[x], rowY[x]));
             }
-            pOut[y*pitch+x] = value;
+            StoreRow(dx.data() + static_cast<size_t>(y) * width, rowX.data(), width);
+            StoreRow(dy.data() + static_cast<size_t>(y) * width, rowY.data(), width);
         }
-    }
-return Result::Ok;
+        // One call may cover several bands (all of them without a pool)
+        for (int y = y0; y < y1; y += HOST_BAND_ROWS)
+        {
+            bandMax[y / HOST_BAND_ROWS] = maxVal;
+        }
+    });
+
+    float maxValXY = 0.0f;
+    for (float m : bandMax) maxValXY = std::max(maxValXY, m);
+    float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
+
+    runBands([&](int y0, int y1) {
+        vector<float> rowX(width), rowY(width);
+        for (int y = y0; y < y1; y++)
+        {
+            size_t offset = static_cast<size_t>(y) * width;
+            LoadRow(rowX.data(), dx.data() + offset, width);
+            LoadRow(rowY.data(), dy.data() + offset, width);
+            for (int x = 0; x < width; x++)
+            {
+                float i0 = rowX[x] * scale;
+                float i1 = rowY[x] * scale;
+                pOut[offset + x] = sqrtf(i0 * i0 + i1 * i1);
+            }
+        }
+    });
+}
+
+static void SobelFilterStorageCpp(ThreadPool *pool,
+                 std::vector<float> &fl_in_buffer,
+                 std::vector<float> &fl_out_buffer,
+                 int width, int height, Border border, float constant, StoragePrecision precision)
+{
+    DispatchBorder(border, [&](auto tag) {
+        constexpr Border B = decltype(tag)::value;
+        if (precision == StoragePrecision::Float16)
+        {
+            SobelFilterStorageBorderCpp<B, HostHalf>(pool, fl_in_buffer.data(), fl_out_buffer.data(), width, height, constant);
+        }
+        else
+        {
+            SobelFilterStorageBorderCpp<B, HostBFloat16>(pool, fl_in_buffer.data(), fl_out_buffer.data(), width, height, constant);
+        }
+        return Result::Ok;
+    });
 }
 
 /***************************************************************
@@ -188,24 +820,22 @@ return Result::Ok;
 ****************************************************************/
 void SobelFilterCpp(std::vector<float> &fl_in_buffer, // a grayscale buffer with 1 channel
                  std::vector<float> &fl_out_buffer,
-                 int width, int height)
-{
-    vector<float> sobelXGradient(width * height);
-    vector<float> sobelYGradient(width * height);
-    //float sobelXFilter[9] = {0, 0, 0,  
-    //                   0, 1, 0, 
-    //                   0, 0,  0};
-    float sobelXFilter[9] = {1, 0, -1,  
-                        2, 0, -2, 
-                        1, 0,  -1};
-    float sobelYFilter[9] = {1, 2,   1,  
-                        0, 0,   0, 
-                        -1, -2, -1};
+                 int width, int height, Border border, float constant, StoragePrecision precision)
+{
+    if (precision != StoragePrecision::Float32)
+    {
+        SobelFilterStorageCpp(nullptr, fl_in_buffer, fl_out_buffer, width, height, border, constant, precision);
+        return;
+    }
+
+    // Scratch from the host pool, reused from call to call
+    PooledArray<float> sobelXGradient(HostMemoryPool(), static_cast<size_t>(width) * height);
+    PooledArray<float> sobelYGradient(HostMemoryPool(), static_cast<size_t>(width) * height);
 
     // Convolve the x gradient
-    Convolution3x3Cpp(sobelXGradient.data(), fl_in_buffer.data(), &sobelXFilter[0], width, height, width, Border::Clamp);
+    StencilCpp<SobelXStencil>(sobelXGradient.data(), fl_in_buffer.data(), width, height, width, border, constant);
     // Convolve the y gradient
-    Convolution3x3Cpp(sobelYGradient.data(), fl_in_buffer.data(), &sobelYFilter[0], width, height, width, Border::Clamp);
+    StencilCpp<SobelYStencil>(sobelYGradient.data(), fl_in_buffer.data(), width, height, width, border, constant);
     // Find max of both gradients
     float maxValX = FindMaxCpp(sobelXGradient.data(), width, height);
     //cout << "Max SobelX value = " << maxValX << std::endl;
@@ -214,12 +844,14 @@ void SobelFilterCpp(std::vector<float> &fl_in_buffer, // a grayscale buffer with
     // float maxValXY = std::max(maxValX, maxValY); // todo: look up fix in tracker.h to get template version of max()
     
     float maxValXY = maxValX < maxValY ? maxValY : maxValX;
+    // A flat image has no gradients, keep it at 0 rather than 0 / 0
+    float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
 
     // Normalize both X and Y
-    vector<float> sobelXScaled(width * height);
-    ScaleImgCpp(sobelXGradient.data(), sobelXScaled.data(), width, height, 1.0f/maxValXY);
-    vector<float> sobelYScaled(width * height);
-    ScaleImgCpp(sobelYGradient.data(), sobelYScaled.data(), width, height, 1.0f/maxValXY);
+    PooledArray<float> sobelXScaled(HostMemoryPool(), static_cast<size_t>(width) * height);
+    ScaleImgCpp(sobelXGradient.data(), sobelXScaled.data(), width, height, scale);
+    PooledArray<float> sobelYScaled(HostMemoryPool(), static_cast<size_t>(width) * height);
+    ScaleImgCpp(sobelYGradient.data(), sobelYScaled.data(), width, height, scale);
 
     //maxVal = FindMaxCpp(sobelXScaled.data(), width, height); // debug
     //cout << "Max scaled image value = " << maxVal << std::endl;  // debug
@@ -237,3 +869,462 @@ void SobelFilterCpp(std::vector<float> &fl_in_buffer, // a grayscale buffer with
     // Compute magnitude (final step of Sobel)
     ComputeMagnitudeCpp(sobelXScaled.data(), sobelYScaled.data(), fl_out_buffer, width, height);
 }
+
+/***************************************************************
+ * Multithreaded SobelFilterCpp. Same steps and same result as the
+ * single threaded version, but every step runs in row bands on the
+ * pool, with a parallel max reduction in between.
+****************************************************************/
+void SobelFilterCpp(ThreadPool &pool,
+                 std::vector<float> &fl_in_buffer, // a grayscale buffer with 1 channel
+                 std::vector<float> &fl_out_buffer,
+                 int width, int height, Border border, float constant, StoragePrecision precision)
+{
+    if (precision != StoragePrecision::Float32)
+    {
+        SobelFilterStorageCpp(&pool, fl_in_buffer, fl_out_buffer, width, height, border, constant, precision);
+        return;
+    }
+
+    // Scratch from the host pool, reused from call to call
+    PooledArray<float> sobelXGradient(HostMemoryPool(), static_cast<size_t>(width) * height);
+    PooledArray<float> sobelYGradient(HostMemoryPool(), static_cast<size_t>(width) * height);
+
+    StencilCpp<SobelXStencil>(pool, sobelXGradient.data(), fl_in_buffer.data(), width, height, width, border, constant);
+    StencilCpp<SobelYStencil>(pool, sobelYGradient.data(), fl_in_buffer.data(), width, height, width, border, constant);
+
+    float maxValX = FindMaxCpp(pool, sobelXGradient.data(), width, height);
+    float maxValY = FindMaxCpp(pool, sobelYGradient.data(), width, height);
+    float maxValXY = maxValX < maxValY ? maxValY : maxValX;
+    float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
+
+    // Normalize in place, the unscaled gradients aren't needed any more
+    ScaleImgCpp(pool, sobelXGradient.data(), sobelXGradient.data(), width, height, scale);
+    ScaleImgCpp(pool, sobelYGradient.data(), sobelYGradient.data(), width, height, scale);
+
+    ComputeMagnitudeCpp(pool, sobelXGradient.data(), sobelYGradient.data(), fl_out_buffer, width, height);
+}
+
+/***************************************************************
+ * Fixed point luminance of rows [y0, y1), u8 in and out. 1 or 2
+ * channel input is taken as gray.
+ ****************************************************************/
+static void ConvertToGrayscaleFixedCpp(uint8_t* pGray, const uint8_t* pIn,
+                      int width, int numChannels, int y0, int y1)
+{
+    for (int idx = y0 * width; idx < y1 * width; idx++)
+    {
+        const uint8_t* p = pIn + numChannels * idx;
+        pGray[idx] = numChannels >= 3 ? LuminanceFixed(p[0], p[1], p[2]) : p[0];
+    }
+}
+
+/***************************************************************
+ * Integer Sobel gradients of one pixel with the taps read through
+ * border mode B. Only used on the outer ring of the image.
+ ****************************************************************/
+template <Border B>
+static inline uint8_t SobelFixedPixelBorder(const uint8_t* pGray, int x, int y, int sx, int sy,
+                      int shift, uint8_t constant)
+{
+    int v[9];
+    int i = 0;
+    for (int l = -1; l <= 1; l++)
+    {
+        for (int k = -1; k <= 1; k++)
+        {
+            v[i++] = static_cast<int>(BorderFetch<B>(pGray, x + k, y + l, sx, sy, sx, constant));
+        }
+    }
+    int dx, dy;
+    SobelFromTile(v, 4, 3, dx, dy);
+    return SobelMagnitudeFixed(dx, dy, shift);
+}
+
+/***************************************************************
+ * Border mode specialization of SobelFixedCpp for output rows
+ * [y0, y1) of the gray image. The interior goes to the int16 SIMD
+ * kernels, the scalar code picks up the rest.
+ ****************************************************************/
+template <Border B>
+static void SobelFixedBorderCpp(uint8_t* pOut, const uint8_t* pGray, int sx, int sy,
+                      int shift, uint8_t constant, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        uint8_t* pOutRow = pOut + y * sx;
+        if (y == 0 || y == sy - 1 || sx < 3)
+        {
+            for (int x = 0; x < sx; x++)
+            {
+                pOutRow[x] = SobelFixedPixelBorder<B>(pGray, x, y, sx, sy, shift, constant);
+            }
+            continue;
+        }
+
+        pOutRow[0] = SobelFixedPixelBorder<B>(pGray, 0, y, sx, sy, shift, constant);
+        int x = SobelFixedRowSimd(pOutRow, pGray + (y - 1) * sx, pGray + y * sx,
+                                  pGray + (y + 1) * sx, 1, sx - 1, shift);
+        for (; x < sx - 1; x++)
+        {
+            int dx, dy;
+            SobelFromTile(pGray, y * sx + x, sx, dx, dy);
+            pOutRow[x] = SobelMagnitudeFixed(dx, dy, shift);
+        }
+        pOutRow[sx - 1] = SobelFixedPixelBorder<B>(pGray, sx - 1, y, sx, sy, shift, constant);
+    }
+}
+
+/***************************************************************
+ * Integer Sobel: u8 RGB(A) or gray in, u8 edges out. Luminance is
+ * fixed point (LuminanceFixed), gradients fit in int16 and the
+ * magnitude is the saturating SobelMagnitudeFixed. There is no max
+ * normalization, shift sets the scale. Working storage is one u8 gray
+ * image, a quarter of the float pipeline's.
+ ****************************************************************/
+Result SobelFixedCpp(uint8_t* pOut, const uint8_t* pIn, int width, int height, int numChannels,
+                      int shift, Border border, uint8_t constant)
+{
+    if (pOut == nullptr || pIn == nullptr || width <= 0 || height <= 0 || numChannels <= 0 ||
+        shift < 0 || shift > 15) return InvalidArgument;
+
+    vector<uint8_t> gray(static_cast<size_t>(width) * height);
+    ConvertToGrayscaleFixedCpp(gray.data(), pIn, width, numChannels, 0, height);
+    return DispatchBorder(border, [&](auto tag) {
+        SobelFixedBorderCpp<decltype(tag)::value>(pOut, gray.data(), width, height, shift, constant, 0, height);
+        return Result::Ok;
+    });
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result SobelFixedCpp(ThreadPool &pool, uint8_t* pOut, const uint8_t* pIn, int width, int height,
+                      int numChannels, int shift, Border border, uint8_t constant)
+{
+    if (pOut == nullptr || pIn == nullptr || width <= 0 || height <= 0 || numChannels <= 0 ||
+        shift < 0 || shift > 15) return InvalidArgument;
+
+    vector<uint8_t> gray(static_cast<size_t>(width) * height);
+    pool.ParallelFor(height, HOST_BAND_ROWS, [&](int y0, int y1) {
+        ConvertToGrayscaleFixedCpp(gray.data(), pIn, width, numChannels, y0, y1);
+    });
+    return DispatchBorder(border, [&](auto tag) {
+        pool.ParallelFor(height, HOST_BAND_ROWS, [&](int y0, int y1) {
+            SobelFixedBorderCpp<decltype(tag)::value>(pOut, gray.data(), width, height, shift, constant, y0, y1);
+        });
+        return Result::Ok;
+    });
+}
+
+/***************************************************************
+ * 
+ ****************************************************************/
+ImageDiff CompareImagesCpp(const float *pRef, const float *pTest, int width, int height, float peak)
+{
+    ImageDiff diff;
+    double sumAbs = 0.0;
+    double sumSquares = 0.0;
+    size_t numPixels = static_cast<size_t>(width) * height;
+    for (size_t idx = 0; idx < numPixels; idx++)
+    {
+        double e = std::fabs(static_cast<double>(pTest[idx]) - pRef[idx]);
+        diff.maxAbsError = std::max(diff.maxAbsError, static_cast<float>(e));
+        sumAbs += e;
+        sumSquares += e * e;
+    }
+    if (numPixels == 0) return diff;
+    diff.meanAbsError = static_cast<float>(sumAbs / numPixels);
+    double mse = sumSquares / numPixels;
+    diff.psnr = mse > 0.0 ? static_cast<float>(10.0 * std::log10(double(peak) * peak / mse))
+                          : std::numeric_limits<float>::infinity();
+    return diff;
+}
+
+/***************************************************************
+ * Canny edge detection on the host:
+ *
+ * 1. Gaussian pre-blur, skipped if sigma is 0
+ * 2. Sobel gradients with Border::Clamp, magnitude normalized like
+ *    SobelFilterCpp
+ * 3. Non-maximum suppression and double threshold (CannyClassify),
+ *    in bands on the pool
+ * 4. Hysteresis as a flood fill from the strong pixels. It is serial
+ *    but linear in the number of pixels, unlike the device version
+ *    which repeats parallel propagation rounds until nothing changes.
+ *    Both give the same edges.
+ ****************************************************************/
+static Result CannyCpp(ThreadPool *pool, std::vector<uint8_t> &u8_edges_out,
+                 const std::vector<float> &fl_gray, int width, int height,
+                 float sigma, float lowThreshold, float highThreshold)
+{
+    if (width <= 0 || height <= 0 || fl_gray.size() < static_cast<size_t>(width) * height ||
+        sigma < 0.0f || lowThreshold < 0.0f || highThreshold < lowThreshold)
+    {
+        return InvalidArgument;
+    }
+
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    auto runBands = [&](const std::function<void(int, int)> &fn) {
+        if (pool) pool->ParallelFor(height, HOST_BAND_ROWS, fn);
+        else fn(0, height);
+    };
+
+    vector<float> blurred;
+    const float *pSrc = fl_gray.data();
+    if (sigma > 0.0f)
+    {
+        blurred.resize(numPixels);
+        GaussianBlurCpp(pool, blurred.data(), pSrc, width, height, width, sigma, Border::Clamp, 0.0f);
+        pSrc = blurred.data();
+    }
+
+    vector<float> dx(numPixels);
+    vector<float> dy(numPixels);
+    vector<float> mag(numPixels);
+    if (pool)
+    {
+        StencilCpp<SobelXStencil>(*pool, dx.data(), pSrc, width, height, width, Border::Clamp);
+        StencilCpp<SobelYStencil>(*pool, dy.data(), pSrc, width, height, width, Border::Clamp);
+    }
+    else
+    {
+        StencilCpp<SobelXStencil>(dx.data(), pSrc, width, height, width, Border::Clamp);
+        StencilCpp<SobelYStencil>(dy.data(), pSrc, width, height, width, Border::Clamp);
+    }
+    float maxValX = pool ? FindMaxCpp(*pool, dx.data(), width, height) : FindMaxCpp(dx.data(), width, height);
+    float maxValY = pool ? FindMaxCpp(*pool, dy.data(), width, height) : FindMaxCpp(dy.data(), width, height);
+    float maxValXY = maxValX < maxValY ? maxValY : maxValX;
+    // A flat image has no edges, and would divide by 0 below
+    float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
+
+    runBands([&](int y0, int y1) {
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            float x = dx[i] * scale;
+            float y = dy[i] * scale;
+            mag[i] = sqrtf(x * x + y * y);
+        }
+    });
+
+    u8_edges_out.resize(numPixels);
+    uint8_t *pState = u8_edges_out.data();
+    runBands([&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                size_t i = static_cast<size_t>(y) * width + x;
+                pState[i] = CannyClassify(mag, x, y, width, height, dx[i], dy[i], lowThreshold, highThreshold);
+            }
+        }
+    });
+
+    // Grow the strong pixels into the connected weak ones
+    vector<size_t> stack;
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        if (pState[i] == CANNY_STRONG) stack.push_back(i);
+    }
+    while (!stack.empty())
+    {
+        size_t i = stack.back();
+        stack.pop_back();
+        int x = static_cast<int>(i % width);
+        int y = static_cast<int>(i / width);
+        for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++)
+        {
+            for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++)
+            {
+                size_t n = static_cast<size_t>(ny) * width + nx;
+                if (pState[n] == CANNY_WEAK)
+                {
+                    pState[n] = CANNY_STRONG;
+                    stack.push_back(n);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        pState[i] = pState[i] == CANNY_STRONG ? 255 : 0;
+    }
+    return Result::Ok;
+}
+
+Result CannyCpp(std::vector<uint8_t> &u8_edges_out, const std::vector<float> &fl_gray,
+                 int width, int height, float sigma, float lowThreshold, float highThreshold)
+{
+    return CannyCpp(nullptr, u8_edges_out, fl_gray, width, height, sigma, lowThreshold, highThreshold);
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result CannyCpp(ThreadPool &pool, std::vector<uint8_t> &u8_edges_out, const std::vector<float> &fl_gray,
+                 int width, int height, float sigma, float lowThreshold, float highThreshold)
+{
+    return CannyCpp(&pool, u8_edges_out, fl_gray, width, height, sigma, lowThreshold, highThreshold);
+}
+
+/***************************************************************
+ * Both gradients of a row are computed into one row scratches and
+ * reduced right away to the magnitude and the orientation bin, so
+ * dx and dy never exist as full frames. The magnitude is normalized
+ * by the max of dx and dy like SobelFilterCpp, in a second pass
+ * once the max of all the bands is known.
+ * pool may be null to run the bands on the calling thread.
+ ****************************************************************/
+static Result SobelMagnitudeOrientationCpp(ThreadPool *pool, const std::vector<float> &fl_in,
+                 std::vector<float> &fl_magnitude_out, std::vector<uint8_t> &u8_orientation_out,
+                 int width, int height, int numBins, Border border)
+{
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    if (width <= 0 || height <= 0 || fl_in.size() < numPixels || numBins <= 0 || numBins > 255)
+    {
+        return InvalidArgument;
+    }
+    fl_magnitude_out.resize(numPixels);
+    u8_orientation_out.resize(numPixels);
+
+    int numBands = (height + HOST_BAND_ROWS - 1) / HOST_BAND_ROWS;
+    vector<float> bandMax(numBands, 0.0f);
+
+    auto runBands = [&](const std::function<void(int, int)> &fn) {
+        if (pool) pool->ParallelFor(height, HOST_BAND_ROWS, fn);
+        else fn(0, height);
+    };
+
+    Result result = DispatchBorder(border, [&](auto tag) {
+        constexpr Border B = decltype(tag)::value;
+        runBands([&](int y0, int y1) {
+            vector<float> rowX(width), rowY(width);
+            float maxVal = 0.0f;    // like FindMaxCpp
+            for (int y = y0; y < y1; y++)
+            {
+                StencilRowCpp<SobelXStencil, B>(rowX.data(), fl_in.data(), y, width, height, width, 0.0f);
+                StencilRowCpp<SobelYStencil, B>(rowY.data(), fl_in.data(), y, width, height, width, 0.0f);
+                float *pMag = fl_magnitude_out.data() + static_cast<size_t>(y) * width;
+                uint8_t *pOrientation = u8_orientation_out.data() + static_cast<size_t>(y) * width;
+                for (int x = 0; x < width; x++)
+                {
+                    maxVal = std::max(maxVal, std::max(rowX[x], rowY[x]));
+                    pMag[x] = sqrtf(rowX[x] * rowX[x] + rowY[x] * rowY[x]);
+                    pOrientation[x] = QuantizeOrientation(rowX[x], rowY[x], numBins);
+                }
+            }
+            // One call may cover several bands (all of them without a pool)
+            for (int y = y0; y < y1; y += HOST_BAND_ROWS)
+            {
+                bandMax[y / HOST_BAND_ROWS] = maxVal;
+            }
+        });
+        return Result::Ok;
+    });
+    if (result != Result::Ok) return result;
+
+    float maxValXY = 0.0f;
+    for (float m : bandMax) maxValXY = std::max(maxValXY, m);
+    float scale = maxValXY > 0.0f ? 1.0f / maxValXY : 0.0f;
+    runBands([&](int y0, int y1) {
+        for (size_t i = static_cast<size_t>(y0) * width; i < static_cast<size_t>(y1) * width; i++)
+        {
+            fl_magnitude_out[i] *= scale;
+        }
+    });
+    return Result::Ok;
+}
+
+Result SobelMagnitudeOrientationCpp(const std::vector<float> &fl_in,
+                 std::vector<float> &fl_magnitude_out, std::vector<uint8_t> &u8_orientation_out,
+                 int width, int height, int numBins, Border border)
+{
+    return SobelMagnitudeOrientationCpp(nullptr, fl_in, fl_magnitude_out, u8_orientation_out,
+                                        width, height, numBins, border);
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result SobelMagnitudeOrientationCpp(ThreadPool &pool, const std::vector<float> &fl_in,
+                 std::vector<float> &fl_magnitude_out, std::vector<uint8_t> &u8_orientation_out,
+                 int width, int height, int numBins, Border border)
+{
+    return SobelMagnitudeOrientationCpp(&pool, fl_in, fl_magnitude_out, u8_orientation_out,
+                                        width, height, numBins, border);
+}
+
+/***************************************************************
+ * Each band of cell rows is histogrammed by one task, then each
+ * block is normalized with HogNormalizeBlock like on the device.
+ ****************************************************************/
+static Result HogCpp(ThreadPool *pool, std::vector<float> &descriptor,
+                 const std::vector<float> &fl_magnitude, const std::vector<uint8_t> &u8_orientation,
+                 int width, int height, const HogOptions &options)
+{
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    const size_t size = HogDescriptorSize(width, height, options);
+    if (width <= 0 || height <= 0 || !HogOptionsValid(options) || size == 0 ||
+        fl_magnitude.size() < numPixels || u8_orientation.size() < numPixels)
+    {
+        return InvalidArgument;
+    }
+
+    const int cellSize = options.cellSize;
+    const int numBins = options.numBins;
+    const int cellsX = width / cellSize;
+    const int cellsY = height / cellSize;
+    vector<float> cells(static_cast<size_t>(cellsX) * cellsY * numBins, 0.0f);
+
+    auto runRows = [&](int rows, const std::function<void(int, int)> &fn) {
+        if (pool) pool->ParallelFor(rows, 1, fn);
+        else fn(0, rows);
+    };
+
+    runRows(cellsY, [&](int cy0, int cy1) {
+        for (int y = cy0 * cellSize; y < cy1 * cellSize; y++)
+        {
+            float *pRowCells = cells.data() + static_cast<size_t>(y / cellSize) * cellsX * numBins;
+            for (int x = 0; x < cellsX * cellSize; x++)
+            {
+                size_t i = static_cast<size_t>(y) * width + x;
+                int bin = u8_orientation[i] < numBins ? u8_orientation[i] : numBins - 1;
+                pRowCells[(x / cellSize) * numBins + bin] += fl_magnitude[i];
+            }
+        }
+    });
+
+    const int blocksX = HogBlocksX(width, options);
+    const int blockLength = options.blockSize * options.blockSize * numBins;
+    descriptor.resize(size);
+    float *pOut = descriptor.data();
+    runRows(HogBlocksY(height, options), [&](int by0, int by1) {
+        for (int by = by0; by < by1; by++)
+        {
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                HogNormalizeBlock(cells, pOut, (static_cast<size_t>(by) * blocksX + bx) * blockLength,
+                                  bx, by, cellsX, options.blockSize, numBins, options.clip);
+            }
+        }
+    });
+    return Result::Ok;
+}
+
+Result HogCpp(std::vector<float> &descriptor, const std::vector<float> &fl_magnitude,
+                 const std::vector<uint8_t> &u8_orientation, int width, int height,
+                 const HogOptions &options)
+{
+    return HogCpp(nullptr, descriptor, fl_magnitude, u8_orientation, width, height, options);
+}
+
+/***************************************************************
+ * Multithreaded version of the above. Same result.
+ ****************************************************************/
+Result HogCpp(ThreadPool &pool, std::vector<float> &descriptor, const std::vector<float> &fl_magnitude,
+                 const std::vector<uint8_t> &u8_orientation, int width, int height,
+                 const HogOptions &options)
+{
+    return HogCpp(&pool, descriptor, fl_magnitude, u8_orientation, width, height, options);
+}
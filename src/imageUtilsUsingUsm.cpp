@@ -0,0 +1,146 @@
+#include <cstdio>
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingUsm.h"
+
+using namespace sycl;
+using namespace std;
+
+/***************************************************************
+ * 
+****************************************************************/
+sycl::event ConvertToGrayscaleUsm(queue &q,
+                      const uint8_t *u8_image_in, // input
+                      float *fl_gray,             // output
+                      int width, int height, int numChannels,
+                      const std::vector<sycl::event> &deps)
+{
+  try
+  {
+    return q.submit([&](handler &h) {
+      h.depends_on(deps);
+      h.parallel_for(range<1>(width * height), [=](id<1> idx) {
+          int offset = numChannels * idx[0];
+          fl_gray[idx[0]] = numChannels >= 3 ? luminance(u8_image_in[offset], u8_image_in[offset + 1],
+                                                         u8_image_in[offset + 2])
+                                             : u8_image_in[offset] / 255.0f;
+      });
+    });
+  } catch (std::exception const &e) {
+    cout << "ConvertToGrayscaleUsm exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
+
+/***************************************************************
+ * Same kernels as SobelFilterFused in imageUtilsUsingBuffers.cpp,
+ * with USM pointers and explicit dependencies instead of accessors.
+****************************************************************/
+template <Border B>
+static sycl::event SobelFilterUsmKernels(queue &q, const float *fl_in, float *fl_out, float *fl_max,
+                      int width, int height, float constant,
+                      const std::vector<sycl::event> &deps)
+{
+  constexpr int tileW = SOBEL_TILE_WIDTH;
+  constexpr int tileH = SOBEL_TILE_HEIGHT;
+  constexpr int haloW = tileW + 2;
+  constexpr int haloH = tileH + 2;
+  nd_range<2> ndRange(range<2>(((height + tileH - 1) / tileH) * tileH,
+                               ((width + tileW - 1) / tileW) * tileW),
+                      range<2>(tileH, tileW));
+
+  // Like FindMaxCpp the max starts at 0
+  event maxInit = q.submit([&](handler &h) {
+    h.depends_on(deps);
+    h.fill(fl_max, 0.0f, 1);
+  });
+
+  event magnitudeDone = q.submit([&](handler &h) {
+    h.depends_on(maxInit);
+    local_accessor<float, 1> tile(range<1>(haloW * haloH), h);
+
+    h.parallel_for(ndRange, sycl::reduction(fl_max, sycl::maximum<float>()),
+        [=](nd_item<2> item, auto &maxVal) {
+            const int lx = item.get_local_id(1);
+            const int ly = item.get_local_id(0);
+            const int x0 = item.get_group(1) * tileW - 1;
+            const int y0 = item.get_group(0) * tileH - 1;
+
+            for (int i = ly * tileW + lx; i < haloW * haloH; i += tileW * tileH)
+            {
+                tile[i] = BorderFetch<B>(fl_in, x0 + i % haloW, y0 + i / haloW,
+                                         width, height, width, constant);
+            }
+            group_barrier(item.get_group());
+
+            const int x = x0 + 1 + lx;
+            const int y = y0 + 1 + ly;
+            if (x >= width || y >= height) return;
+
+            float dx_val, dy_val;
+            SobelFromTile(tile, (ly + 1) * haloW + (lx + 1), haloW, dx_val, dy_val);
+            fl_out[y * width + x] = sycl::sqrt(dx_val * dx_val + dy_val * dy_val);
+            maxVal.combine(sycl::max(dx_val, dy_val));
+        });
+  });
+
+  // Normalize in place, reading the max from device memory
+  return q.submit([&](handler &h) {
+    h.depends_on(magnitudeDone);
+    h.parallel_for(range<1>(width * height), [=](id<1> idx) {
+        float m = fl_max[0];
+        fl_out[idx[0]] *= m > 0.0f ? 1.0f / m : 0.0f;
+    });
+  });
+}
+
+sycl::event SobelFilterUsm(queue &q,
+                      const float *fl_in,
+                      float *fl_out,
+                      float *fl_max,
+                      int width, int height,
+                      Border border, float constant,
+                      const std::vector<sycl::event> &deps)
+{
+  sycl::event last;
+  try
+  {
+    Result result = DispatchBorder(border, [&](auto tag) {
+        last = SobelFilterUsmKernels<decltype(tag)::value>(q, fl_in, fl_out, fl_max,
+                                                           width, height, constant, deps);
+        return Result::Ok;
+    });
+    if (result != Result::Ok)
+    {
+      cout << "SobelFilterUsm: invalid border mode" << std::endl;
+      terminate();
+    }
+  } catch (std::exception const &e) {
+    cout << "SobelFilterUsm exception: " << e.what() << std::endl;
+    terminate();
+  }
+  return last;
+}
+
+/***************************************************************
+ * 
+****************************************************************/
+sycl::event ConvertToUint8Usm(queue &q,
+                      const float *fl_in,  // input. normalized to 0 ... 1
+                      uint8_t *u8_out,
+                      int width, int height,
+                      const std::vector<sycl::event> &deps)
+{
+  try
+  {
+    return q.submit([&](handler &h) {
+      h.depends_on(deps);
+      h.parallel_for(range<1>(width * height), [=](id<1> idx) {
+          // Saturate, the magnitude can be above 1
+          u8_out[idx[0]] = static_cast<uint8_t>(sycl::clamp(fl_in[idx[0]] * 255.0f, 0.0f, 255.0f));
+      });
+    });
+  } catch (std::exception const &e) {
+    cout << "ConvertToUint8Usm exception: " << e.what() << std::endl;
+    terminate();
+  }
+}
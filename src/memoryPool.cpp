@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+#include "memoryPool.h"
+
+// Smallest size class, also the alignment of host blocks
+const size_t POOL_MIN_CLASS = 256;
+
+/***************************************************************
+ *
+ ****************************************************************/
+MemoryPool::MemoryPool(const sycl::queue &q, PoolMemory memory)
+    : memory_(memory)
+{
+    if (memory != PoolMemory::Host) queue_ = q;
+}
+
+MemoryPool::~MemoryPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ReclaimCompleted(true);
+    }
+    Trim();
+}
+
+size_t MemoryPool::SizeClass(size_t bytes)
+{
+    if (bytes <= POOL_MIN_CLASS) return POOL_MIN_CLASS;
+    // Largest power of two below bytes, then steps of a quarter of it
+    size_t power = POOL_MIN_CLASS;
+    while (power * 2 < bytes) power *= 2;
+    size_t step = power / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+void *MemoryPool::AllocateBlock(size_t bytes)
+{
+    switch (memory_)
+    {
+    case PoolMemory::UsmDevice: return sycl::malloc_device(bytes, *queue_);
+    case PoolMemory::UsmHost:   return sycl::malloc_host(bytes, *queue_);
+    default:
+        try
+        {
+            return ::operator new(bytes, std::align_val_t(POOL_MIN_CLASS));
+        } catch (std::bad_alloc const &) {
+            return nullptr;
+        }
+    }
+}
+
+void MemoryPool::FreeBlock(void *p)
+{
+    if (memory_ == PoolMemory::Host) ::operator delete(p, std::align_val_t(POOL_MIN_CLASS));
+    else sycl::free(p, *queue_);
+}
+
+void *MemoryPool::Allocate(size_t bytes)
+{
+    const size_t size = SizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReclaimCompleted(false);
+
+    void *p = nullptr;
+    auto it = cached_.find(size);
+    if (it != cached_.end() && !it->second.empty())
+    {
+        p = it->second.back();
+        it->second.pop_back();
+        stats_.bytesCached -= size;
+        stats_.hits++;
+    }
+    else
+    {
+        p = AllocateBlock(size);
+        if (p == nullptr)
+        {
+            // Give the cached blocks back, including the ones still waiting
+            // for their kernels, and try once more
+            ReclaimCompleted(true);
+            for (auto &c : cached_)
+            {
+                for (void *block : c.second) FreeBlock(block);
+            }
+            cached_.clear();
+            stats_.bytesCached = 0;
+            p = AllocateBlock(size);
+            if (p == nullptr) return nullptr;
+        }
+        stats_.misses++;
+    }
+
+    inUse_[p] = size;
+    stats_.bytesInUse += size;
+    stats_.highWaterInUse = std::max(stats_.highWaterInUse, stats_.bytesInUse);
+    stats_.highWaterTotal = std::max(stats_.highWaterTotal, stats_.bytesInUse + stats_.bytesCached);
+    return p;
+}
+
+void MemoryPool::Free(void *p)
+{
+    if (p == nullptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    CacheBlock(p);
+}
+
+void MemoryPool::FreeAfter(void *p, const sycl::event &e)
+{
+    if (p == nullptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace_back(p, e);
+}
+
+void MemoryPool::ReclaimCompleted(bool wait)
+{
+    auto done = [wait](std::pair<void *, sycl::event> &block) {
+        if (wait) block.second.wait();
+        return block.second.get_info<sycl::info::event::command_execution_status>() ==
+               sycl::info::event_command_status::complete;
+    };
+    auto firstPending = std::stable_partition(pending_.begin(), pending_.end(), done);
+    for (auto it = pending_.begin(); it != firstPending; ++it) CacheBlock(it->first);
+    pending_.erase(pending_.begin(), firstPending);
+}
+
+void MemoryPool::CacheBlock(void *p)
+{
+    auto it = inUse_.find(p);
+    if (it == inUse_.end()) return;     // not from this pool
+    const size_t size = it->second;
+    inUse_.erase(it);
+    cached_[size].push_back(p);
+    stats_.bytesInUse -= size;
+    stats_.bytesCached += size;
+}
+
+void MemoryPool::Trim()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReclaimCompleted(false);
+    for (auto &c : cached_)
+    {
+        for (void *block : c.second) FreeBlock(block);
+    }
+    cached_.clear();
+    stats_.bytesCached = 0;
+}
+
+PoolStats MemoryPool::Stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void MemoryPool::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.highWaterInUse = stats_.bytesInUse;
+    stats_.highWaterTotal = stats_.bytesInUse + stats_.bytesCached;
+}
+
+bool MemoryPool::Serves(const sycl::queue &q) const
+{
+    if (memory_ == PoolMemory::Host) return true;
+    return q.get_context() == queue_->get_context() && q.get_device() == queue_->get_device();
+}
+
+/***************************************************************
+ * The pools are never destroyed: freeing USM from a static
+ * destructor could run after the SYCL runtime has shut down.
+ ****************************************************************/
+MemoryPool &HostMemoryPool()
+{
+    static MemoryPool *pool = new MemoryPool();
+    return *pool;
+}
+
+MemoryPool &UsmMemoryPool(const sycl::queue &q, PoolMemory memory)
+{
+    static std::mutex mutex;
+    static auto *pools = new std::vector<std::unique_ptr<MemoryPool>>();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &pool : *pools)
+    {
+        if (pool->Memory() == memory && pool->Serves(q)) return *pool;
+    }
+    pools->emplace_back(new MemoryPool(q, memory));
+    return *pools->back();
+}
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include "multiDevice.h"
+#include "imageUtilsUsingBuffers.h"
+#include "stageProfiler.h"
+#include "workGroupTuner.h"
+
+using namespace sycl;
+using namespace std;
+
+namespace {
+
+// A band of rows and its buffers on the band's device. The input and the
+// gradients cover the halo rows too, the edges only the band's rows.
+struct Band
+{
+    int y0 = 0;         // first image row of the band
+    int rows = 0;
+    int top = 0;        // halo rows above and below, 0 at the image edges
+    int bottom = 0;
+    std::unique_ptr<buffer<uint8_t, 1>> image;
+    std::unique_ptr<buffer<float, 1>> gray;
+    std::unique_ptr<buffer<float, 1>> dx;
+    std::unique_ptr<buffer<float, 1>> dy;
+    std::unique_ptr<buffer<float, 1>> maxVal;
+    std::unique_ptr<buffer<uint8_t, 1>> edges;
+
+    int PaddedRows() const { return rows + top + bottom; }
+};
+
+/***************************************************************
+ * Band heights in proportion to the compute units of the queues'
+ * devices, at least one row each. Fewer bands than queues if the
+ * image has fewer rows.
+ ****************************************************************/
+vector<Band> SplitRows(vector<queue> &queues, int height)
+{
+    int numBands = std::min(static_cast<int>(queues.size()), height);
+    vector<double> weights(numBands);
+    double sum = 0;
+    for (int b = 0; b < numBands; b++)
+    {
+        weights[b] = std::max(1.0, static_cast<double>(
+            queues[b].get_device().get_info<info::device::max_compute_units>()));
+        sum += weights[b];
+    }
+
+    vector<Band> bands(numBands);
+    int y = 0;
+    double weightBefore = 0;
+    for (int b = 0; b < numBands; b++)
+    {
+        weightBefore += weights[b];
+        int end = b == numBands - 1 ? height : static_cast<int>(height * weightBefore / sum + 0.5);
+        end = std::max(end, y + 1);
+        end = std::min(end, height - (numBands - 1 - b));
+        bands[b].y0 = y;
+        bands[b].rows = end - y;
+        bands[b].top = y > 0 ? 1 : 0;
+        bands[b].bottom = end < height ? 1 : 0;
+        y = end;
+    }
+    return bands;
+}
+
+/***************************************************************
+ * Gradients of a band on its device. The band is filtered as an
+ * image of its own, halo rows included: at the image edges the
+ * border mode applies as for the whole image, inside it only the
+ * halo rows see the band's edge, and they are not written out.
+ ****************************************************************/
+void BandGradients(queue &q, Band &band, const uint8_t *pImage, int width, int numChannels,
+                   Border border, float constant)
+{
+    const int paddedRows = band.PaddedRows();
+    const size_t pixels = static_cast<size_t>(paddedRows) * width;
+    // Created without host memory: allocated when first used on the band's device
+    band.image.reset(new buffer<uint8_t, 1>(range<1>(pixels * numChannels)));
+    band.gray.reset(new buffer<float, 1>(range<1>(pixels)));
+    band.dx.reset(new buffer<float, 1>(range<1>(pixels)));
+    band.dy.reset(new buffer<float, 1>(range<1>(pixels)));
+    band.maxVal.reset(new buffer<float, 1>(range<1>(1)));
+    band.edges.reset(new buffer<uint8_t, 1>(range<1>(static_cast<size_t>(band.rows) * width)));
+
+    const uint8_t *pBand = pImage + static_cast<size_t>(band.y0 - band.top) * width * numChannels;
+    ProfileStage("CopyBandToDevice", q.submit([&](handler &h) {
+        accessor image(*band.image, h, write_only, no_init);
+        h.copy(pBand, image);
+    }));
+
+    ConvertToGrayscaleBuffer(q, *band.image, *band.gray, width, paddedRows, numChannels);
+    StencilBuffer<SobelXStencil>(q, *band.gray, *band.dx, width, paddedRows, border, constant);
+    StencilBuffer<SobelYStencil>(q, *band.gray, *band.dy, width, paddedRows, border, constant);
+
+    // Max of dx and dy over the band's own rows. Like SobelFilter the max starts at 0.
+    ProfileStage("BandMaxInit", q.submit([&](handler &h) {
+        accessor maxVal(*band.maxVal, h, write_only, no_init);
+        h.fill(maxVal, 0.0f);
+    }));
+    ProfileStage("BandMax", q.submit([&](handler &h) {
+        accessor dx(*band.dx, h, read_only);
+        accessor dy(*band.dy, h, read_only);
+        auto maxReduction = reduction(*band.maxVal, h, maximum<float>());
+        const int top = band.top;
+        ParallelFor2D(h, WorkGroupShape(), band.rows, width, maxReduction,
+                      [=](int y, int x, auto &maxVal) {
+                          size_t i = static_cast<size_t>(y + top) * width + x;
+                          maxVal.combine(sycl::max(dx[i], dy[i]));
+                      });
+    }));
+}
+
+// u8 magnitude of the band's rows with the gradients scaled by scale,
+// copied into the band's rows of pEdges
+void BandEdges(queue &q, Band &band, uint8_t *pEdges, int width, float scale)
+{
+    ProfileStage("BandEdges", q.submit([&](handler &h) {
+        accessor dx(*band.dx, h, read_only);
+        accessor dy(*band.dy, h, read_only);
+        accessor edges(*band.edges, h, write_only, no_init);
+        const int top = band.top;
+        ParallelFor2D(h, WorkGroupShape(), band.rows, width, [=](int y, int x) {
+            size_t i = static_cast<size_t>(y + top) * width + x;
+            float gx = dx[i] * scale;
+            float gy = dy[i] * scale;
+            // The magnitude can reach sqrt(2), saturate instead of wrapping
+            edges[static_cast<size_t>(y) * width + x] =
+                static_cast<uint8_t>(sycl::min(sycl::sqrt(gx * gx + gy * gy) * 255.0f, 255.0f));
+        });
+    }));
+
+    uint8_t *pBand = pEdges + static_cast<size_t>(band.y0) * width;
+    ProfileStage("CopyBandToHost", q.submit([&](handler &h) {
+        accessor edges(*band.edges, h, read_only);
+        h.copy(edges, pBand);
+    }));
+}
+
+} // namespace
+
+/***************************************************************
+ *
+ ****************************************************************/
+std::vector<sycl::queue> CreatePartitionQueues(const sycl::device &device, PartitionMode mode,
+                                               const sycl::async_handler &handler,
+                                               bool enableProfiling)
+{
+    vector<sycl::device> devices;
+    switch (mode)
+    {
+    case PartitionMode::Numa:
+        try
+        {
+            if (device.get_info<info::device::partition_max_sub_devices>() > 1)
+            {
+                devices = device.create_sub_devices<info::partition_property::partition_by_affinity_domain>(
+                    info::partition_affinity_domain::numa);
+            }
+        } catch (sycl::exception const &) {
+            // Not partitionable by NUMA domain, use the device whole
+        }
+        break;
+    case PartitionMode::Devices:
+        devices = device.get_platform().get_devices();
+        break;
+    default:
+        break;
+    }
+    if (devices.empty()) devices.push_back(device);
+
+    vector<sycl::queue> queues;
+    for (auto &d : devices)
+    {
+        property_list properties;
+        if (enableProfiling) properties = property_list{property::queue::enable_profiling()};
+        queues.emplace_back(sycl::context(d), d, handler, properties);
+    }
+    return queues;
+}
+
+/***************************************************************
+ * Two passes over the bands, each submitted to every queue before
+ * waiting on any: the gradients and per band max, then, once the
+ * max of the whole image is known on the host, the edges.
+ ****************************************************************/
+Result SobelEdgesPartitioned(std::vector<sycl::queue> &queues,
+                             const uint8_t *pImage, uint8_t *pEdges,
+                             int width, int height, int numChannels,
+                             PartitionStats &stats,
+                             Border border, float constant)
+{
+    stats = PartitionStats();
+    if (queues.empty() || pImage == nullptr || pEdges == nullptr || width <= 0 || height <= 0 ||
+        numChannels < 3 || border == Border::Wrap || static_cast<int>(border) > static_cast<int>(Border::Last))
+    {
+        return Result::InvalidArgument;
+    }
+    auto wallBegin = std::chrono::steady_clock::now();
+
+    vector<Band> bands = SplitRows(queues, height);
+    try
+    {
+        for (size_t b = 0; b < bands.size(); b++)
+        {
+            BandGradients(queues[b], bands[b], pImage, width, numChannels, border, constant);
+        }
+
+        float maxVal = 0.0f;
+        for (auto &band : bands)
+        {
+            host_accessor bandMax(*band.maxVal, read_only);
+            maxVal = std::max(maxVal, bandMax[0]);
+        }
+        const float scale = maxVal > 0.0f ? 1.0f / maxVal : 0.0f;
+
+        for (size_t b = 0; b < bands.size(); b++)
+        {
+            BandEdges(queues[b], bands[b], pEdges, width, scale);
+        }
+        for (size_t b = 0; b < bands.size(); b++)
+        {
+            queues[b].wait();
+        }
+    } catch (std::exception const &e) {
+        cout << "SobelEdgesPartitioned exception: " << e.what() << std::endl;
+        terminate();
+    }
+
+    for (auto &band : bands) stats.bandRows.push_back(band.rows);
+    stats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallBegin).count();
+    return Result::Ok;
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "stageProfiler.h"
+
+namespace {
+
+thread_local StageProfiler *currentProfiler = nullptr;
+
+} // namespace
+
+StageProfiler *SetStageProfiler(StageProfiler *profiler)
+{
+    StageProfiler *previous = currentProfiler;
+    currentProfiler = profiler;
+    return previous;
+}
+
+sycl::event ProfileStage(const char *stage, sycl::event e)
+{
+    if (currentProfiler) currentProfiler->Record(stage, e);
+    return e;
+}
+
+/***************************************************************
+ *
+ ****************************************************************/
+void StageProfiler::Record(const char *stage, const sycl::event &e)
+{
+    pending_.emplace_back(stage, e);
+}
+
+void StageProfiler::AddTime(const std::string &stage, double ms)
+{
+    Times(stage).push_back(ms);
+}
+
+std::vector<double> &StageProfiler::Times(const std::string &stage)
+{
+    auto it = timesMs_.find(stage);
+    if (it == timesMs_.end())
+    {
+        order_.push_back(stage);
+        it = timesMs_.emplace(stage, std::vector<double>()).first;
+    }
+    return it->second;
+}
+
+void StageProfiler::Collect()
+{
+    for (auto &p : pending_)
+    {
+        // Listed even if none of its events has profiling info
+        std::vector<double> &times = Times(p.first);
+
+        sycl::event &e = p.second;
+        e.wait();
+        try
+        {
+            uint64_t start = e.get_profiling_info<sycl::info::event_profiling::command_start>();
+            uint64_t end = e.get_profiling_info<sycl::info::event_profiling::command_end>();
+            times.push_back((end - start) * 1e-6);
+        } catch (sycl::exception const &) {
+            // The queue of e doesn't have enable_profiling
+            unprofiled_++;
+        }
+    }
+    pending_.clear();
+}
+
+void StageProfiler::Clear()
+{
+    pending_.clear();
+    order_.clear();
+    timesMs_.clear();
+    unprofiled_ = 0;
+}
+
+std::vector<StageStats> StageProfiler::Stats()
+{
+    Collect();
+    std::vector<StageStats> stats;
+    for (const std::string &name : order_)
+    {
+        std::vector<double> times = timesMs_[name];
+        StageStats s;
+        s.name = name;
+        s.count = times.size();
+        if (!times.empty())
+        {
+            std::sort(times.begin(), times.end());
+            for (double t : times) s.totalMs += t;
+            s.minMs = times.front();
+            s.maxMs = times.back();
+            size_t mid = times.size() / 2;
+            s.medianMs = times.size() % 2 ? times[mid] : 0.5 * (times[mid - 1] + times[mid]);
+        }
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+void StageProfiler::Report(std::ostream &os)
+{
+    std::vector<StageStats> stats = Stats();
+    double totalMs = 0;
+    for (const StageStats &s : stats) totalMs += s.totalMs;
+
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::left << std::setw(24) << "Stage" << std::right << std::setw(8) << "Count"
+       << std::setw(12) << "Min ms" << std::setw(12) << "Median ms" << std::setw(12) << "Max ms"
+       << std::setw(12) << "Total ms" << std::setw(8) << "%" << "\n";
+    os << std::fixed;
+    for (const StageStats &s : stats)
+    {
+        os << std::left << std::setw(24) << s.name << std::right << std::setw(8) << s.count
+           << std::setprecision(4) << std::setw(12) << s.minMs << std::setw(12) << s.medianMs
+           << std::setw(12) << s.maxMs << std::setprecision(3) << std::setw(12) << s.totalMs
+           << std::setprecision(1) << std::setw(8) << (totalMs > 0 ? 100.0 * s.totalMs / totalMs : 0.0)
+           << "\n";
+    }
+    if (unprofiled_ > 0)
+    {
+        os << unprofiled_ << " events without profiling info, create the queue with "
+           << "property::queue::enable_profiling\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "stripStream.h"
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingCpp.h"
+#include "imageUtilsSimdCpp.h"
+#include "imageUtilsUsingBuffers.h"
+
+using namespace sycl;
+using namespace std;
+
+namespace {
+
+// Largest |dx| or |dy| of the Sobel filters on a 0 ... 1 image, the fixed
+// scale of the streamed gradients
+const float STREAM_MAX_GRADIENT = 4.0f;
+
+double ElapsedMs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Row of the image used for row y, -1 for the constant. Same as BorderIndex.
+int MapRow(Border border, int y, int height)
+{
+    switch (border)
+    {
+    case Border::Clamp:    return BorderIndex<Border::Clamp>(y, height);
+    case Border::Reflect:  return BorderIndex<Border::Reflect>(y, height);
+    case Border::Mirror:   return BorderIndex<Border::Mirror>(y, height);
+    default:               return BorderIndex<Border::Constant>(y, height);
+    }
+}
+
+bool IsValid(RowSource &source, const StreamOptions &options)
+{
+    return source.Width() > 0 && source.Height() > 0 && source.Channels() > 0 &&
+           options.stripRows > 0 && options.border != Border::Wrap &&
+           static_cast<int>(options.border) <= static_cast<int>(Border::Last);
+}
+
+/***************************************************************
+ * Cuts the rows of a source into strips with a one row halo.
+ * Only the rows the current strip needs are kept: the two halo
+ * rows it shares with the previous strip are moved to the top of
+ * the window and the rest is read from the source.
+ ****************************************************************/
+class StripReader
+{
+public:
+    StripReader(RowSource &source, const StreamOptions &options)
+        : source_(source), options_(options), height_(source.Height()),
+          rowBytes_(static_cast<size_t>(source.Width()) * source.Channels()),
+          window_((options.stripRows + 2) * rowBytes_)
+    {
+    }
+
+    size_t BytesAllocated() const { return window_.size(); }
+
+    /***************************************************************
+     * Fill pPadded (stripRows + 2 rows) with image rows y0 - 1 ...
+     * y0 + numRows, the border mode applied outside the image.
+     * numRows is 0 after the last strip.
+     ****************************************************************/
+    Result Next(uint8_t *pPadded, int &y0, int &numRows)
+    {
+        y0 = nextY_;
+        numRows = std::min(options_.stripRows, height_ - y0);
+        if (numRows <= 0)
+        {
+            numRows = 0;
+            return Result::Ok;
+        }
+
+        int first = std::max(y0 - 1, 0);
+        int last = std::min(y0 + numRows, height_ - 1);
+        int drop = first - windowFirst_;
+        if (drop > 0)
+        {
+            std::memmove(window_.data(), window_.data() + drop * rowBytes_, (windowRows_ - drop) * rowBytes_);
+            windowRows_ -= drop;
+            windowFirst_ = first;
+        }
+        int missing = last + 1 - (windowFirst_ + windowRows_);
+        if (missing > 0)
+        {
+            if (!source_.ReadRows(window_.data() + windowRows_ * rowBytes_, missing)) return Result::FileIOFailure;
+            windowRows_ += missing;
+        }
+
+        for (int k = 0; k < numRows + 2; k++)
+        {
+            int row = MapRow(options_.border, y0 - 1 + k, height_);
+            uint8_t *pDst = pPadded + k * rowBytes_;
+            if (row < 0) std::memset(pDst, options_.constant, rowBytes_);
+            else std::memcpy(pDst, window_.data() + (row - windowFirst_) * rowBytes_, rowBytes_);
+        }
+        nextY_ += numRows;
+        return Result::Ok;
+    }
+
+private:
+    RowSource &source_;
+    StreamOptions options_;
+    int height_;
+    size_t rowBytes_;
+    std::vector<uint8_t> window_;   // image rows windowFirst_ ... windowFirst_ + windowRows_ - 1
+    int windowFirst_ = 0;
+    int windowRows_ = 0;
+    int nextY_ = 0;
+};
+
+// Skip whitespace and # comments between the fields of a PNM header
+bool ReadPnmField(std::ifstream &file, int &value)
+{
+    int c = file.peek();
+    while (file && (std::isspace(c) || c == '#'))
+    {
+        if (c == '#') file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        else file.get();
+        c = file.peek();
+    }
+    return static_cast<bool>(file >> value);
+}
+
+// Gray value the Border::Constant columns see. The padded rows repeat
+// options.constant in every channel, so they go through the same luminance.
+float ConstantGray(const StreamOptions &options, int channels)
+{
+    const uint8_t c = options.constant;
+    return channels >= 3 ? luminance(c, c, c) : c / 255.0f;
+}
+
+} // namespace
+
+/***************************************************************
+ *
+ ****************************************************************/
+Result PnmRowSource::Open(const std::string &path)
+{
+    file_.open(path, std::ios::binary);
+    if (!file_) return Result::FileIOFailure;
+
+    char magic[2] = {};
+    file_.read(magic, 2);
+    if (magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) return Result::InvalidArgument;
+    channels_ = magic[1] == '5' ? 1 : 3;
+
+    if (!ReadPnmField(file_, width_) || !ReadPnmField(file_, height_) || !ReadPnmField(file_, maxVal_))
+    {
+        return Result::FileIOFailure;
+    }
+    if (width_ <= 0 || height_ <= 0 || maxVal_ <= 0 || maxVal_ > 255) return Result::InvalidArgument;
+    file_.get();    // the single whitespace before the pixels
+    return file_ ? Result::Ok : Result::FileIOFailure;
+}
+
+bool PnmRowSource::ReadRows(uint8_t *pRows, int numRows)
+{
+    std::streamsize bytes = static_cast<std::streamsize>(width_) * channels_ * numRows;
+    if (!file_.read(reinterpret_cast<char *>(pRows), bytes)) return false;
+    if (maxVal_ < 255)
+    {
+        // Stretch 0 ... maxVal to 0 ... 255, rounded
+        for (std::streamsize i = 0; i < bytes; i++)
+        {
+            int v = std::min<int>(pRows[i], maxVal_);
+            pRows[i] = static_cast<uint8_t>((v * 255 + maxVal_ / 2) / maxVal_);
+        }
+    }
+    return true;
+}
+
+Result PnmRowSink::Open(const std::string &path, int width, int height)
+{
+    file_.open(path, std::ios::binary);
+    if (!file_) return Result::FileIOFailure;
+    width_ = width;
+    file_ << "P5\n" << width << " " << height << "\n255\n";
+    return file_ ? Result::Ok : Result::FileIOFailure;
+}
+
+bool PnmRowSink::WriteRows(const uint8_t *pRows, int numRows)
+{
+    std::streamsize bytes = static_cast<std::streamsize>(width_) * numRows;
+    return static_cast<bool>(file_.write(reinterpret_cast<const char *>(pRows), bytes));
+}
+
+/***************************************************************
+ * Per strip: luminance of the padded strip, Convolution3x3Cpp for
+ * dx and dy (rows 0 and numRows + 1 are only there as taps), then
+ * the u8 magnitude of the inner rows.
+ ****************************************************************/
+Result SobelStreamCpp(ThreadPool &pool, RowSource &source, RowSink &sink,
+                      const StreamOptions &options, StreamStats &stats)
+{
+    stats = StreamStats();
+    if (!IsValid(source, options)) return Result::InvalidArgument;
+    auto wallBegin = std::chrono::steady_clock::now();
+
+    const int width = source.Width();
+    const int channels = source.Channels();
+    const size_t paddedPixels = static_cast<size_t>(options.stripRows + 2) * width;
+    StripReader reader(source, options);
+    vector<uint8_t> padded(paddedPixels * channels);
+    vector<float> gray(paddedPixels);
+    vector<float> dx(paddedPixels);
+    vector<float> dy(paddedPixels);
+    vector<uint8_t> edges(static_cast<size_t>(options.stripRows) * width);
+    stats.bytesAllocated = reader.BytesAllocated() + padded.size() + edges.size() +
+                           3 * paddedPixels * sizeof(float);
+
+    const float constant = ConstantGray(options, channels);
+    const float scale = 1.0f / STREAM_MAX_GRADIENT;
+
+    for (;;)
+    {
+        int y0, numRows;
+        Result result = reader.Next(padded.data(), y0, numRows);
+        if (result != Result::Ok) return result;
+        if (numRows == 0) break;
+        const int paddedRows = numRows + 2;
+
+        pool.ParallelFor(paddedRows, HOST_BAND_ROWS, [&](int r0, int r1) {
+            size_t begin = static_cast<size_t>(r0) * width;
+            begin += ConvertToGrayscaleRowSimd(&gray[begin], &padded[begin * channels], channels,
+                                               (r1 - r0) * width);
+            for (size_t i = begin; i < static_cast<size_t>(r1) * width; i++)
+            {
+                const uint8_t *p = &padded[i * channels];
+                gray[i] = channels >= 3 ? luminance(p[0], p[1], p[2]) : p[0] / 255.0f;
+            }
+        });
+        StencilCpp<SobelXStencil>(pool, dx.data(), gray.data(), width, paddedRows, width,
+                          options.border, constant);
+        StencilCpp<SobelYStencil>(pool, dy.data(), gray.data(), width, paddedRows, width,
+                          options.border, constant);
+        pool.ParallelFor(numRows, HOST_BAND_ROWS, [&](int r0, int r1) {
+            for (size_t i = static_cast<size_t>(r0) * width; i < static_cast<size_t>(r1) * width; i++)
+            {
+                float x = dx[i + width] * scale;
+                float y = dy[i + width] * scale;
+                // The magnitude can reach sqrt(2), saturate instead of wrapping
+                edges[i] = static_cast<uint8_t>(std::min(sqrtf(x * x + y * y) * 255.0f, 255.0f));
+            }
+        });
+
+        if (!sink.WriteRows(edges.data(), numRows)) return Result::FileIOFailure;
+        stats.strips++;
+    }
+    stats.wallMs = ElapsedMs(wallBegin);
+    return Result::Ok;
+}
+
+/***************************************************************
+ * Each strip goes through SobelEdgesUint8Buffer as an image of
+ * numRows + 2 rows. Its first and last output rows see the border
+ * of the strip rather than the image and are dropped.
+ ****************************************************************/
+Result SobelStreamBuffer(sycl::queue &q, RowSource &source, RowSink &sink,
+                      const StreamOptions &options, StreamStats &stats)
+{
+    stats = StreamStats();
+    if (!IsValid(source, options)) return Result::InvalidArgument;
+    auto wallBegin = std::chrono::steady_clock::now();
+
+    const int width = source.Width();
+    const int channels = source.Channels();
+    const size_t paddedPixels = static_cast<size_t>(options.stripRows + 2) * width;
+    StripReader reader(source, options);
+
+    // A strip on the device. Destroying the buffers waits for the kernels
+    // and copies the edges back into out.
+    struct StripSlot
+    {
+        vector<uint8_t> in;
+        vector<uint8_t> out;
+        std::unique_ptr<buffer<uint8_t, 1>> inBuf;
+        std::unique_ptr<buffer<uint8_t, 1>> outBuf;
+        int numRows = 0;
+    };
+    StripSlot slots[2];
+    for (auto &slot : slots)
+    {
+        slot.in.resize(paddedPixels * channels);
+        slot.out.resize(paddedPixels);
+    }
+    stats.bytesAllocated = reader.BytesAllocated() + 2 * paddedPixels * (channels + 1);
+
+    bool writeFailed = false;
+    auto retire = [&](StripSlot &slot) {
+        if (!slot.outBuf) return;
+        slot.outBuf.reset();
+        slot.inBuf.reset();
+        if (!sink.WriteRows(slot.out.data() + width, slot.numRows)) writeFailed = true;
+        stats.strips++;
+    };
+
+    try
+    {
+        int s = 0;
+        for (;; s++)
+        {
+            // The slot still holds strip s - 2, strip s - 1 keeps the device busy
+            StripSlot &slot = slots[s % 2];
+            retire(slot);
+            if (writeFailed) break;
+
+            int y0;
+            Result result = reader.Next(slot.in.data(), y0, slot.numRows);
+            if (result != Result::Ok)
+            {
+                retire(slots[(s + 1) % 2]);
+                return result;
+            }
+            if (slot.numRows == 0) break;
+
+            const int paddedRows = slot.numRows + 2;
+            const size_t pixels = static_cast<size_t>(paddedRows) * width;
+            slot.inBuf.reset(new buffer<uint8_t, 1>(slot.in.data(), range<1>(pixels * channels)));
+            slot.inBuf->set_write_back(false);  // the input is never modified
+            slot.outBuf.reset(new buffer<uint8_t, 1>(slot.out.data(), range<1>(pixels)));
+            SobelEdgesUint8Buffer(q, *slot.inBuf, *slot.outBuf, width, paddedRows, channels,
+                                  false, options.border, ConstantGray(options, channels));
+        }
+        retire(slots[(s + 1) % 2]);
+    } catch (std::exception const &e) {
+        cout << "SobelStreamBuffer exception: " << e.what() << std::endl;
+        terminate();
+    }
+
+    stats.wallMs = ElapsedMs(wallBegin);
+    return writeFailed ? Result::FileIOFailure : Result::Ok;
+}
@@ -0,0 +1,95 @@
+#include "threadPool.h"
+
+/***************************************************************
+ * 
+ ****************************************************************/
+ThreadPool::ThreadPool(int numThreads)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (numThreads <= 0) numThreads = 1;
+    }
+    for (int i = 1; i < numThreads; i++)
+    {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : workers_) t.join();
+}
+
+/***************************************************************
+ * Take chunks of the current job until there are none left
+ ****************************************************************/
+void ThreadPool::RunChunks()
+{
+    for (;;)
+    {
+        int begin = next_.fetch_add(grain_);
+        if (begin >= count_) break;
+        int end = begin + grain_ < count_ ? begin + grain_ : count_;
+        (*fn_)(begin, end);
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned seenJob = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || jobId_ != seenJob; });
+            if (stop_) return;
+            seenJob = jobId_;
+        }
+        RunChunks();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+}
+
+/***************************************************************
+ * 
+ ****************************************************************/
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int, int)> &fn)
+{
+    if (count <= 0) return;
+    if (grain < 1) grain = 1;
+    if (workers_.empty() || count <= grain)
+    {
+        for (int begin = 0; begin < count; begin += grain)
+        {
+            fn(begin, begin + grain < count ? begin + grain : count);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = &fn;
+        count_ = count;
+        grain_ = grain;
+        next_ = 0;
+        busy_ = static_cast<int>(workers_.size());
+        jobId_++;
+    }
+    wake_.notify_all();
+
+    // The calling thread works too
+    RunChunks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return busy_ == 0; });
+    fn_ = nullptr;
+}
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
+
+#include "workGroupTuner.h"
+#include "imageUtilsAgnostic.h"
+#include "imageUtilsUsingBuffers.h"
+#include "stageProfiler.h"
+
+using namespace sycl;
+using namespace std;
+
+namespace {
+
+const char *kernelNames[] = {
+    "Convolution3x3", "SeparableFilter", "GaussianBlur", "SobelSeparable", "SobelFused",
+    "SobelEdgesUint8", "SobelFixed", "CannyClassify", "CannyHysteresis", "Stencil"
+};
+static_assert(sizeof(kernelNames) / sizeof(kernelNames[0]) == static_cast<size_t>(TunedKernel::Count),
+              "one name per TunedKernel");
+
+// Profiled stages (see ProfileStage) of the kernels launched with each
+// TunedKernel's shape, whose device time the tuner compares
+const char *kernelStages[][4] = {
+    {"Convolution3x3"},
+    {"SeparableHorizontal", "SeparableVertical"},
+    {"GaussianHorizontal", "GaussianVertical"},
+    {"SobelDxHorizontal", "SobelDxVertical", "SobelDyHorizontal", "SobelDyVertical"},
+    {"SobelFused"},
+    {"SobelEdgesMax", "SobelEdges"},
+    {"SobelFixed"},
+    {"CannyClassify"},
+    {"CannyHysteresis"},
+    {"Stencil"}
+};
+static_assert(sizeof(kernelStages) / sizeof(kernelStages[0]) == static_cast<size_t>(TunedKernel::Count),
+              "stages per TunedKernel");
+
+// Bytes per pixel of the local memory tile of the tile kernels
+size_t TileElementSize(TunedKernel kernel)
+{
+    switch (kernel)
+    {
+    case TunedKernel::SobelFused:
+    case TunedKernel::SobelEdgesUint8: return sizeof(float);
+    case TunedKernel::SobelFixed:
+    case TunedKernel::CannyHysteresis: return sizeof(uint8_t);
+    default: return 0;
+    }
+}
+
+struct DeviceLimits
+{
+    std::string name;
+    size_t maxWorkGroupSize = 0;
+    size_t localMemSize = 0;
+    // Smallest work_group_size of the program's kernels on the device, which
+    // can be below maxWorkGroupSize for kernels with local memory or
+    // reductions. 0 until queried, or if it couldn't be.
+    size_t kernelWorkGroupSize = 0;
+    bool kernelLimitQueried = false;
+};
+
+// device name, width, height, kernel
+using ShapeKey = std::tuple<std::string, int, int, int>;
+
+struct TunerState
+{
+    std::mutex mutex;
+    std::string cacheFile = WORK_GROUP_CACHE_FILE;
+    std::unordered_map<sycl::device, DeviceLimits> devices;
+    std::map<ShapeKey, WorkGroupShape> shapes;
+};
+
+TunerState &State()
+{
+    static TunerState state;
+    return state;
+}
+
+bool Fits(const DeviceLimits &limits, TunedKernel kernel, WorkGroupShape shape)
+{
+    if (!shape.IsSet()) return !IsTileKernel(kernel);
+    size_t items = static_cast<size_t>(shape.x) * shape.y;
+    if (items > limits.maxWorkGroupSize) return false;
+    if (limits.kernelWorkGroupSize > 0 && items > limits.kernelWorkGroupSize) return false;
+    size_t tileBytes = static_cast<size_t>(shape.x + 2) * (shape.y + 2) * TileElementSize(kernel);
+    return tileBytes <= limits.localMemSize;
+}
+
+WorkGroupShape DefaultShape(TunedKernel kernel)
+{
+    WorkGroupShape shape;
+    if (IsTileKernel(kernel))
+    {
+        shape.x = SOBEL_TILE_WIDTH;
+        shape.y = SOBEL_TILE_HEIGHT;
+    }
+    return shape;
+}
+
+bool ParseKernelName(const std::string &name, TunedKernel &kernel)
+{
+    for (int i = 0; i < static_cast<int>(TunedKernel::Count); i++)
+    {
+        if (name == kernelNames[i])
+        {
+            kernel = static_cast<TunedKernel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/***************************************************************
+ * The cache file has one shape per line, tab separated since
+ * device names have spaces:
+ * device  width  height  kernel  x  y
+ ****************************************************************/
+bool ParseCacheLine(const std::string &line, ShapeKey &key, WorkGroupShape &shape, std::string *pLine = nullptr)
+{
+    if (line.empty() || line[0] == '#') return false;
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t')) fields.push_back(field);
+    TunedKernel kernel;
+    if (fields.size() < 6 || !ParseKernelName(fields[3], kernel)) return false;
+    key = ShapeKey(fields[0], std::atoi(fields[1].c_str()), std::atoi(fields[2].c_str()), static_cast<int>(kernel));
+    shape.x = std::atoi(fields[4].c_str());
+    shape.y = std::atoi(fields[5].c_str());
+    if (pLine) *pLine = line;
+    return true;
+}
+
+// Called with the state locked, the first time a device is seen
+void LoadCache(TunerState &state, const std::string &deviceName)
+{
+    std::ifstream file(state.cacheFile);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        ShapeKey key;
+        WorkGroupShape shape;
+        if (ParseCacheLine(line, key, shape) && std::get<0>(key) == deviceName) state.shapes[key] = shape;
+    }
+}
+
+DeviceLimits &GetDeviceLimits(TunerState &state, const sycl::device &device)
+{
+    auto found = state.devices.find(device);
+    if (found != state.devices.end()) return found->second;
+
+    DeviceLimits limits;
+    limits.name = device.get_info<info::device::name>();
+    limits.maxWorkGroupSize = device.get_info<info::device::max_work_group_size>();
+    limits.localMemSize = device.get_info<info::device::local_mem_size>();
+    LoadCache(state, limits.name);
+    return state.devices.emplace(device, limits).first->second;
+}
+
+// Builds the program's kernels for the device the first time, so it is only
+// done when a shape other than the default is about to be used
+void QueryKernelLimit(DeviceLimits &limits, const sycl::queue &q)
+{
+    if (limits.kernelLimitQueried) return;
+    limits.kernelLimitQueried = true;
+    try
+    {
+        auto bundle = get_kernel_bundle<bundle_state::executable>(q.get_context(), {q.get_device()});
+        for (const sycl::kernel &k : bundle)
+        {
+            size_t size = k.get_info<info::kernel_device_specific::work_group_size>(q.get_device());
+            limits.kernelWorkGroupSize = limits.kernelWorkGroupSize == 0 ? size
+                                                                          : std::min(limits.kernelWorkGroupSize, size);
+        }
+    } catch (sycl::exception const &) {
+        // The kernels can't be built ahead of use, only the device limit applies
+    }
+}
+
+// Summed device time of kernel's stages recorded by profiler, or a
+// negative value if they weren't profiled
+double StageMs(StageProfiler &profiler, TunedKernel kernel)
+{
+    double ms = 0;
+    bool found = false;
+    for (const StageStats &stats : profiler.Stats())
+    {
+        for (const char *stage : kernelStages[static_cast<int>(kernel)])
+        {
+            if (stage && stats.name == stage && stats.count > 0)
+            {
+                ms += stats.totalMs;
+                found = true;
+            }
+        }
+    }
+    return found && profiler.Unprofiled() == 0 ? ms : -1.0;
+}
+
+Result SaveCache(TunerState &state, const std::string &deviceName, int width, int height)
+{
+    // Keep the lines of other devices and sizes, replace ours
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(state.cacheFile);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            ShapeKey key;
+            WorkGroupShape shape;
+            if (!ParseCacheLine(line, key, shape)) continue;
+            if (std::get<0>(key) == deviceName && std::get<1>(key) == width && std::get<2>(key) == height) continue;
+            lines.push_back(line);
+        }
+    }
+
+    std::ofstream file(state.cacheFile, std::ios::trunc);
+    if (!file) return Result::FileIOFailure;
+    file << "# device\twidth\theight\tkernel\tx\ty\n";
+    for (auto &line : lines) file << line << "\n";
+    for (auto &entry : state.shapes)
+    {
+        const ShapeKey &key = entry.first;
+        if (std::get<0>(key) != deviceName || std::get<1>(key) != width || std::get<2>(key) != height) continue;
+        file << deviceName << "\t" << width << "\t" << height << "\t" << kernelNames[std::get<3>(key)] << "\t"
+             << entry.second.x << "\t" << entry.second.y << "\n";
+    }
+    return file ? Result::Ok : Result::FileIOFailure;
+}
+
+double MedianMs(std::vector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+} // namespace
+
+const char *TunedKernelName(TunedKernel kernel)
+{
+    int i = static_cast<int>(kernel);
+    return i >= 0 && i < static_cast<int>(TunedKernel::Count) ? kernelNames[i] : "Unknown";
+}
+
+bool IsTileKernel(TunedKernel kernel)
+{
+    return TileElementSize(kernel) != 0;
+}
+
+/***************************************************************
+ *
+ ****************************************************************/
+WorkGroupShape GetWorkGroupShape(const sycl::queue &q, TunedKernel kernel, int width, int height)
+{
+    TunerState &state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    DeviceLimits &limits = GetDeviceLimits(state, q.get_device());
+    auto found = state.shapes.find(ShapeKey(limits.name, width, height, static_cast<int>(kernel)));
+    if (found == state.shapes.end()) return DefaultShape(kernel);
+    if (found->second.IsSet()) QueryKernelLimit(limits, q);
+    if (Fits(limits, kernel, found->second)) return found->second;
+    return DefaultShape(kernel);
+}
+
+void SetWorkGroupCacheFile(const std::string &path)
+{
+    TunerState &state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.cacheFile = path;
+    state.devices.clear();
+    state.shapes.clear();
+}
+
+/***************************************************************
+ * Each candidate is put in the shape table, then the function that
+ * launches the kernel is run, so the kernels pick it up through
+ * GetWorkGroupShape like any later run would. Runs go to a
+ * profiling queue and only the device time of the tuned kernel's
+ * stages counts, not the rest of the function (e.g. the other
+ * Canny kernel). Without profiling the function's wall time is
+ * used.
+ *
+ * The functions are the OrThrow versions and the queue's handler
+ * rethrows, so a candidate the runtime rejects, when submitted or
+ * while running, is skipped and its table entry put back.
+ ****************************************************************/
+Result TuneWorkGroups(sycl::queue &q, int width, int height, std::vector<TunedShape> &results,
+                      int iterations)
+{
+    results.clear();
+    if (width <= 0 || height <= 0) return Result::InvalidArgument;
+    iterations = std::max(iterations, 1);
+
+    TunerState &state = State();
+    DeviceLimits limits;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        DeviceLimits &deviceLimits = GetDeviceLimits(state, q.get_device());
+        QueryKernelLimit(deviceLimits, q);
+        limits = deviceLimits;
+    }
+
+    // Same context as q, so the results apply to q. Asynchronous errors are
+    // rethrown by wait_and_throw rather than given to q's handler.
+    const bool profiled = q.get_device().has(aspect::queue_profiling);
+    auto rethrow = [](exception_list errors) {
+        for (const std::exception_ptr &e : errors) std::rethrow_exception(e);
+    };
+    queue tq(q.get_context(), q.get_device(), rethrow,
+             profiled ? property_list{property::queue::enable_profiling()} : property_list{});
+
+    // Test images: a gradient with some texture, so Canny finds edges
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> rgb(numPixels * 3);
+    std::vector<float> gray(numPixels);
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        int x = static_cast<int>(i % width);
+        int y = static_cast<int>(i / width);
+        uint8_t v = static_cast<uint8_t>((x * 3 + y * 5 + ((x / 16 + y / 16) & 1) * 96) & 0xFF);
+        rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = v;
+        gray[i] = v / 255.0f;
+    }
+    buffer<uint8_t, 1> rgb_buffer{rgb.data(), range<1>(rgb.size())};
+    buffer<float, 1> gray_buffer{gray.data(), range<1>(numPixels)};
+    rgb_buffer.set_write_back(false);
+    gray_buffer.set_write_back(false);
+    buffer<float, 1> fl_out_buffer{range<1>(numPixels)};
+    buffer<uint8_t, 1> u8_out_buffer{range<1>(numPixels)};
+    SobelContext ctx(tq, width, height);
+
+    const float sobelX[9] = {1, 0, -1, 2, 0, -2, 1, 0, -1};
+    const std::vector<float> binomial = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    auto run = [&](TunedKernel kernel) {
+        switch (kernel)
+        {
+        case TunedKernel::Convolution3x3:
+            Convolution3x3BufferOrThrow(tq, gray_buffer, fl_out_buffer, sobelX, width, height,
+                                        Border::Clamp, 0.0f); break;
+        case TunedKernel::SeparableFilter:
+            SeparableFilterBufferOrThrow(tq, gray_buffer, fl_out_buffer, binomial, binomial, width, height,
+                                         Border::Clamp, 0.0f); break;
+        case TunedKernel::GaussianBlur:
+            GaussianBlurBufferOrThrow(tq, gray_buffer, fl_out_buffer, width, height, 1.0f,
+                                      Border::Clamp, 0.0f); break;
+        case TunedKernel::SobelSeparable:
+            SobelFilter(ctx, gray_buffer, fl_out_buffer); break;   // has no catch
+        case TunedKernel::SobelFused:
+            SobelFilterFusedOrThrow(tq, gray_buffer, fl_out_buffer, width, height, Border::Clamp, 0.0f); break;
+        case TunedKernel::SobelEdgesUint8:
+            SobelEdgesUint8BufferOrThrow(tq, rgb_buffer, u8_out_buffer, width, height, 3, true,
+                                         Border::Clamp, 0.0f); break;
+        case TunedKernel::SobelFixed:
+            SobelFixedBufferOrThrow(tq, rgb_buffer, u8_out_buffer, width, height, 3, 2, Border::Clamp, 0); break;
+        case TunedKernel::Stencil:
+            StencilBufferOrThrow<SobelXStencil>(tq, gray_buffer, fl_out_buffer, width, height,
+                                                Border::Clamp, 0.0f); break;
+        default:
+            CannyBufferOrThrow(ctx, gray_buffer, u8_out_buffer, 1.0f, 0.1f, 0.3f); break;
+        }
+        tq.wait_and_throw();
+    };
+    auto timeShape = [&](TunedKernel kernel, WorkGroupShape shape) {
+        const ShapeKey key(limits.name, width, height, static_cast<int>(kernel));
+        bool hadShape;
+        WorkGroupShape previousShape;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            auto found = state.shapes.find(key);
+            hadShape = found != state.shapes.end();
+            if (hadShape) previousShape = found->second;
+            state.shapes[key] = shape;
+        }
+        try
+        {
+            run(kernel);    // warm up, including the JIT of the kernel
+            std::vector<double> times;
+            for (int i = 0; i < iterations; i++)
+            {
+                StageProfiler profiler;
+                StageProfiler *previous = SetStageProfiler(&profiler);
+                auto begin = std::chrono::steady_clock::now();
+                try
+                {
+                    run(kernel);
+                } catch (...) {
+                    SetStageProfiler(previous);
+                    throw;
+                }
+                double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                SetStageProfiler(previous);
+                double deviceMs = StageMs(profiler, kernel);
+                times.push_back(deviceMs >= 0 ? deviceMs : wallMs);
+            }
+            return MedianMs(times);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (hadShape) state.shapes[key] = previousShape;
+            else state.shapes.erase(key);
+            throw;
+        }
+    };
+    // Median ms of shape, or infinity if the runtime rejects it
+    auto tryShape = [&](TunedKernel kernel, WorkGroupShape shape) {
+        try
+        {
+            return timeShape(kernel, shape);
+        } catch (sycl::exception const &) {
+            return std::numeric_limits<double>::infinity();
+        }
+    };
+
+    for (int k = 0; k < static_cast<int>(TunedKernel::Count); k++)
+    {
+        TunedKernel kernel = static_cast<TunedKernel>(k);
+        TunedShape best;
+        best.kernel = kernel;
+        best.shape = DefaultShape(kernel);
+        best.defaultMs = best.ms = tryShape(kernel, best.shape);
+
+        for (int y : {1, 2, 4, 8, 16, 32})
+        {
+            for (int x : {8, 16, 32, 64, 128, 256})
+            {
+                WorkGroupShape shape;
+                shape.x = x;
+                shape.y = y;
+                if (!Fits(limits, kernel, shape)) continue;
+                if (shape.x == best.shape.x && shape.y == best.shape.y && best.ms == best.defaultMs) continue;
+                double ms = tryShape(kernel, shape);
+                if (ms < best.ms)
+                {
+                    best.ms = ms;
+                    best.shape = shape;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.shapes[ShapeKey(limits.name, width, height, k)] = best.shape;
+        results.push_back(best);
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return SaveCache(state, limits.name, width, height);
+}